@@ -1,5 +1,7 @@
 #include "ble_gatt.h"
 #include "config.h"
+#include "deferred_log.h"
+#include "trace_capture.h"
 #include "sdkconfig.h"
 
 #if CONFIG_BT_ENABLED
@@ -8,6 +10,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "nimble/nimble_port.h"
@@ -43,6 +46,35 @@ static uint16_t s_tx_attr_handle = 0;
 static ble_gatt_rx_callback_t s_rx_callback = NULL;
 static bool s_initialized = false;
 
+// Advertising schedule (intervals in 0.625 ms units, per Apple accessory
+// guidelines: 20 ms for the first 30 s, then step down to ~1 s)
+typedef struct {
+    uint16_t itvl;          // Advertising interval (0.625 ms units)
+    int32_t duration_ms;    // Time to stay in this phase (BLE_HS_FOREVER = last)
+} adv_phase_t;
+
+static const adv_phase_t s_adv_phases[] = {
+    { 32,   CONFIG_BLE_ADV_FAST_DURATION_MS },  // 20 ms
+    { 244,  CONFIG_BLE_ADV_STEP_DURATION_MS },  // 152.5 ms
+    { 874,  CONFIG_BLE_ADV_STEP_DURATION_MS },  // 546.25 ms
+    { 1636, BLE_HS_FOREVER },                   // 1022.5 ms
+};
+#define ADV_PHASE_COUNT (sizeof(s_adv_phases) / sizeof(s_adv_phases[0]))
+
+// Average random advDelay added to every advertising event (0-10 ms)
+#define ADV_DELAY_AVG_US 5000
+// Per-PDU overhead on 1M PHY: preamble(1) + access addr(4) + header(2) + AdvA(6) + CRC(3)
+#define ADV_PDU_OVERHEAD_BYTES 16
+
+static uint8_t s_adv_phase = 0;
+static uint8_t s_adv_data_len = 0;          // Primary payload length (bytes)
+static bool s_adv_uuid_in_primary = false;
+static int64_t s_adv_phase_start_us = 0;    // When the current phase started
+static int64_t s_adv_discovery_start_us = 0;// Boot/disconnect time (0 = not discovering)
+static int64_t s_adv_last_discovery_us = -1;
+static uint64_t s_adv_air_us = 0;           // Estimated radio-on time since boot
+static uint32_t s_connect_count = 0;
+
 // Forward declarations
 static int ble_gap_event(struct ble_gap_event *event, void *arg);
 static void ble_on_sync(void);
@@ -57,21 +89,26 @@ static int gatt_chr_access_rx(uint16_t conn_handle, uint16_t attr_handle,
         uint16_t len = OS_MBUF_PKTLEN(om);
 
         if (len > 0) {
+            trace_capture_begin(TC_EV_GATT_RX, len);
             uint8_t buf[256];
             uint16_t copy_len = len < sizeof(buf) ? len : sizeof(buf);
             os_mbuf_copydata(om, 0, copy_len, buf);
 
-            ESP_LOGI(TAG, "RX: %d bytes", copy_len);
-            ESP_LOG_BUFFER_HEX(TAG, buf, copy_len);
+            DLOG(DLOG_BLE_RX, copy_len, buf[0],
+                 copy_len > 1 ? buf[1] : 0, copy_len > 2 ? buf[2] : 0);
 
+            esp_err_t err = ESP_OK;
             if (s_rx_callback != NULL) {
-                ESP_LOGI(TAG, "Calling RX callback");
-                s_rx_callback(buf, copy_len);
+                err = s_rx_callback(buf, copy_len);
             } else {
-                ESP_LOGW(TAG, "No RX callback registered!");
+                DLOG(DLOG_BLE_RX_NO_CALLBACK);
+            }
+            trace_capture_end(TC_EV_GATT_RX, len);
+            if (err != ESP_OK) {
+                return BLE_ATT_ERR_INSUFFICIENT_RES;
             }
         } else {
-            ESP_LOGW(TAG, "RX: empty write received");
+            DLOG(DLOG_BLE_RX_EMPTY);
         }
         return 0;
     }
@@ -111,49 +148,123 @@ static const struct ble_gatt_svc_def gatt_svcs[] = {
     {0}, // Terminator
 };
 
-// Start advertising
-static void ble_advertise(void)
+// Estimated on-air time of one advertising event (3 channels)
+static uint32_t adv_event_air_us(void)
+{
+    return 3 * (ADV_PDU_OVERHEAD_BYTES + s_adv_data_len) * 8;
+}
+
+// Advertising event period for a phase, including average advDelay
+static uint32_t adv_period_us(uint8_t phase)
+{
+    return s_adv_phases[phase].itvl * 625 + ADV_DELAY_AVG_US;
+}
+
+// Add the airtime spent in the current phase to the running total
+static void adv_account(int64_t now)
+{
+    if (s_state != BLE_STATE_ADVERTISING || s_adv_phase_start_us == 0) {
+        return;
+    }
+    uint64_t elapsed = now - s_adv_phase_start_us;
+    s_adv_air_us += elapsed / adv_period_us(s_adv_phase) * adv_event_air_us();
+    s_adv_phase_start_us = now;
+}
+
+// Build advertising payload. The service UUID goes into the primary packet
+// so iOS scan filters match without waiting for a scan response; the name
+// moves to the scan response if both don't fit.
+static int ble_set_adv_data(void)
 {
-    struct ble_gap_adv_params adv_params;
     struct ble_hs_adv_fields fields;
     struct ble_hs_adv_fields rsp_fields;
+    const uint8_t name_len = strlen(CONFIG_BLE_DEVICE_NAME);
     int rc;
 
-    // Main advertising data: flags + name
+    // Field sizes: flags (3), 128-bit UUID (2 + 16), name (2 + len)
+    const int flags_size = 3;
+    const int uuid_size = 2 + 16;
+    const int name_size = 2 + name_len;
+
     memset(&fields, 0, sizeof(fields));
+    memset(&rsp_fields, 0, sizeof(rsp_fields));
     fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
-    fields.name = (uint8_t *)CONFIG_BLE_DEVICE_NAME;
-    fields.name_len = strlen(CONFIG_BLE_DEVICE_NAME);
-    fields.name_is_complete = 1;
 
-    ESP_LOGI(TAG, "Setting adv data: name='%s' len=%d", CONFIG_BLE_DEVICE_NAME, fields.name_len);
+    if (flags_size + uuid_size <= BLE_HS_ADV_MAX_SZ) {
+        fields.uuids128 = (ble_uuid128_t *)&nus_service_uuid;
+        fields.num_uuids128 = 1;
+        fields.uuids128_is_complete = 1;
+        s_adv_uuid_in_primary = true;
+        s_adv_data_len = flags_size + uuid_size;
+
+        int room = BLE_HS_ADV_MAX_SZ - s_adv_data_len - 2;
+        if (name_size <= BLE_HS_ADV_MAX_SZ - s_adv_data_len) {
+            // Everything fits in the primary packet
+            fields.name = (uint8_t *)CONFIG_BLE_DEVICE_NAME;
+            fields.name_len = name_len;
+            fields.name_is_complete = 1;
+            s_adv_data_len += name_size;
+        } else {
+            // Shortened name in primary, complete name in scan response
+            if (room > 0) {
+                fields.name = (uint8_t *)CONFIG_BLE_DEVICE_NAME;
+                fields.name_len = room;
+                fields.name_is_complete = 0;
+                s_adv_data_len += 2 + room;
+            }
+            rsp_fields.name = (uint8_t *)CONFIG_BLE_DEVICE_NAME;
+            rsp_fields.name_len = name_len;
+            rsp_fields.name_is_complete = 1;
+        }
+    } else {
+        // Fallback: name in primary, UUID in scan response
+        fields.name = (uint8_t *)CONFIG_BLE_DEVICE_NAME;
+        fields.name_len = name_len;
+        fields.name_is_complete = 1;
+        rsp_fields.uuids128 = (ble_uuid128_t *)&nus_service_uuid;
+        rsp_fields.num_uuids128 = 1;
+        rsp_fields.uuids128_is_complete = 1;
+        s_adv_uuid_in_primary = false;
+        s_adv_data_len = flags_size + name_size;
+    }
 
     rc = ble_gap_adv_set_fields(&fields);
     if (rc != 0) {
         ESP_LOGE(TAG, "Failed to set adv fields: %d", rc);
-        return;
+        return rc;
     }
 
-    // Scan response data: 128-bit service UUID
-    memset(&rsp_fields, 0, sizeof(rsp_fields));
-    rsp_fields.uuids128 = (ble_uuid128_t *)&nus_service_uuid;
-    rsp_fields.num_uuids128 = 1;
-    rsp_fields.uuids128_is_complete = 1;
-
     rc = ble_gap_adv_rsp_set_fields(&rsp_fields);
     if (rc != 0) {
         ESP_LOGE(TAG, "Failed to set scan rsp fields: %d", rc);
+        return rc;
+    }
+
+    ESP_LOGI(TAG, "Adv data set: %d bytes, UUID in %s", s_adv_data_len,
+             s_adv_uuid_in_primary ? "primary" : "scan rsp");
+    return 0;
+}
+
+// Start advertising in the current schedule phase
+static void ble_advertise(void)
+{
+    struct ble_gap_adv_params adv_params;
+    int rc;
+
+    if (s_adv_data_len == 0 && ble_set_adv_data() != 0) {
         return;
     }
 
-    ESP_LOGI(TAG, "Adv and scan rsp data set successfully");
+    const adv_phase_t *phase = &s_adv_phases[s_adv_phase];
 
     // Advertising parameters
     memset(&adv_params, 0, sizeof(adv_params));
     adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;  // Connectable
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;  // General discoverable
+    adv_params.itvl_min = phase->itvl;
+    adv_params.itvl_max = phase->itvl;
 
-    rc = ble_gap_adv_start(BLE_OWN_ADDR_PUBLIC, NULL, BLE_HS_FOREVER,
+    rc = ble_gap_adv_start(BLE_OWN_ADDR_PUBLIC, NULL, phase->duration_ms,
                            &adv_params, ble_gap_event, NULL);
     if (rc != 0) {
         ESP_LOGE(TAG, "Failed to start advertising: %d", rc);
@@ -161,56 +272,74 @@ static void ble_advertise(void)
     }
 
     s_state = BLE_STATE_ADVERTISING;
-    ESP_LOGI(TAG, "Advertising started as '%s'", CONFIG_BLE_DEVICE_NAME);
+    s_adv_phase_start_us = esp_timer_get_time();
+    DLOG(DLOG_BLE_ADV_START, s_adv_phase, phase->itvl * 625);
+}
+
+// Restart the schedule at the fastest interval (boot or disconnect)
+static void ble_advertise_fast(void)
+{
+    s_adv_phase = 0;
+    s_adv_discovery_start_us = esp_timer_get_time();
+    ble_advertise();
 }
 
 // GAP event handler
 static int ble_gap_event(struct ble_gap_event *event, void *arg)
 {
-    ESP_LOGI(TAG, "GAP event: type=%d", event->type);
-
     switch (event->type) {
         case BLE_GAP_EVENT_CONNECT:
-            ESP_LOGI(TAG, "GAP_EVENT_CONNECT: status=%d", event->connect.status);
             if (event->connect.status == 0) {
+                int64_t now = esp_timer_get_time();
+                adv_account(now);
+                if (s_adv_discovery_start_us != 0) {
+                    s_adv_last_discovery_us = now - s_adv_discovery_start_us;
+                    s_adv_discovery_start_us = 0;
+                }
+                s_connect_count++;
                 s_conn_handle = event->connect.conn_handle;
                 s_state = BLE_STATE_CONNECTED;
-                ESP_LOGI(TAG, "Client connected (handle=%d)", s_conn_handle);
+                DLOG(DLOG_BLE_GAP_CONNECT, 0, s_conn_handle, s_adv_last_discovery_us / 1000);
             } else {
-                ESP_LOGW(TAG, "Connection failed: %d", event->connect.status);
+                DLOG(DLOG_BLE_GAP_CONNECT, event->connect.status, BLE_HS_CONN_HANDLE_NONE, 0);
                 ble_advertise();
             }
             break;
 
         case BLE_GAP_EVENT_DISCONNECT:
-            ESP_LOGI(TAG, "GAP_EVENT_DISCONNECT: reason=%d", event->disconnect.reason);
+            DLOG(DLOG_BLE_GAP_DISCONNECT, event->disconnect.reason);
             s_conn_handle = BLE_HS_CONN_HANDLE_NONE;
             s_state = BLE_STATE_IDLE;
-            ble_advertise();
+            ble_advertise_fast();
             break;
 
         case BLE_GAP_EVENT_ADV_COMPLETE:
-            ESP_LOGI(TAG, "GAP_EVENT_ADV_COMPLETE");
-            ble_advertise();
+            if (s_state == BLE_STATE_ADVERTISING) {
+                // Phase duration expired - back off to the next interval
+                adv_account(esp_timer_get_time());
+                if (s_adv_phase < ADV_PHASE_COUNT - 1) {
+                    s_adv_phase++;
+                }
+                DLOG(DLOG_BLE_GAP_ADV_COMPLETE, event->adv_complete.reason, s_adv_phase);
+                ble_advertise();
+            }
             break;
 
         case BLE_GAP_EVENT_MTU:
-            ESP_LOGI(TAG, "GAP_EVENT_MTU: value=%d", event->mtu.value);
+            DLOG(DLOG_BLE_GAP_MTU, event->mtu.value);
             break;
 
         case BLE_GAP_EVENT_SUBSCRIBE:
-            ESP_LOGI(TAG, "GAP_EVENT_SUBSCRIBE: attr_handle=%d, notify=%d, indicate=%d",
-                     event->subscribe.attr_handle,
-                     event->subscribe.cur_notify,
-                     event->subscribe.cur_indicate);
+            DLOG(DLOG_BLE_GAP_SUBSCRIBE, event->subscribe.attr_handle,
+                 event->subscribe.cur_notify, event->subscribe.cur_indicate);
             break;
 
         case BLE_GAP_EVENT_NOTIFY_TX:
-            ESP_LOGI(TAG, "GAP_EVENT_NOTIFY_TX: status=%d", event->notify_tx.status);
+            DLOG(DLOG_BLE_GAP_NOTIFY_TX, event->notify_tx.status);
             break;
 
         default:
-            ESP_LOGI(TAG, "Unhandled GAP event: %d", event->type);
+            DLOG(DLOG_BLE_GAP_OTHER, event->type);
             break;
     }
     return 0;
@@ -230,7 +359,7 @@ static void ble_on_sync(void)
     }
 
     // Start advertising
-    ble_advertise();
+    ble_advertise_fast();
 }
 
 // NimBLE host task
@@ -312,6 +441,8 @@ esp_err_t ble_gatt_stop(void)
         ESP_LOGW(TAG, "Failed to stop advertising: %d", rc);
     }
 
+    adv_account(esp_timer_get_time());
+    s_adv_discovery_start_us = 0;
     s_state = BLE_STATE_IDLE;
     ESP_LOGI(TAG, "BLE GATT stopped");
     return ESP_OK;
@@ -327,6 +458,34 @@ ble_gatt_state_t ble_gatt_get_state(void)
     return s_state;
 }
 
+void ble_gatt_get_adv_stats(ble_gatt_adv_stats_t *stats)
+{
+    int64_t now = esp_timer_get_time();
+    bool advertising = (s_state == BLE_STATE_ADVERTISING);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->advertising = advertising;
+    stats->uuid_in_primary = s_adv_uuid_in_primary;
+    stats->adv_phase = s_adv_phase;
+    stats->adv_interval_us = s_adv_phases[s_adv_phase].itvl * 625;
+    stats->connect_count = s_connect_count;
+    stats->last_discovery_ms = s_adv_last_discovery_us < 0 ? -1 : (int32_t)(s_adv_last_discovery_us / 1000);
+
+    // Current duty cycle: airtime of one event over the event period
+    if (advertising) {
+        stats->adv_duty_ppm = (uint64_t)adv_event_air_us() * 1000000 / adv_period_us(s_adv_phase);
+    }
+
+    // Average duty cycle since boot, including the still-running phase
+    uint64_t air_us = s_adv_air_us;
+    if (advertising && s_adv_phase_start_us != 0) {
+        air_us += (uint64_t)(now - s_adv_phase_start_us) / adv_period_us(s_adv_phase) * adv_event_air_us();
+    }
+    if (now > 0) {
+        stats->adv_avg_duty_ppm = air_us * 1000000 / now;
+    }
+}
+
 void ble_gatt_set_rx_callback(ble_gatt_rx_callback_t callback)
 {
     s_rx_callback = callback;
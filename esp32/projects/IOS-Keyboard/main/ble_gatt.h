@@ -16,10 +16,26 @@ typedef enum {
     BLE_STATE_CONNECTED,
 } ble_gatt_state_t;
 
+/**
+ * Advertising scheduler statistics
+ */
+typedef struct {
+    bool advertising;           // Currently advertising
+    bool uuid_in_primary;       // Service UUID is in the primary adv packet
+    uint8_t adv_phase;          // Schedule phase (0 = fastest)
+    uint32_t adv_interval_us;   // Interval of the current phase
+    uint32_t adv_duty_ppm;      // Estimated radio duty cycle of current phase (parts per million)
+    uint32_t adv_avg_duty_ppm;  // Estimated radio duty cycle averaged since boot
+    int32_t last_discovery_ms;  // Boot/disconnect to connect time (-1 = never connected)
+    uint32_t connect_count;     // Number of successful connections
+} ble_gatt_adv_stats_t;
+
 /**
  * Callback type for received data on RX characteristic
+ * Runs on the NimBLE host task before the write is acknowledged; an error
+ * rejects the write (ATT "insufficient resources") so the client can retry.
  */
-typedef void (*ble_gatt_rx_callback_t)(const uint8_t *data, size_t len);
+typedef esp_err_t (*ble_gatt_rx_callback_t)(const uint8_t *data, size_t len);
 
 #if CONFIG_BT_ENABLED
 
@@ -48,6 +64,11 @@ bool ble_gatt_is_connected(void);
  */
 ble_gatt_state_t ble_gatt_get_state(void);
 
+/**
+ * Get advertising scheduler statistics (discovery latency, duty cycle)
+ */
+void ble_gatt_get_adv_stats(ble_gatt_adv_stats_t *stats);
+
 /**
  * Set callback for received data
  * @param callback Function to call when data is received on RX characteristic
@@ -69,6 +90,7 @@ static inline esp_err_t ble_gatt_start(void) { return ESP_ERR_NOT_SUPPORTED; }
 static inline esp_err_t ble_gatt_stop(void) { return ESP_ERR_NOT_SUPPORTED; }
 static inline bool ble_gatt_is_connected(void) { return false; }
 static inline ble_gatt_state_t ble_gatt_get_state(void) { return BLE_STATE_IDLE; }
+static inline void ble_gatt_get_adv_stats(ble_gatt_adv_stats_t *stats) { *stats = (ble_gatt_adv_stats_t){ .last_discovery_ms = -1 }; }
 static inline void ble_gatt_set_rx_callback(ble_gatt_rx_callback_t callback) { (void)callback; }
 static inline esp_err_t ble_gatt_send(const uint8_t *data, size_t len) { (void)data; (void)len; return ESP_ERR_NOT_SUPPORTED; }
 
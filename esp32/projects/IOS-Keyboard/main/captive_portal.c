@@ -1,6 +1,8 @@
 #include "captive_portal.h"
 #include "wifi_manager.h"
 #include "config.h"
+#include "json_stream.h"
+#include "web_assets.h"
 
 #include <string.h>
 #include "esp_log.h"
@@ -10,82 +12,10 @@
 static const char *TAG = "captive";
 static httpd_handle_t s_server = NULL;
 
-// Embedded HTML for captive portal
-static const char CAPTIVE_PORTAL_HTML[] =
-"<!DOCTYPE html>"
-"<html><head>"
-"<meta name='viewport' content='width=device-width,initial-scale=1'>"
-"<title>IOS-Keyboard Setup</title>"
-"<style>"
-"body{font-family:Arial,sans-serif;margin:20px;background:#1a1a2e;color:#eee;}"
-"h1{color:#0f0;text-align:center;}"
-".container{max-width:400px;margin:0 auto;}"
-".card{background:#16213e;padding:20px;border-radius:10px;margin:10px 0;}"
-"input,select{width:100%;padding:12px;margin:8px 0;box-sizing:border-box;"
-"border:1px solid #0f0;border-radius:5px;background:#0f3460;color:#eee;}"
-"button{width:100%;padding:12px;background:#0f0;color:#000;border:none;"
-"border-radius:5px;cursor:pointer;font-weight:bold;margin-top:10px;}"
-"button:hover{background:#0c0;}"
-".network{padding:10px;margin:5px 0;background:#0f3460;border-radius:5px;"
-"cursor:pointer;display:flex;justify-content:space-between;}"
-".network:hover{background:#1a4a7a;}"
-".rssi{color:#0f0;}"
-".status{text-align:center;padding:10px;margin:10px 0;border-radius:5px;}"
-".success{background:#0f03;border:1px solid #0f0;}"
-".error{background:#f003;border:1px solid #f00;}"
-".loading{color:#ff0;}"
-"</style>"
-"</head><body>"
-"<div class='container'>"
-"<h1>IOS-Keyboard Setup</h1>"
-"<div class='card'>"
-"<h3>Available Networks</h3>"
-"<div id='networks'><p class='loading'>Scanning...</p></div>"
-"<button onclick='scan()'>Refresh</button>"
-"</div>"
-"<div class='card'>"
-"<h3>Connect to Network</h3>"
-"<form id='wifiForm'>"
-"<input type='text' id='ssid' name='ssid' placeholder='Network Name (SSID)' required>"
-"<input type='password' id='password' name='password' placeholder='Password'>"
-"<button type='submit'>Connect</button>"
-"</form>"
-"<div id='status'></div>"
-"</div>"
-"</div>"
-"<script>"
-"function scan(){"
-"document.getElementById('networks').innerHTML='<p class=\"loading\">Scanning...</p>';"
-"fetch('/scan').then(r=>r.json()).then(data=>{"
-"let html='';"
-"if(data.networks&&data.networks.length>0){"
-"data.networks.forEach(n=>{"
-"html+='<div class=\"network\" onclick=\"selectNetwork(\\''+n.ssid+'\\')\"><span>'+n.ssid+'</span><span class=\"rssi\">'+n.rssi+' dBm</span></div>';"
-"});}else{html='<p>No networks found</p>';}"
-"document.getElementById('networks').innerHTML=html;"
-"}).catch(e=>{document.getElementById('networks').innerHTML='<p class=\"error\">Scan failed</p>';});}"
-"function selectNetwork(ssid){document.getElementById('ssid').value=ssid;}"
-"document.getElementById('wifiForm').onsubmit=function(e){"
-"e.preventDefault();"
-"let ssid=document.getElementById('ssid').value;"
-"let pass=document.getElementById('password').value;"
-"document.getElementById('status').innerHTML='<p class=\"loading\">Connecting...</p>';"
-"fetch('/connect',{method:'POST',headers:{'Content-Type':'application/json'},"
-"body:JSON.stringify({ssid:ssid,password:pass})}).then(r=>r.json()).then(data=>{"
-"if(data.success){"
-"document.getElementById('status').innerHTML='<p class=\"status success\">Connected! Device will restart...</p>';"
-"}else{"
-"document.getElementById('status').innerHTML='<p class=\"status error\">Failed: '+data.message+'</p>';"
-"}}).catch(e=>{document.getElementById('status').innerHTML='<p class=\"status error\">Error: '+e+'</p>';});};"
-"scan();"
-"</script>"
-"</body></html>";
-
 // Handler for root page
 static esp_err_t root_handler(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, CAPTIVE_PORTAL_HTML, HTTPD_RESP_USE_STRLEN);
+    web_assets_send(req, "captive.html");
     return ESP_OK;
 }
 
@@ -96,25 +26,21 @@ static esp_err_t scan_handler(httpd_req_t *req)
     int8_t rssi[20];
     int count = wifi_manager_scan(ssids, rssi, 20);
 
-    cJSON *root = cJSON_CreateObject();
-    cJSON *networks = cJSON_CreateArray();
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_array_begin(&js, "networks");
 
     for (int i = 0; i < count; i++) {
-        cJSON *network = cJSON_CreateObject();
-        cJSON_AddStringToObject(network, "ssid", ssids[i]);
-        cJSON_AddNumberToObject(network, "rssi", rssi[i]);
-        cJSON_AddItemToArray(networks, network);
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "ssid", ssids[i]);
+        json_stream_int(&js, "rssi", rssi[i]);
+        json_stream_object_end(&js);
     }
 
-    cJSON_AddItemToObject(root, "networks", networks);
-    char *json = cJSON_PrintUnformatted(root);
-
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
-
-    free(json);
-    cJSON_Delete(root);
-    return ESP_OK;
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
 }
 
 // Handler for connect request
@@ -158,25 +84,16 @@ static esp_err_t connect_handler(httpd_req_t *req)
     // Try to connect
     esp_err_t err = wifi_manager_try_connect(ssid, password);
 
-    cJSON *response = cJSON_CreateObject();
     if (err == ESP_OK) {
         // Save credentials and schedule restart
         wifi_manager_save_credentials(ssid, password);
-        cJSON_AddBoolToObject(response, "success", true);
-        cJSON_AddStringToObject(response, "message", "Connected successfully");
+        json_stream_send_result(req, true, "Connected successfully");
     } else {
-        cJSON_AddBoolToObject(response, "success", false);
-        cJSON_AddStringToObject(response, "message", "Connection failed");
+        json_stream_send_result(req, false, "Connection failed");
         // Restart AP mode
         wifi_manager_start_ap();
     }
 
-    char *json = cJSON_PrintUnformatted(response);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
-
-    free(json);
-    cJSON_Delete(response);
     cJSON_Delete(root);
 
     // If connection successful, restart after short delay
@@ -194,20 +111,16 @@ static esp_err_t status_handler(httpd_req_t *req)
 {
     wifi_manager_status_t status = wifi_manager_get_status();
 
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "mode", status.mode == WIFI_MGR_MODE_AP ? "ap" : "sta");
-    cJSON_AddBoolToObject(root, "connected", status.connected);
-    cJSON_AddStringToObject(root, "ssid", status.ssid);
-    cJSON_AddStringToObject(root, "ip", status.ip_addr);
-    cJSON_AddNumberToObject(root, "rssi", status.rssi);
-
-    char *json = cJSON_PrintUnformatted(root);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
-
-    free(json);
-    cJSON_Delete(root);
-    return ESP_OK;
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "mode", status.mode == WIFI_MGR_MODE_AP ? "ap" : "sta");
+    json_stream_bool(&js, "connected", status.connected);
+    json_stream_string(&js, "ssid", status.ssid);
+    json_stream_string(&js, "ip", status.ip_addr);
+    json_stream_int(&js, "rssi", status.rssi);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
 }
 
 // Captive portal redirect handler (for any unknown URL)
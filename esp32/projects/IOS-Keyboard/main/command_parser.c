@@ -1,7 +1,11 @@
 #include "command_parser.h"
 #include "config.h"
 #include "usb_hid.h"
+#include "keyboard_layout.h"
 #include "debug_server.h"
+#include "deferred_log.h"
+#include "metrics.h"
+#include "trace_capture.h"
 
 #include <string.h>
 #include "esp_log.h"
@@ -14,40 +18,44 @@ esp_err_t command_parser_init(void)
     return ESP_OK;
 }
 
-void command_parser_process(const uint8_t *data, size_t len)
+// Decode and execute one command packet
+static esp_err_t dispatch(const uint8_t *data, size_t len)
 {
     if (data == NULL || len == 0) {
         ESP_LOGW(TAG, "Empty command received");
-        return;
+        return ESP_ERR_INVALID_SIZE;
     }
 
     uint8_t cmd = data[0];
+    metrics_inc(METRIC_COMMANDS, 1);
+    metrics_cmd_stage(METRIC_STAGE_PARSE);
 
     switch (cmd) {
         case CMD_BACKSPACE: {
             // 0x01 <count> - send backspace count times
             if (len < 2) {
                 ESP_LOGW(TAG, "Backspace command missing count");
-                return;
+                return ESP_ERR_INVALID_SIZE;
             }
             uint8_t count = data[1];
-            ESP_LOGI(TAG, "Backspace x%d", count);
-            debug_server_trace_ble("BS x%d", count);
+            DLOG(DLOG_CMD_BACKSPACE, count);
+            debug_server_trace(TRACE_STAGE_BLE, CMD_BACKSPACE, 0, 0, count);
+            metrics_cmd_stage(METRIC_STAGE_ENQUEUE);
             for (uint8_t i = 0; i < count; i++) {
                 esp_err_t ret = usb_hid_send_backspace();
                 if (ret != ESP_OK) {
                     ESP_LOGE(TAG, "Failed to send backspace: %s", esp_err_to_name(ret));
-                    return;
+                    return ret;
                 }
             }
-            break;
+            return ESP_OK;
         }
 
         case CMD_INSERT: {
             // 0x02 <text> - type the text
             if (len < 2) {
                 ESP_LOGW(TAG, "Insert command missing text");
-                return;
+                return ESP_ERR_INVALID_SIZE;
             }
             // Create null-terminated string from payload
             size_t text_len = len - 1;
@@ -55,50 +63,98 @@ void command_parser_process(const uint8_t *data, size_t len)
             memcpy(text, &data[1], text_len);
             text[text_len] = '\0';
 
-            ESP_LOGI(TAG, "Insert: %s", text);
-            // Truncate for trace display
-            char trace_text[32];
-            size_t trace_len = text_len > 28 ? 28 : text_len;
-            memcpy(trace_text, text, trace_len);
-            trace_text[trace_len] = '\0';
-            if (text_len > 28) strcat(trace_text, "...");
-            debug_server_trace_ble("TXT: %s", trace_text);
+            DLOG(DLOG_CMD_INSERT, text_len);
+            debug_server_trace(TRACE_STAGE_BLE, CMD_INSERT, 0, 0, text_len);
+            metrics_cmd_stage(METRIC_STAGE_ENQUEUE);
             esp_err_t ret = usb_hid_type_text(text);
             if (ret != ESP_OK) {
                 ESP_LOGE(TAG, "Failed to type text: %s", esp_err_to_name(ret));
             }
-            break;
+            return ret;
         }
 
         case CMD_ENTER: {
             // 0x03 - send enter key
-            ESP_LOGI(TAG, "Enter");
-            debug_server_trace_ble("ENTER");
+            DLOG(DLOG_CMD_ENTER);
+            debug_server_trace(TRACE_STAGE_BLE, CMD_ENTER, 0, 0, 0);
+            metrics_cmd_stage(METRIC_STAGE_ENQUEUE);
             esp_err_t ret = usb_hid_send_enter();
             if (ret != ESP_OK) {
                 ESP_LOGE(TAG, "Failed to send enter: %s", esp_err_to_name(ret));
             }
-            break;
+            return ret;
         }
 
         case CMD_CTRL_KEY: {
             // 0x04 <key> - send Ctrl+key combo
             if (len < 2) {
                 ESP_LOGW(TAG, "Ctrl+key command missing key");
-                return;
+                return ESP_ERR_INVALID_SIZE;
             }
             char key = (char)data[1];
-            ESP_LOGI(TAG, "Ctrl+%c", key);
-            debug_server_trace_ble("CTRL+%c", key);
+            DLOG(DLOG_CMD_CTRL_KEY, key);
+            debug_server_trace(TRACE_STAGE_BLE, CMD_CTRL_KEY, 0, 0, (uint8_t)key);
+            metrics_cmd_stage(METRIC_STAGE_ENQUEUE);
             esp_err_t ret = usb_hid_send_ctrl_key(key);
             if (ret != ESP_OK) {
                 ESP_LOGE(TAG, "Failed to send Ctrl+%c: %s", key, esp_err_to_name(ret));
             }
-            break;
+            return ret;
+        }
+
+        case CMD_LAYOUT: {
+            // 0x05 [code] - layout for the following text, RAM only
+            char code[8];
+            size_t code_len = len - 1;
+            if (code_len >= sizeof(code)) {
+                ESP_LOGW(TAG, "Layout code too long");
+                return ESP_ERR_INVALID_SIZE;
+            }
+            memcpy(code, &data[1], code_len);
+            code[code_len] = '\0';
+
+            esp_err_t ret = keyboard_layout_select_by_code(code);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Unknown layout: %s", code);
+                return ret;
+            }
+            DLOG(DLOG_CMD_LAYOUT, keyboard_layout_get());
+            debug_server_trace(TRACE_STAGE_BLE, CMD_LAYOUT, 0, 0, keyboard_layout_get());
+            return ESP_OK;
+        }
+
+        case CMD_SHORTCUT: {
+            // 0x06 <id> - editing shortcut, translated for the host OS
+            if (len < 2) {
+                ESP_LOGW(TAG, "Shortcut command missing id");
+                return ESP_ERR_INVALID_SIZE;
+            }
+            uint8_t id = data[1];
+            DLOG(DLOG_CMD_SHORTCUT, id);
+            debug_server_trace(TRACE_STAGE_BLE, CMD_SHORTCUT, 0, 0, id);
+            metrics_cmd_stage(METRIC_STAGE_ENQUEUE);
+            esp_err_t ret = usb_hid_send_shortcut((host_shortcut_t)id);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to send shortcut %u: %s", id, esp_err_to_name(ret));
+            }
+            return ret;
         }
 
         default:
             ESP_LOGW(TAG, "Unknown command: 0x%02x", cmd);
-            break;
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+esp_err_t command_parser_execute(const uint8_t *data, size_t len)
+{
+    uint32_t opcode = (data != NULL && len > 0) ? data[0] : 0;
+    trace_capture_begin(TC_EV_PARSE, opcode);
+    esp_err_t ret = dispatch(data, len);
+    if (ret != ESP_OK) {
+        metrics_inc(METRIC_DROPS, 1);
     }
+    trace_capture_end(TC_EV_PARSE, opcode);
+    metrics_cmd_end();
+    return ret;
 }
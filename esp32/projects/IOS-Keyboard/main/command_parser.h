@@ -11,18 +11,26 @@
 esp_err_t command_parser_init(void);
 
 /**
- * Process a received command packet
- * Called by BLE GATT when data is received on RX characteristic
+ * Execute a command packet
+ * Called by the ingest engine task for every queued command (BLE,
+ * HTTP and WebSocket all use this format).
  *
  * Packet format:
  * - 0x01 <count>  : Send <count> backspace keystrokes
  * - 0x02 <text>   : Type the text characters
  * - 0x03          : Send enter key
  * - 0x04 <key>    : Send Ctrl+key combo (e.g., 0x04 0x4A for Ctrl+J)
+ * - 0x05 [code]   : Type the following text with layout <code> (e.g.
+ *                   "us"); no code returns to the saved default. Lasts
+ *                   until the next 0x05 or a reboot and is not saved.
+ * - 0x06 <id>     : Send an editing shortcut (host_shortcut_t, e.g. 0x06
+ *                   0x00 deletes the previous word) with the keys of the
+ *                   detected host OS
  *
  * @param data Pointer to received data
  * @param len Length of received data
+ * @return ESP_OK once the keystrokes were queued to USB
  */
-void command_parser_process(const uint8_t *data, size_t len);
+esp_err_t command_parser_execute(const uint8_t *data, size_t len);
 
 #endif // COMMAND_PARSER_H
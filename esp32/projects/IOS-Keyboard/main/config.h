@@ -28,12 +28,162 @@
 #define CONFIG_LOG_BUFFER_SIZE 50
 #endif
 
-// Keyboard typing delay (ms between keystrokes)
+// BLE/HID trace ring depth (binary records) - must be a power of two
+#ifndef CONFIG_TRACE_RING_SIZE
+#define CONFIG_TRACE_RING_SIZE 64
+#endif
+
+// Chrome trace capture buffer (records) and maximum window (ms)
+#ifndef CONFIG_TRACE_CAPTURE_EVENTS
+#define CONFIG_TRACE_CAPTURE_EVENTS 2048
+#endif
+
+#ifndef CONFIG_TRACE_CAPTURE_MAX_MS
+#define CONFIG_TRACE_CAPTURE_MAX_MS 10000
+#endif
+
+// Debug dashboard event stream (/events): max clients, push check interval
+// and minimum interval between status updates (ms)
+#ifndef CONFIG_SSE_MAX_CLIENTS
+#define CONFIG_SSE_MAX_CLIENTS 3
+#endif
+
+#ifndef CONFIG_SSE_PUSH_MS
+#define CONFIG_SSE_PUSH_MS 200
+#endif
+
+#ifndef CONFIG_SSE_STATUS_MS
+#define CONFIG_SSE_STATUS_MS 1000
+#endif
+
+// Deferred (binary) log ring for hot paths - must be a power of two
+#ifndef CONFIG_DLOG_RING_SIZE
+#define CONFIG_DLOG_RING_SIZE 128
+#endif
+
+// Deferred log drain interval (ms)
+#ifndef CONFIG_DLOG_FLUSH_MS
+#define CONFIG_DLOG_FLUSH_MS 100
+#endif
+
+// Staging buffer for streamed JSON responses (bytes, on the handler stack)
+#ifndef CONFIG_JSON_STREAM_BUF_SIZE
+#define CONFIG_JSON_STREAM_BUF_SIZE 256
+#endif
+
+// Persistent flash log ("logs" partition): RAM staging buffer (bytes),
+// flush interval (ms) and longest stored line
+#ifndef CONFIG_LOG_STORE_STAGE_SIZE
+#define CONFIG_LOG_STORE_STAGE_SIZE 2048
+#endif
+
+#ifndef CONFIG_LOG_STORE_FLUSH_MS
+#define CONFIG_LOG_STORE_FLUSH_MS 2000
+#endif
+
+#ifndef CONFIG_LOG_STORE_MAX_LINE
+#define CONFIG_LOG_STORE_MAX_LINE 128
+#endif
+
+// Settings store: delay between the first change and its NVS commit (ms);
+// further changes in that window share the commit
+#ifndef CONFIG_SETTINGS_COMMIT_DELAY_MS
+#define CONFIG_SETTINGS_COMMIT_DELAY_MS 1000
+#endif
+
+// USB host OS detection: enumeration requests seen this long after mount
+// are matched against known hosts (ms)
+#ifndef CONFIG_HOST_OS_DETECT_MS
+#define CONFIG_HOST_OS_DETECT_MS 1500
+#endif
+
+// Longest a keystroke report waits for the host to poll the previous one
+// before the text is abandoned (ms)
+#ifndef CONFIG_HID_REPORT_RETRY_MS
+#define CONFIG_HID_REPORT_RETRY_MS 100
+#endif
+
+// Typing rate calibration (Num Lock LED echo): toggles per rate and echo
+// round-trip samples (both even, so Num Lock ends as it started), wait for
+// a late echo (ms) and margin added to the fastest clean rate (%)
+#ifndef CONFIG_CALIBRATE_TOGGLES
+#define CONFIG_CALIBRATE_TOGGLES 10
+#endif
+
+#ifndef CONFIG_CALIBRATE_RTT_SAMPLES
+#define CONFIG_CALIBRATE_RTT_SAMPLES 4
+#endif
+
+#ifndef CONFIG_CALIBRATE_ECHO_TIMEOUT_MS
+#define CONFIG_CALIBRATE_ECHO_TIMEOUT_MS 250
+#endif
+
+#ifndef CONFIG_CALIBRATE_MARGIN_PCT
+#define CONFIG_CALIBRATE_MARGIN_PCT 25
+#endif
+
+// Keyboard typing delay (ms between keystrokes) for hosts without a
+// speed profile
 #ifndef CONFIG_TYPING_DELAY_MS
 #define CONFIG_TYPING_DELAY_MS 50
 #endif
 
-// NVS namespace for WiFi credentials
+// Async /type jobs: text queued between the HTTP receiver and the typing
+// worker (bytes), and characters typed per usb_hid_type_text call (also
+// bounds cancel latency)
+#ifndef CONFIG_TYPE_JOB_BUF_SIZE
+#define CONFIG_TYPE_JOB_BUF_SIZE 4096
+#endif
+
+#ifndef CONFIG_TYPE_JOB_CHUNK
+#define CONFIG_TYPE_JOB_CHUNK 16
+#endif
+
+// Command ingest bus: queue depth per source, max packet size (bytes),
+// per-source rate limits (commands/s, 0 = unlimited) and burst allowance
+#ifndef CONFIG_INGEST_QUEUE_LEN
+#define CONFIG_INGEST_QUEUE_LEN 8
+#endif
+
+#ifndef CONFIG_INGEST_MAX_CMD
+#define CONFIG_INGEST_MAX_CMD 256
+#endif
+
+#ifndef CONFIG_INGEST_RATE_BLE
+#define CONFIG_INGEST_RATE_BLE 0
+#endif
+
+#ifndef CONFIG_INGEST_RATE_HTTP
+#define CONFIG_INGEST_RATE_HTTP 20
+#endif
+
+#ifndef CONFIG_INGEST_RATE_WS
+#define CONFIG_INGEST_RATE_WS 100
+#endif
+
+#ifndef CONFIG_INGEST_BURST
+#define CONFIG_INGEST_BURST 8
+#endif
+
+// /profile: max tasks reported and longest sampling window (ms)
+#ifndef CONFIG_PROFILE_MAX_TASKS
+#define CONFIG_PROFILE_MAX_TASKS 32
+#endif
+
+#ifndef CONFIG_PROFILE_MAX_WINDOW_MS
+#define CONFIG_PROFILE_MAX_WINDOW_MS 5000
+#endif
+
+// Layout pack ("layouts" partition): max layouts used, max upload size (bytes)
+#ifndef CONFIG_LAYOUT_PACK_MAX
+#define CONFIG_LAYOUT_PACK_MAX 8
+#endif
+
+#ifndef CONFIG_LAYOUT_PACK_MAX_SIZE
+#define CONFIG_LAYOUT_PACK_MAX_SIZE 16384
+#endif
+
+// NVS namespace for settings (WiFi credentials, layout)
 #define CONFIG_NVS_NAMESPACE "ios_kbd"
 #define CONFIG_NVS_KEY_SSID "wifi_ssid"
 #define CONFIG_NVS_KEY_PASS "wifi_pass"
@@ -61,6 +211,22 @@
 // BLE Configuration
 #define CONFIG_BLE_DEVICE_NAME "IOS-Keyboard"
 
+// BLE advertising schedule: fast interval right after boot/disconnect, then
+// back off in steps (see s_adv_phases in ble_gatt.c for the intervals)
+#ifndef CONFIG_BLE_ADV_FAST_DURATION_MS
+#define CONFIG_BLE_ADV_FAST_DURATION_MS 30000
+#endif
+
+#ifndef CONFIG_BLE_ADV_STEP_DURATION_MS
+#define CONFIG_BLE_ADV_STEP_DURATION_MS 60000
+#endif
+
+// Longest a BLE write waits for room in the ingest queue before it is
+// rejected (ms); the write response is held back meanwhile
+#ifndef CONFIG_BLE_RX_WAIT_MS
+#define CONFIG_BLE_RX_WAIT_MS 500
+#endif
+
 // Nordic UART Service (NUS) UUIDs
 // Service: 6E400001-B5A3-F393-E0A9-E50E24DCCA9E
 // RX Char: 6E400002-B5A3-F393-E0A9-E50E24DCCA9E (Write - receive from phone)
@@ -71,5 +237,7 @@
 #define CMD_INSERT    0x02  // 0x02 <text>  - type text characters
 #define CMD_ENTER     0x03  // 0x03         - send enter key
 #define CMD_CTRL_KEY  0x04  // 0x04 <key>   - send Ctrl+key combo
+#define CMD_LAYOUT    0x05  // 0x05 [code]  - layout for the following text (not saved)
+#define CMD_SHORTCUT  0x06  // 0x06 <id>    - editing shortcut for the host OS (host_shortcut_t)
 
 #endif // CONFIG_H
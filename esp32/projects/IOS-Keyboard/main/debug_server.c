@@ -3,18 +3,40 @@
 #include "ota_handler.h"
 #include "config.h"
 #include "keyboard_layout.h"
-#if CONFIG_ENABLE_HID
+#include "host_os.h"
 #include "usb_hid.h"
+#include "deferred_log.h"
+#include "metrics.h"
+#include "json_stream.h"
+#include "web_assets.h"
+#include "trace_capture.h"
+#include "ingest.h"
+#include "profiler.h"
+#include "log_store.h"
+#include "settings.h"
+#include "utf8.h"
+#if CONFIG_ENABLE_HID
+#include "type_job.h"
+#include "ws_ingest.h"
+#endif
+#if CONFIG_ENABLE_BLE
+#include "ble_gatt.h"
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <unistd.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "cJSON.h"
 
 static const char *TAG = "debug_srv";
@@ -25,202 +47,120 @@ static httpd_handle_t s_server = NULL;
 static char s_log_buffer[CONFIG_LOG_BUFFER_SIZE][LOG_MSG_MAX_LEN];
 static int s_log_index = 0;
 static int s_log_count = 0;
+static uint32_t s_log_seq = 0;      // Total lines written (sequence of the next line)
 static SemaphoreHandle_t s_log_mutex = NULL;
 
 // Boot time for uptime calculation
 static int64_t s_boot_time = 0;
 
-// Debug trace buffer for BLE->HID data flow
-#define DEBUG_TRACE_SIZE 20
-#define DEBUG_TRACE_MSG_LEN 64
-static char s_ble_trace[DEBUG_TRACE_SIZE][DEBUG_TRACE_MSG_LEN];
-static char s_hid_trace[DEBUG_TRACE_SIZE][DEBUG_TRACE_MSG_LEN];
-static int s_ble_trace_idx = 0;
-static int s_hid_trace_idx = 0;
-static int s_ble_trace_count = 0;
-static int s_hid_trace_count = 0;
-static SemaphoreHandle_t s_trace_mutex = NULL;
-
-// Add BLE trace message
-void debug_server_trace_ble(const char *format, ...)
+// Debug trace ring for BLE->HID data flow. Producers reserve a slot with
+// one atomic increment and publish it with a per-slot sequence number, so
+// the typing path never takes a lock or formats text.
+#if (CONFIG_TRACE_RING_SIZE & (CONFIG_TRACE_RING_SIZE - 1)) != 0
+#error "CONFIG_TRACE_RING_SIZE must be a power of two"
+#endif
+#define TRACE_RING_MASK (CONFIG_TRACE_RING_SIZE - 1)
+#define TRACE_MSG_LEN 48
+
+typedef struct {
+    atomic_uint_fast32_t seq;   // Record sequence + 1 when valid, 0 while being written
+    uint32_t timestamp_ms;
+    uint8_t stage;
+    uint8_t opcode;
+    uint8_t keycode;
+    uint8_t modifiers;
+    uint16_t arg;
+} trace_record_t;
+
+static trace_record_t s_trace_ring[CONFIG_TRACE_RING_SIZE];
+static atomic_uint_fast32_t s_trace_seq = 0;
+
+void debug_server_trace(trace_stage_t stage, uint8_t opcode, uint8_t keycode,
+                        uint8_t modifiers, uint16_t arg)
 {
-    if (s_trace_mutex == NULL) return;
-
-    va_list args;
-    va_start(args, format);
+    uint32_t seq = atomic_fetch_add_explicit(&s_trace_seq, 1, memory_order_relaxed);
+    trace_record_t *rec = &s_trace_ring[seq & TRACE_RING_MASK];
+
+    atomic_store_explicit(&rec->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    rec->timestamp_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    rec->stage = stage;
+    rec->opcode = opcode;
+    rec->keycode = keycode;
+    rec->modifiers = modifiers;
+    rec->arg = arg;
+    atomic_store_explicit(&rec->seq, seq + 1, memory_order_release);
+}
 
-    xSemaphoreTake(s_trace_mutex, portMAX_DELAY);
+// Copy a consistent snapshot of the record with sequence number seq
+static bool trace_read(uint32_t seq, trace_record_t *out)
+{
+    trace_record_t *rec = &s_trace_ring[seq & TRACE_RING_MASK];
 
-    vsnprintf(s_ble_trace[s_ble_trace_idx], DEBUG_TRACE_MSG_LEN, format, args);
-    s_ble_trace_idx = (s_ble_trace_idx + 1) % DEBUG_TRACE_SIZE;
-    if (s_ble_trace_count < DEBUG_TRACE_SIZE) {
-        s_ble_trace_count++;
+    uint32_t before = atomic_load_explicit(&rec->seq, memory_order_acquire);
+    if (before != seq + 1) {
+        return false;  // Overwritten or still being written
     }
-
-    xSemaphoreGive(s_trace_mutex);
-    va_end(args);
+    out->timestamp_ms = rec->timestamp_ms;
+    out->stage = rec->stage;
+    out->opcode = rec->opcode;
+    out->keycode = rec->keycode;
+    out->modifiers = rec->modifiers;
+    out->arg = rec->arg;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&rec->seq, memory_order_relaxed) == before;
 }
 
-// Add HID trace message
-void debug_server_trace_hid(const char *format, ...)
+// Render a trace record as text (only done when /trace is requested)
+static void trace_format(const trace_record_t *rec, char *buf, size_t size)
 {
-    if (s_trace_mutex == NULL) return;
-
-    va_list args;
-    va_start(args, format);
-
-    xSemaphoreTake(s_trace_mutex, portMAX_DELAY);
-
-    vsnprintf(s_hid_trace[s_hid_trace_idx], DEBUG_TRACE_MSG_LEN, format, args);
-    s_hid_trace_idx = (s_hid_trace_idx + 1) % DEBUG_TRACE_SIZE;
-    if (s_hid_trace_count < DEBUG_TRACE_SIZE) {
-        s_hid_trace_count++;
+    int n = snprintf(buf, size, "[%" PRIu32 ".%03" PRIu32 "] ",
+                     rec->timestamp_ms / 1000, rec->timestamp_ms % 1000);
+    buf += n;
+    size -= n;
+
+    char ch = (rec->arg >= 32 && rec->arg < 127) ? (char)rec->arg : '?';
+
+    if (rec->stage == TRACE_STAGE_BLE) {
+        switch (rec->opcode) {
+            case CMD_BACKSPACE: snprintf(buf, size, "BS x%u", rec->arg); break;
+            case CMD_INSERT:    snprintf(buf, size, "TXT: %u bytes", rec->arg); break;
+            case CMD_ENTER:     snprintf(buf, size, "ENTER"); break;
+            case CMD_CTRL_KEY:  snprintf(buf, size, "CTRL+%c", ch); break;
+            case CMD_LAYOUT: {
+                const keyboard_layout_info_t *info = keyboard_layout_get_info(rec->arg);
+                snprintf(buf, size, "LAYOUT %s", info ? info->code : "?");
+                break;
+            }
+            case CMD_SHORTCUT:  snprintf(buf, size, "SHORTCUT %u", rec->arg); break;
+            default:            snprintf(buf, size, "CMD 0x%02X", rec->opcode); break;
+        }
+        return;
     }
 
-    xSemaphoreGive(s_trace_mutex);
-    va_end(args);
+    switch (rec->opcode) {
+        case CMD_BACKSPACE:
+            snprintf(buf, size, "BS K:0x%02X", rec->keycode);
+            break;
+        case CMD_ENTER:
+            snprintf(buf, size, "ENTER K:0x%02X", rec->keycode);
+            break;
+        case CMD_CTRL_KEY:
+            snprintf(buf, size, "CTRL+%c K:0x%02X M:0x%02X", ch, rec->keycode, rec->modifiers);
+            break;
+        case CMD_SHORTCUT:
+            snprintf(buf, size, "SHORTCUT %u K:0x%02X M:0x%02X", rec->arg, rec->keycode, rec->modifiers);
+            break;
+        default:
+            if (rec->arg >= 32 && rec->arg < 127) {
+                snprintf(buf, size, "'%c' K:0x%02X M:0x%02X", ch, rec->keycode, rec->modifiers);
+            } else {
+                snprintf(buf, size, "0x%02X K:0x%02X M:0x%02X", rec->arg, rec->keycode, rec->modifiers);
+            }
+            break;
+    }
 }
 
-// Embedded HTML for debug dashboard
-static const char DEBUG_HTML[] =
-"<!DOCTYPE html>"
-"<html><head>"
-"<meta name='viewport' content='width=device-width,initial-scale=1'>"
-"<title>IOS-Keyboard Debug</title>"
-"<style>"
-"body{font-family:monospace;margin:20px;background:#0a0a0a;color:#0f0;}"
-"h1{text-align:center;}"
-".container{max-width:800px;margin:0 auto;}"
-".card{background:#111;padding:15px;border:1px solid #0f0;border-radius:5px;margin:10px 0;}"
-".card h3{margin-top:0;border-bottom:1px solid #0f0;padding-bottom:5px;}"
-".status-row{display:flex;justify-content:space-between;padding:5px 0;}"
-".status-label{color:#888;}"
-".status-value{color:#0f0;}"
-"button{padding:10px 20px;background:#0f0;color:#000;border:none;"
-"border-radius:3px;cursor:pointer;margin:5px;font-family:monospace;}"
-"button:hover{background:#0c0;}"
-"button.danger{background:#f00;color:#fff;}"
-"button.danger:hover{background:#c00;}"
-"input,select{padding:10px;background:#000;color:#0f0;border:1px solid #0f0;"
-"border-radius:3px;font-family:monospace;}"
-"input{width:100%;box-sizing:border-box;}"
-".logs{background:#000;padding:10px;border:1px solid #333;border-radius:3px;"
-"height:300px;overflow-y:auto;font-size:12px;}"
-".log-entry{padding:2px 0;border-bottom:1px solid #222;}"
-".progress{background:#333;border-radius:3px;height:20px;margin:10px 0;}"
-".progress-bar{background:#0f0;height:100%;border-radius:3px;transition:width 0.3s;}"
-".hidden{display:none;}"
-"</style>"
-"</head><body>"
-"<div class='container'>"
-"<h1>IOS-Keyboard Debug</h1>"
-"<div class='card'>"
-"<h3>System Status</h3>"
-"<div class='status-row'><span class='status-label'>Version:</span><span class='status-value' id='version'>-</span></div>"
-"<div class='status-row'><span class='status-label'>Uptime:</span><span class='status-value' id='uptime'>-</span></div>"
-"<div class='status-row'><span class='status-label'>WiFi SSID:</span><span class='status-value' id='ssid'>-</span></div>"
-"<div class='status-row'><span class='status-label'>IP Address:</span><span class='status-value' id='ip'>-</span></div>"
-"<div class='status-row'><span class='status-label'>RSSI:</span><span class='status-value' id='rssi'>-</span></div>"
-"<div class='status-row'><span class='status-label'>Free Heap:</span><span class='status-value' id='heap'>-</span></div>"
-"<div class='status-row'><span class='status-label'>Keyboard:</span><span class='status-value'><select id='keyboard' onchange='setKeyboard()'></select></span></div>"
-"</div>"
-"<div class='card'>"
-"<h3>OTA Update</h3>"
-"<input type='text' id='otaUrl' placeholder='http://server/firmware.bin'>"
-"<div style='margin-top:10px;'>"
-"<button onclick='startOta()'>Start OTA Update</button>"
-"</div>"
-"<div id='otaProgress' class='hidden'>"
-"<div class='progress'><div class='progress-bar' id='otaBar' style='width:0%'></div></div>"
-"<div id='otaStatus'>Idle</div>"
-"</div>"
-"</div>"
-"<div class='card'>"
-"<h3>Actions</h3>"
-"<button onclick='typeTest()'>Type Test</button>"
-"<button onclick='location.reload()'>Refresh</button>"
-"<button class='danger' onclick='resetWifi()'>Reset WiFi</button>"
-"<button class='danger' onclick='reboot()'>Reboot</button>"
-"</div>"
-"<div class='card'>"
-"<h3>BLE &rarr; HID Trace</h3>"
-"<button onclick='refreshTrace()'>Refresh Trace</button>"
-"<div style='display:flex;gap:10px;'>"
-"<div style='flex:1;'>"
-"<h4 style='color:#0ff;margin:5px 0;'>BLE Received</h4>"
-"<div class='logs' id='ble-trace' style='height:150px;border-color:#0ff;'></div>"
-"</div>"
-"<div style='flex:1;'>"
-"<h4 style='color:#ff0;margin:5px 0;'>HID Sent</h4>"
-"<div class='logs' id='hid-trace' style='height:150px;border-color:#ff0;'></div>"
-"</div>"
-"</div>"
-"</div>"
-"<div class='card'>"
-"<h3>Logs</h3>"
-"<button onclick='refreshLogs()'>Refresh Logs</button>"
-"<div class='logs' id='logs'></div>"
-"</div>"
-"</div>"
-"<script>"
-"function updateStatus(){"
-"fetch('/status').then(r=>r.json()).then(d=>{"
-"document.getElementById('version').textContent=d.version;"
-"document.getElementById('uptime').textContent=formatUptime(d.uptime);"
-"document.getElementById('ssid').textContent=d.ssid;"
-"document.getElementById('ip').textContent=d.ip;"
-"document.getElementById('rssi').textContent=d.rssi+' dBm';"
-"document.getElementById('heap').textContent=Math.round(d.heap/1024)+' KB';"
-"if(d.ota_status!=='idle'){"
-"document.getElementById('otaProgress').classList.remove('hidden');"
-"document.getElementById('otaBar').style.width=d.ota_progress+'%';"
-"document.getElementById('otaStatus').textContent=d.ota_status+' ('+d.ota_progress+'%)';"
-"}}).catch(e=>console.error(e));}"
-"function formatUptime(s){let h=Math.floor(s/3600);let m=Math.floor((s%3600)/60);return h+'h '+m+'m';}"
-"function startOta(){"
-"let url=document.getElementById('otaUrl').value;"
-"if(!url){alert('Enter firmware URL');return;}"
-"fetch('/ota',{method:'POST',headers:{'Content-Type':'application/json'},"
-"body:JSON.stringify({url:url})}).then(r=>r.json()).then(d=>{"
-"if(d.success){document.getElementById('otaProgress').classList.remove('hidden');}"
-"else{alert('OTA failed: '+d.message);}});}"
-"function typeTest(){"
-"fetch('/type',{method:'POST'}).then(r=>r.json()).then(d=>alert(d.message));}"
-"function resetWifi(){"
-"if(confirm('Clear WiFi credentials and reboot?')){"
-"fetch('/reset-wifi',{method:'POST'}).then(()=>alert('Rebooting...'));}}"
-"function reboot(){"
-"if(confirm('Reboot device?')){"
-"fetch('/reboot',{method:'POST'}).then(()=>alert('Rebooting...'));}}"
-"function refreshLogs(){"
-"fetch('/logs').then(r=>r.json()).then(d=>{"
-"let html='';d.logs.forEach(l=>{html+='<div class=\"log-entry\">'+l+'</div>';});"
-"document.getElementById('logs').innerHTML=html;});}"
-"function refreshTrace(){"
-"fetch('/trace').then(r=>r.json()).then(d=>{"
-"let bleHtml='';d.ble.forEach(l=>{bleHtml+='<div class=\"log-entry\" style=\"color:#0ff;\">'+l+'</div>';});"
-"document.getElementById('ble-trace').innerHTML=bleHtml;"
-"let hidHtml='';d.hid.forEach(l=>{hidHtml+='<div class=\"log-entry\" style=\"color:#ff0;\">'+l+'</div>';});"
-"document.getElementById('hid-trace').innerHTML=hidHtml;});}"
-"function loadKeyboard(){"
-"fetch('/keyboard').then(r=>r.json()).then(d=>{"
-"let sel=document.getElementById('keyboard');"
-"sel.innerHTML='';"
-"d.layouts.forEach(l=>{"
-"let opt=document.createElement('option');"
-"opt.value=l.code;opt.textContent=l.name;"
-"if(l.code===d.current)opt.selected=true;"
-"sel.appendChild(opt);});});}"
-"function setKeyboard(){"
-"let code=document.getElementById('keyboard').value;"
-"fetch('/keyboard',{method:'POST',headers:{'Content-Type':'application/json'},"
-"body:JSON.stringify({layout:code})}).then(r=>r.json()).then(d=>{"
-"if(!d.success)alert('Failed: '+d.message);});}"
-"updateStatus();refreshLogs();loadKeyboard();refreshTrace();"
-"setInterval(updateStatus,5000);setInterval(refreshTrace,2000);"
-"</script>"
-"</body></html>";
-
 // Add log message to buffer
 void debug_server_log(const char *format, ...)
 {
@@ -236,8 +176,11 @@ void debug_server_log(const char *format, ...)
     int len = snprintf(s_log_buffer[s_log_index], LOG_MSG_MAX_LEN,
                        "[%lld] ", now);
     vsnprintf(s_log_buffer[s_log_index] + len, LOG_MSG_MAX_LEN - len, format, args);
+    const char *text = s_log_buffer[s_log_index] + len;
+    log_store_append(text, strlen(text));
 
     s_log_index = (s_log_index + 1) % CONFIG_LOG_BUFFER_SIZE;
+    s_log_seq++;
     if (s_log_count < CONFIG_LOG_BUFFER_SIZE) {
         s_log_count++;
     }
@@ -249,26 +192,23 @@ void debug_server_log(const char *format, ...)
 // Handler for root page
 static esp_err_t root_handler(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, DEBUG_HTML, HTTPD_RESP_USE_STRLEN);
+    web_assets_send(req, "debug.html");
     return ESP_OK;
 }
 
-// Handler for status
-static esp_err_t status_handler(httpd_req_t *req)
+// Write the status members (shared by /status and the event stream)
+static void status_write(json_stream_t *js)
 {
     wifi_manager_status_t wifi = wifi_manager_get_status();
     ota_progress_t ota = ota_handler_get_progress();
 
-    int64_t uptime = (esp_timer_get_time() - s_boot_time) / 1000000;
-
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "version", ota_handler_get_version());
-    cJSON_AddNumberToObject(root, "uptime", uptime);
-    cJSON_AddStringToObject(root, "ssid", wifi.ssid);
-    cJSON_AddStringToObject(root, "ip", wifi.ip_addr);
-    cJSON_AddNumberToObject(root, "rssi", wifi.rssi);
-    cJSON_AddNumberToObject(root, "heap", esp_get_free_heap_size());
+    json_stream_string(js, "version", ota_handler_get_version());
+    json_stream_string(js, "ssid", wifi.ssid);
+    json_stream_string(js, "ip", wifi.ip_addr);
+    json_stream_int(js, "rssi", wifi.rssi);
+    json_stream_uint(js, "heap", esp_get_free_heap_size());
+    json_stream_uint(js, "heap_min", esp_get_minimum_free_heap_size());
+    json_stream_uint(js, "heap_largest", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
 
     // OTA status
     const char *ota_status_str;
@@ -279,44 +219,219 @@ static esp_err_t status_handler(httpd_req_t *req)
         case OTA_STATUS_FAILED: ota_status_str = "failed"; break;
         default: ota_status_str = "idle"; break;
     }
-    cJSON_AddStringToObject(root, "ota_status", ota_status_str);
-    cJSON_AddNumberToObject(root, "ota_progress", ota.progress);
+    json_stream_string(js, "ota_status", ota_status_str);
+    json_stream_int(js, "ota_progress", ota.progress);
+
+    // Deferred log ring
+    deferred_log_stats_t dlog;
+    deferred_log_get_stats(&dlog);
+    json_stream_object_begin(js, "dlog");
+    json_stream_uint(js, "written", dlog.written);
+    json_stream_uint(js, "dropped", dlog.dropped);
+    json_stream_uint(js, "pending", dlog.pending);
+    json_stream_object_end(js);
+
+    // Persistent flash log
+    log_store_status_t flog;
+    log_store_get_status(&flog);
+    if (flog.enabled) {
+        json_stream_object_begin(js, "flash_log");
+        json_stream_uint(js, "boot", flog.boot);
+        json_stream_uint(js, "segments", flog.segments);
+        json_stream_uint(js, "segments_used", flog.segments_used);
+        json_stream_uint(js, "head_erases", flog.head_erases);
+        json_stream_uint(js, "written", flog.written);
+        json_stream_uint(js, "dropped", flog.dropped);
+        json_stream_object_end(js);
+    }
 
-    char *json = cJSON_PrintUnformatted(root);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    // USB host OS (detected or overridden)
+    host_os_status_t host;
+    host_os_get_status(&host);
+    json_stream_object_begin(js, "host");
+    json_stream_string(js, "os", host_os_name(host.os));
+    json_stream_string(js, "guess", host_os_name(host.guess));
+    json_stream_bool(js, "override", host.overridden);
+    json_stream_bool(js, "calibrated", host.calibrated);
+    json_stream_object_end(js);
+
+    // Settings store (deferred NVS commits)
+    settings_stats_t cfg;
+    settings_get_stats(&cfg);
+    json_stream_object_begin(js, "settings");
+    json_stream_uint(js, "commits", cfg.commits);
+    json_stream_uint(js, "writes", cfg.writes);
+    json_stream_uint(js, "coalesced", cfg.coalesced);
+    json_stream_uint(js, "errors", cfg.errors);
+    json_stream_uint(js, "pending", cfg.pending);
+    json_stream_object_end(js);
+
+#if CONFIG_ENABLE_BLE
+    // BLE advertising scheduler
+    ble_gatt_adv_stats_t adv;
+    ble_gatt_get_adv_stats(&adv);
+    const char *ble_state_str;
+    switch (ble_gatt_get_state()) {
+        case BLE_STATE_ADVERTISING: ble_state_str = "advertising"; break;
+        case BLE_STATE_CONNECTED: ble_state_str = "connected"; break;
+        default: ble_state_str = "idle"; break;
+    }
+    json_stream_object_begin(js, "ble");
+    json_stream_string(js, "state", ble_state_str);
+    json_stream_uint(js, "adv_phase", adv.adv_phase);
+    json_stream_number(js, "adv_interval_ms", adv.adv_interval_us / 1000.0);
+    json_stream_number(js, "adv_duty_pct", adv.adv_duty_ppm / 10000.0);
+    json_stream_number(js, "adv_avg_duty_pct", adv.adv_avg_duty_ppm / 10000.0);
+    json_stream_bool(js, "uuid_in_primary", adv.uuid_in_primary);
+    json_stream_int(js, "discovery_ms", adv.last_discovery_ms);
+    json_stream_uint(js, "connects", adv.connect_count);
+    json_stream_object_end(js);
+#endif
+}
 
-    free(json);
-    cJSON_Delete(root);
-    return ESP_OK;
+// Handler for status
+static esp_err_t status_handler(httpd_req_t *req)
+{
+    int64_t uptime = (esp_timer_get_time() - s_boot_time) / 1000000;
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    status_write(&js);
+    json_stream_int(&js, "uptime", uptime);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
 }
 
-// Handler for logs
-static esp_err_t logs_handler(httpd_req_t *req)
+// Get an unsigned integer query parameter
+static uint32_t query_u32(httpd_req_t *req, const char *key, uint32_t def)
 {
-    cJSON *root = cJSON_CreateObject();
-    cJSON *logs = cJSON_CreateArray();
+    char query[64];
+    char value[12];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, key, value, sizeof(value)) == ESP_OK) {
+        return strtoul(value, NULL, 10);
+    }
+    return def;
+}
 
-    xSemaphoreTake(s_log_mutex, portMAX_DELAY);
+// Requests that take seconds (profile windows, calibration) run one at a
+// time on a worker task, on an async copy of the request, so the server
+// task keeps serving meanwhile
+typedef esp_err_t (*async_fn_t)(httpd_req_t *req, uint32_t arg);
+
+static TaskHandle_t s_async_task = NULL;
+static httpd_req_t *s_async_req = NULL;     // Request in progress, NULL when idle
+static async_fn_t s_async_fn = NULL;
+static uint32_t s_async_arg = 0;
+
+static void async_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        httpd_req_t *req = s_async_req;
+        if (req == NULL) {
+            continue;
+        }
+        s_async_fn(req, s_async_arg);
+        httpd_req_async_handler_complete(req);
+        s_async_req = NULL;
+    }
+}
+
+// Run fn(req, arg) on the worker; 503 while it is busy with another request
+static esp_err_t async_run(httpd_req_t *req, async_fn_t fn, uint32_t arg)
+{
+    if (s_async_req != NULL) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return json_stream_send_result(req, false, "Busy with another long request");
+    }
+    if (s_async_task == NULL &&
+        xTaskCreate(async_task, "http_async", 4096, NULL, 5, &s_async_task) != pdPASS) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for worker task");
+        return ESP_FAIL;
+    }
 
-    int start = (s_log_count < CONFIG_LOG_BUFFER_SIZE) ? 0 :
-                (s_log_index);
-    for (int i = 0; i < s_log_count; i++) {
-        int idx = (start + i) % CONFIG_LOG_BUFFER_SIZE;
-        cJSON_AddItemToArray(logs, cJSON_CreateString(s_log_buffer[idx]));
+    httpd_req_t *async_req;
+    esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    s_async_fn = fn;
+    s_async_arg = arg;
+    s_async_req = async_req;
+    xTaskNotifyGive(s_async_task);
+    return ESP_OK;
+}
+
+// Range of ring sequence numbers selected by ?since=<seq>&limit=N
+typedef struct {
+    uint32_t start;
+    uint32_t end;       // Exclusive; also the next cursor
+    uint32_t lost;      // Entries after since that were overwritten
+} cursor_t;
+
+static void cursor_resolve(httpd_req_t *req, uint32_t oldest, uint32_t head, cursor_t *cur)
+{
+    uint32_t since = query_u32(req, "since", oldest);
+    uint32_t limit = query_u32(req, "limit", UINT32_MAX);
+
+    cur->lost = 0;
+    if ((int32_t)(head - since) < 0) {
+        since = oldest;                 // Cursor ahead of us: device rebooted
+    } else if ((int32_t)(since - oldest) < 0) {
+        cur->lost = oldest - since;     // Overwritten by wraparound
+        since = oldest;
     }
+    cur->start = since;
+    cur->end = (head - since > limit) ? since + limit : head;
+}
+
+// Log line with sequence number seq (caller holds s_log_mutex, seq still in the ring)
+static const char *log_line(uint32_t seq)
+{
+    uint32_t back = s_log_seq - seq;
+    return s_log_buffer[(s_log_index + CONFIG_LOG_BUFFER_SIZE - back) % CONFIG_LOG_BUFFER_SIZE];
+}
+
+// Handler for logs (?since=<seq>&limit=N returns only newer lines)
+static esp_err_t logs_handler(httpd_req_t *req)
+{
+    json_stream_t js;
+    cursor_t cur;
+    char line[LOG_MSG_MAX_LEN];
 
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_array_begin(&js, "logs");
+
+    // Copy each line out so the mutex is never held across a socket send
+    xSemaphoreTake(s_log_mutex, portMAX_DELAY);
+    cursor_resolve(req, s_log_seq - s_log_count, s_log_seq, &cur);
     xSemaphoreGive(s_log_mutex);
 
-    cJSON_AddItemToObject(root, "logs", logs);
+    for (uint32_t seq = cur.start; seq != cur.end; seq++) {
+        xSemaphoreTake(s_log_mutex, portMAX_DELAY);
+        bool valid = (int32_t)(seq - (s_log_seq - s_log_count)) >= 0;
+        if (valid) {
+            memcpy(line, log_line(seq), sizeof(line));
+        }
+        xSemaphoreGive(s_log_mutex);
 
-    char *json = cJSON_PrintUnformatted(root);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+        if (!valid) {
+            cur.lost++;     // Overwritten while we were sending
+            continue;
+        }
+        json_stream_string(&js, NULL, line);
+    }
 
-    free(json);
-    cJSON_Delete(root);
-    return ESP_OK;
+    json_stream_array_end(&js);
+    json_stream_uint(&js, "next", cur.end);
+    json_stream_uint(&js, "lost", cur.lost);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
 }
 
 // Handler for OTA
@@ -351,31 +466,69 @@ static esp_err_t ota_handler(httpd_req_t *req)
     esp_err_t err = ota_handler_start(url_copy);
     cJSON_Delete(root);
 
-    cJSON *response = cJSON_CreateObject();
     if (err == ESP_OK) {
-        cJSON_AddBoolToObject(response, "success", true);
-        cJSON_AddStringToObject(response, "message", "OTA started");
         debug_server_log("OTA started: %s", url_copy);
-    } else {
-        cJSON_AddBoolToObject(response, "success", false);
-        cJSON_AddStringToObject(response, "message", esp_err_to_name(err));
+        return json_stream_send_result(req, true, "OTA started");
     }
+    return json_stream_send_result(req, false, esp_err_to_name(err));
+}
 
-    char *json = cJSON_PrintUnformatted(response);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+#if CONFIG_ENABLE_HID
+static SemaphoreHandle_t s_type_done = NULL;
+static esp_err_t s_type_result;
 
-    free(json);
-    cJSON_Delete(response);
-    return ESP_OK;
+static void type_done(esp_err_t result, const uint8_t *data, size_t len, void *ctx, uint64_t cookie)
+{
+    s_type_result = result;
+    xSemaphoreGive(s_type_done);
 }
 
+// Type short text through the ingest bus and wait for the outcome
+static esp_err_t type_text(const char *text)
+{
+    if (s_type_done == NULL) {
+        s_type_done = xSemaphoreCreateBinary();
+        if (s_type_done == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    uint8_t packet[CONFIG_INGEST_MAX_CMD];
+    size_t len = strlen(text);
+    if (len + 1 > sizeof(packet)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    packet[0] = CMD_INSERT;
+    memcpy(packet + 1, text, len);
+
+    esp_err_t err = ingest_submit(INGEST_SRC_HTTP, packet, len + 1, 0, type_done, NULL, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Every submitted command completes (typed or flushed)
+    xSemaphoreTake(s_type_done, portMAX_DELAY);
+    return s_type_result;
+}
+#endif
+
 // Handler for type test
 static esp_err_t type_handler(httpd_req_t *req)
 {
-    cJSON *response = cJSON_CreateObject();
-
 #if CONFIG_ENABLE_HID
+    // Large texts: stream the body into a background job (POST /type?async=1)
+    if (query_u32(req, "async", 0)) {
+        esp_err_t err = type_job_start(req);
+        if (err == ESP_ERR_INVALID_STATE) {
+            httpd_resp_set_status(req, "409 Conflict");
+            return json_stream_send_result(req, false, "Typing job already running");
+        }
+        if (err != ESP_OK) {
+            return json_stream_send_result(req, false, esp_err_to_name(err));
+        }
+        debug_server_log("Typing job started (%u bytes)", (unsigned)req->content_len);
+        return ESP_OK;
+    }
+
     // Read request body for text to type
     char buf[256] = {0};
     int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
@@ -384,52 +537,74 @@ static esp_err_t type_handler(httpd_req_t *req)
 
     if (ret > 0) {
         cJSON *root = cJSON_Parse(buf);
-        if (root) {
-            cJSON *text_json = cJSON_GetObjectItem(root, "text");
-            if (text_json && cJSON_IsString(text_json)) {
-                text_to_type = text_json->valuestring;
-            }
+        if (root == NULL) {
+            return json_stream_send_result(req, false, "Invalid JSON");
+        }
 
-            esp_err_t err = usb_hid_type_text(text_to_type);
-            if (err == ESP_OK) {
-                cJSON_AddBoolToObject(response, "success", true);
-                cJSON_AddStringToObject(response, "message", "Text typed successfully");
-                debug_server_log("Typed: %s", text_to_type);
-            } else {
-                cJSON_AddBoolToObject(response, "success", false);
-                cJSON_AddStringToObject(response, "message", esp_err_to_name(err));
-                debug_server_log("Type failed: %s", esp_err_to_name(err));
-            }
-            cJSON_Delete(root);
-        } else {
-            cJSON_AddBoolToObject(response, "success", false);
-            cJSON_AddStringToObject(response, "message", "Invalid JSON");
+        cJSON *text_json = cJSON_GetObjectItem(root, "text");
+        if (text_json && cJSON_IsString(text_json)) {
+            text_to_type = text_json->valuestring;
         }
-    } else {
-        // No body - type default
-        esp_err_t err = usb_hid_type_text(text_to_type);
+
+        esp_err_t err = type_text(text_to_type);
         if (err == ESP_OK) {
-            cJSON_AddBoolToObject(response, "success", true);
-            cJSON_AddStringToObject(response, "message", "Typed 'hello world'");
+            debug_server_log("Typed: %s", text_to_type);
         } else {
-            cJSON_AddBoolToObject(response, "success", false);
-            cJSON_AddStringToObject(response, "message", esp_err_to_name(err));
+            debug_server_log("Type failed: %s", esp_err_to_name(err));
         }
+        cJSON_Delete(root);
+        return json_stream_send_result(req, err == ESP_OK,
+                                       err == ESP_OK ? "Text typed successfully" : esp_err_to_name(err));
     }
+
+    // No body - type default
+    esp_err_t err = type_text(text_to_type);
+    return json_stream_send_result(req, err == ESP_OK,
+                                   err == ESP_OK ? "Typed 'hello world'" : esp_err_to_name(err));
 #else
-    cJSON_AddBoolToObject(response, "success", false);
-    cJSON_AddStringToObject(response, "message", "HID disabled");
     debug_server_log("Type requested but HID disabled");
+    return json_stream_send_result(req, false, "HID disabled");
 #endif
+}
 
-    char *json = cJSON_PrintUnformatted(response);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+#if CONFIG_ENABLE_HID
+// Handler for typing job progress (GET /type/job)
+static esp_err_t type_job_status_handler(httpd_req_t *req)
+{
+    type_job_status_t st;
+    type_job_get_status(&st);
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_uint(&js, "job", st.id);
+    json_stream_string(&js, "state", type_job_state_name(st.state));
+    json_stream_bool(&js, "receiving", st.receiving);
+    json_stream_uint(&js, "bytes_total", st.bytes_total);
+    json_stream_uint(&js, "bytes_received", st.bytes_received);
+    json_stream_uint(&js, "chars_typed", st.chars_typed);
+    json_stream_uint(&js, "elapsed_ms", st.elapsed_ms);
+    json_stream_number(&js, "chars_per_sec",
+                       st.elapsed_ms > 0 ? st.chars_typed * 1000.0 / st.elapsed_ms : 0);
+    if (st.state == TYPE_JOB_FAILED) {
+        json_stream_string(&js, "error", esp_err_to_name(st.error));
+    }
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
 
-    free(json);
-    cJSON_Delete(response);
-    return ESP_OK;
+// Handler to cancel a typing job (DELETE /type/job?id=N, no id = current)
+static esp_err_t type_job_cancel_handler(httpd_req_t *req)
+{
+    uint32_t id = query_u32(req, "id", 0);
+    if (type_job_cancel(id) != ESP_OK) {
+        httpd_resp_set_status(req, "404 Not Found");
+        return json_stream_send_result(req, false, "No such running job");
+    }
+    debug_server_log("Typing job cancel requested");
+    return json_stream_send_result(req, true, "Cancelling");
 }
+#endif
 
 // Handler for reset WiFi
 static esp_err_t reset_wifi_handler(httpd_req_t *req)
@@ -437,16 +612,7 @@ static esp_err_t reset_wifi_handler(httpd_req_t *req)
     debug_server_log("WiFi reset requested");
     wifi_manager_clear_credentials();
 
-    cJSON *response = cJSON_CreateObject();
-    cJSON_AddBoolToObject(response, "success", true);
-    cJSON_AddStringToObject(response, "message", "WiFi credentials cleared, rebooting...");
-
-    char *json = cJSON_PrintUnformatted(response);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
-
-    free(json);
-    cJSON_Delete(response);
+    json_stream_send_result(req, true, "WiFi credentials cleared, rebooting...");
 
     vTaskDelay(pdMS_TO_TICKS(1000));
     esp_restart();
@@ -459,16 +625,7 @@ static esp_err_t reboot_handler(httpd_req_t *req)
 {
     debug_server_log("Reboot requested");
 
-    cJSON *response = cJSON_CreateObject();
-    cJSON_AddBoolToObject(response, "success", true);
-    cJSON_AddStringToObject(response, "message", "Rebooting...");
-
-    char *json = cJSON_PrintUnformatted(response);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
-
-    free(json);
-    cJSON_Delete(response);
+    json_stream_send_result(req, true, "Rebooting...");
 
     vTaskDelay(pdMS_TO_TICKS(1000));
     esp_restart();
@@ -479,32 +636,33 @@ static esp_err_t reboot_handler(httpd_req_t *req)
 // Handler for GET keyboard layout
 static esp_err_t keyboard_get_handler(httpd_req_t *req)
 {
-    cJSON *root = cJSON_CreateObject();
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
 
     // Current layout
     keyboard_layout_t current = keyboard_layout_get();
     const keyboard_layout_info_t *info = keyboard_layout_get_info(current);
-    cJSON_AddStringToObject(root, "current", info ? info->code : "us");
+    json_stream_string(&js, "current", info ? info->code : "us");
+    info = keyboard_layout_get_info(keyboard_layout_get_default());
+    json_stream_string(&js, "default", info ? info->code : "us");
 
     // All available layouts
     int count = 0;
     const keyboard_layout_info_t *layouts = keyboard_layout_get_all(&count);
-    cJSON *layouts_arr = cJSON_CreateArray();
+    json_stream_array_begin(&js, "layouts");
     for (int i = 0; i < count; i++) {
-        cJSON *layout_obj = cJSON_CreateObject();
-        cJSON_AddStringToObject(layout_obj, "code", layouts[i].code);
-        cJSON_AddStringToObject(layout_obj, "name", layouts[i].name);
-        cJSON_AddItemToArray(layouts_arr, layout_obj);
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "code", layouts[i].code);
+        json_stream_string(&js, "name", layouts[i].name);
+        json_stream_uint(&js, "country", layouts[i].hid_country);
+        json_stream_string(&js, "source", layouts[i].packed ? "pack" : "builtin");
+        json_stream_object_end(&js);
     }
-    cJSON_AddItemToObject(root, "layouts", layouts_arr);
-
-    char *json = cJSON_PrintUnformatted(root);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    json_stream_array_end(&js);
 
-    free(json);
-    cJSON_Delete(root);
-    return ESP_OK;
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
 }
 
 // Handler for POST keyboard layout
@@ -534,62 +692,1169 @@ static esp_err_t keyboard_post_handler(httpd_req_t *req)
     esp_err_t err = keyboard_layout_set_by_code(layout_json->valuestring);
     cJSON_Delete(root);
 
-    cJSON *response = cJSON_CreateObject();
+    if (err != ESP_OK) {
+        return json_stream_send_result(req, false, "Invalid layout code");
+    }
+    const keyboard_layout_info_t *info = keyboard_layout_get_info(keyboard_layout_get());
+    debug_server_log("Keyboard layout: %s", info ? info->name : "unknown");
+    return json_stream_send_result(req, true, info ? info->name : "Layout set");
+}
+
+// Handler for GET /host: host OS detection, the evidence behind the guess
+// and what it selects
+static esp_err_t host_get_handler(httpd_req_t *req)
+{
+    host_os_status_t st;
+    host_os_get_status(&st);
+    host_speed_t speed = host_os_get_speed();
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "os", host_os_name(st.os));
+    json_stream_string(&js, "guess", host_os_name(st.guess));
+    json_stream_bool(&js, "override", st.overridden);
+    json_stream_bool(&js, "settled", st.settled);
+    json_stream_bool(&js, "calibrated", st.calibrated);
+    json_stream_uint(&js, "press_ms", speed.press_ms);
+    json_stream_uint(&js, "release_ms", speed.release_ms);
+
+    json_stream_object_begin(&js, "evidence");
+    json_stream_uint(&js, "report_desc_requests", st.report_desc_requests);
+    json_stream_bool(&js, "set_idle", st.set_idle);
+    json_stream_bool(&js, "idle_before_desc", st.idle_before_desc);
+    json_stream_uint(&js, "idle_rate", st.idle_rate);
+    json_stream_int(&js, "protocol", st.protocol);
+    json_stream_uint(&js, "led_reports", st.led_reports);
+    json_stream_int(&js, "first_led_ms", st.first_led_ms);
+    json_stream_object_end(&js);
+
+    json_stream_array_begin(&js, "shortcuts");
+    for (int i = 0; i < HOST_SHORTCUT_COUNT; i++) {
+        host_key_t key;
+        host_os_get_shortcut((host_shortcut_t)i, &key);
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "id", i);
+        json_stream_uint(&js, "keycode", key.keycode);
+        json_stream_uint(&js, "modifiers", key.modifiers);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
+
+// Handler for POST /host {"os": "macos"}: override the guess ("auto" clears)
+static esp_err_t host_post_handler(httpd_req_t *req)
+{
+    char buf[64];
+    int ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+    if (ret <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No data");
+        return ESP_FAIL;
+    }
+    buf[ret] = '\0';
+
+    cJSON *root = cJSON_Parse(buf);
+    if (root == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+        return ESP_FAIL;
+    }
+
+    host_os_t os;
+    cJSON *os_json = cJSON_GetObjectItem(root, "os");
+    esp_err_t err = cJSON_IsString(os_json) ? host_os_from_name(os_json->valuestring, &os)
+                                            : ESP_ERR_INVALID_ARG;
+    cJSON_Delete(root);
+    if (err != ESP_OK) {
+        return json_stream_send_result(req, false, "os must be auto, windows, macos, linux or boot");
+    }
+
+    host_os_set_override(os);
+    debug_server_log("Host OS: %s", os == HOST_OS_UNKNOWN ? "auto" : host_os_name(os));
+    return json_stream_send_result(req, true, host_os_name(host_os_get()));
+}
+
+// Measure the host's keystroke rate and send the result (async worker)
+static esp_err_t host_calibrate_run(httpd_req_t *req, uint32_t save)
+{
+    usb_hid_calibration_t cal;
+    esp_err_t err = usb_hid_calibrate(&cal);
+    if (err == ESP_ERR_INVALID_STATE) {
+        return json_stream_send_result(req, false, "USB not mounted");
+    }
+
+    bool saved = false;
+    if (err == ESP_OK && save) {
+        saved = host_os_set_speed(host_os_get(), &cal.speed) == ESP_OK;
+        debug_server_log("Calibrated %s: %u/%u ms", host_os_name(host_os_get()),
+                         cal.speed.press_ms, cal.speed.release_ms);
+    }
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_bool(&js, "success", err == ESP_OK);
+    json_stream_string(&js, "host", host_os_name(host_os_get()));
+    json_stream_bool(&js, "echo", cal.echo);
+    json_stream_uint(&js, "rtt_min_us", cal.rtt_min_us);
+    json_stream_uint(&js, "rtt_avg_us", cal.rtt_avg_us);
+    json_stream_uint(&js, "rtt_max_us", cal.rtt_max_us);
+    json_stream_array_begin(&js, "steps");
+    for (int i = 0; i < cal.steps; i++) {
+        json_stream_object_begin(&js, NULL);
+        json_stream_uint(&js, "press_ms", cal.step[i].press_ms);
+        json_stream_uint(&js, "release_ms", cal.step[i].release_ms);
+        json_stream_uint(&js, "sent", cal.step[i].sent);
+        json_stream_uint(&js, "failed", cal.step[i].failed);
+        json_stream_uint(&js, "echoed", cal.step[i].echoed);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
     if (err == ESP_OK) {
-        const keyboard_layout_info_t *info = keyboard_layout_get_info(keyboard_layout_get());
-        cJSON_AddBoolToObject(response, "success", true);
-        cJSON_AddStringToObject(response, "message", info ? info->name : "Layout set");
-        debug_server_log("Keyboard layout: %s", info ? info->name : "unknown");
-    } else {
-        cJSON_AddBoolToObject(response, "success", false);
-        cJSON_AddStringToObject(response, "message", "Invalid layout code");
+        json_stream_uint(&js, "press_ms", cal.speed.press_ms);
+        json_stream_uint(&js, "release_ms", cal.speed.release_ms);
     }
+    json_stream_bool(&js, "saved", saved);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
 
-    char *json = cJSON_PrintUnformatted(response);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+// Handler for POST /host/calibrate: measure the host's keystroke rate from
+// the Num Lock LED echo and save it as this host OS's speed (?save=0 only
+// measures). Runs on the async worker; typing waits for it.
+static esp_err_t host_calibrate_handler(httpd_req_t *req)
+{
+    return async_run(req, host_calibrate_run, query_u32(req, "save", 1) != 0);
+}
 
-    free(json);
-    cJSON_Delete(response);
-    return ESP_OK;
+// Handler for DELETE /host/calibrate: back to the built-in speed
+static esp_err_t host_calibrate_delete_handler(httpd_req_t *req)
+{
+    host_os_set_speed(host_os_get(), NULL);
+    return json_stream_send_result(req, true, host_os_name(host_os_get()));
 }
 
-// Handler for trace data
+// Handler for a typing plan preview (POST /keyboard/plan, raw UTF-8 body):
+// the keystrokes the current layout would send, without typing them
+static esp_err_t keyboard_plan_handler(httpd_req_t *req)
+{
+    char text[256];
+    int len = httpd_req_recv(req, text, sizeof(text));
+    if (len <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No data");
+        return ESP_FAIL;
+    }
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_array_begin(&js, "keystrokes");
+
+    keyboard_keystroke_t keys[32];
+    size_t pos = 0;
+    uint32_t total = 0, chars = 0, unmapped = 0, mod_changes = 0;
+    uint8_t mods = 0;
+    while (pos < len) {
+        keyboard_plan_t plan;
+        keyboard_layout_plan(NULL, text + pos, len - pos, keys, sizeof(keys) / sizeof(keys[0]), &plan);
+        for (size_t i = 0; i < plan.keys; i++) {
+            json_stream_object_begin(&js, NULL);
+            json_stream_uint(&js, "offset", pos + keys[i].offset);
+            json_stream_uint(&js, "keycode", keys[i].keycode);
+            json_stream_uint(&js, "modifiers", keys[i].modifiers);
+            json_stream_object_end(&js);
+            mod_changes += __builtin_popcount(mods ^ keys[i].modifiers);
+            mods = keys[i].modifiers;
+        }
+        total += plan.keys;
+        chars += plan.chars;
+        unmapped += plan.unmapped;
+        if (plan.consumed == 0) {
+            break;      // Body ends inside a UTF-8 sequence
+        }
+        pos += plan.consumed;
+    }
+    mod_changes += __builtin_popcount(mods);
+
+    json_stream_array_end(&js);
+    json_stream_uint(&js, "keys", total);
+    json_stream_uint(&js, "chars", chars);
+    json_stream_uint(&js, "unmapped", unmapped);
+    json_stream_uint(&js, "modifier_changes", mod_changes);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
+
+// Handler for layout pack upload (raw tools/gen_layouts.py --pack output)
+static esp_err_t keyboard_pack_handler(httpd_req_t *req)
+{
+    size_t total = req->content_len;
+    if (total == 0 || total > CONFIG_LAYOUT_PACK_MAX_SIZE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad pack size");
+        return ESP_FAIL;
+    }
+    uint8_t *pack = malloc(total);
+    if (pack == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    // Whole pack in RAM first: a bad upload never touches the stored pack
+    size_t received = 0;
+    while (received < total) {
+        int n = httpd_req_recv(req, (char *)pack + received, total - received);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (n <= 0) {
+            free(pack);
+            return ESP_FAIL;
+        }
+        received += n;
+    }
+
+    esp_err_t err = keyboard_layout_install_pack(pack, total);
+    free(pack);
+    if (err != ESP_OK) {
+        debug_server_log("Layout pack upload failed: %s", esp_err_to_name(err));
+        return json_stream_send_result(req, false, esp_err_to_name(err));
+    }
+
+    int count = 0;
+    const keyboard_layout_info_t *layouts = keyboard_layout_get_all(&count);
+    int packed = 0;
+    for (int i = 0; i < count; i++) {
+        packed += layouts[i].packed;
+    }
+    debug_server_log("Layout pack installed: %d layouts", packed);
+    return json_stream_send_result(req, true, "Layout pack installed");
+}
+
+// Handler for trace data (?since=<seq>&limit=N returns only newer records)
 static esp_err_t trace_handler(httpd_req_t *req)
 {
-    cJSON *root = cJSON_CreateObject();
-    cJSON *ble_arr = cJSON_CreateArray();
-    cJSON *hid_arr = cJSON_CreateArray();
+    static const struct {
+        trace_stage_t stage;
+        const char *key;
+    } arrays[] = { { TRACE_STAGE_BLE, "ble" }, { TRACE_STAGE_HID, "hid" } };
+
+    json_stream_t js;
+    cursor_t cur;
+
+    uint32_t head = atomic_load_explicit(&s_trace_seq, memory_order_acquire);
+    uint32_t oldest = head > CONFIG_TRACE_RING_SIZE ? head - CONFIG_TRACE_RING_SIZE : 0;
+    cursor_resolve(req, oldest, head, &cur);
+
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+
+    // One pass per stage array. Misses are counted in the first pass only:
+    // a record unreadable then is lost to both arrays, while one overwritten
+    // between the passes may already have been sent
+    uint32_t missed = 0;
+    for (int a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        json_stream_array_begin(&js, arrays[a].key);
+        for (uint32_t seq = cur.start; seq != cur.end; seq++) {
+            trace_record_t rec;
+            if (!trace_read(seq, &rec)) {
+                if (a == 0) {
+                    missed++;
+                }
+                continue;
+            }
+            if (rec.stage != arrays[a].stage) {
+                continue;
+            }
+            char msg[TRACE_MSG_LEN];
+            trace_format(&rec, msg, sizeof(msg));
+            json_stream_string(&js, NULL, msg);
+        }
+        json_stream_array_end(&js);
+    }
+
+    json_stream_uint(&js, "next", cur.end);
+    json_stream_uint(&js, "lost", cur.lost + missed);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
+
+// Buffered writer for chunked text responses
+typedef struct {
+    httpd_req_t *req;
+    size_t len;
+    char buf[512];
+} resp_writer_t;
 
-    if (s_trace_mutex != NULL) {
-        xSemaphoreTake(s_trace_mutex, portMAX_DELAY);
+static void resp_flush(resp_writer_t *w)
+{
+    if (w->len > 0) {
+        httpd_resp_send_chunk(w->req, w->buf, w->len);
+        w->len = 0;
+    }
+}
+
+static void resp_printf(resp_writer_t *w, const char *format, ...)
+{
+    char line[160];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    if (n >= sizeof(line)) {
+        n = sizeof(line) - 1;
+    }
+    if (w->len + n > sizeof(w->buf)) {
+        resp_flush(w);
+    }
+    memcpy(w->buf + w->len, line, n);
+    w->len += n;
+}
+
+// Format microseconds as seconds for Prometheus ("0.000250")
+#define US_AS_SECONDS_FMT "%" PRIu32 ".%06" PRIu32
+#define US_AS_SECONDS(us) (uint32_t)((us) / 1000000), (uint32_t)((us) % 1000000)
+
+// Handler for Prometheus metrics
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    static const struct {
+        metrics_counter_t id;
+        const char *name;
+        const char *help;
+    } counters[] = {
+        { METRIC_COMMANDS,   "ioskbd_commands_total",            "Commands processed" },
+        { METRIC_CHARACTERS, "ioskbd_characters_total",          "Characters typed" },
+        { METRIC_BACKSPACES, "ioskbd_backspaces_total",          "Backspace keystrokes sent" },
+        { METRIC_DROPS,      "ioskbd_drops_total",               "Commands dropped" },
+        { METRIC_UNMAPPED,   "ioskbd_unmapped_codepoints_total", "Codepoints without a keycode in the current layout" },
+    };
+    static const struct {
+        float q;
+        const char *label;
+    } quantiles[] = { { 0.50f, "0.5" }, { 0.95f, "0.95" }, { 0.99f, "0.99" } };
+
+    resp_writer_t w = { .req = req, .len = 0 };
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    for (int i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        resp_printf(&w, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu32 "\n",
+                       counters[i].name, counters[i].help, counters[i].name,
+                       counters[i].name, metrics_get_counter(counters[i].id));
+    }
+
+    metrics_histogram_t hist[METRIC_STAGE_COUNT];
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        metrics_get_histogram(s, &hist[s]);
+    }
 
-        // BLE trace
-        int ble_start = (s_ble_trace_count < DEBUG_TRACE_SIZE) ? 0 : s_ble_trace_idx;
-        for (int i = 0; i < s_ble_trace_count; i++) {
-            int idx = (ble_start + i) % DEBUG_TRACE_SIZE;
-            cJSON_AddItemToArray(ble_arr, cJSON_CreateString(s_ble_trace[idx]));
+    resp_printf(&w, "# HELP ioskbd_latency_seconds Latency from command receive to pipeline stage\n"
+                       "# TYPE ioskbd_latency_seconds histogram\n");
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        const char *stage = metrics_stage_name(s);
+        uint32_t cumulative = 0;
+        for (int b = 0; b < METRICS_BUCKET_COUNT; b++) {
+            cumulative += hist[s].buckets[b];
+            if (b == METRICS_BUCKET_COUNT - 1) {
+                resp_printf(&w, "ioskbd_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" PRIu32 "\n",
+                               stage, cumulative);
+            } else {
+                resp_printf(&w, "ioskbd_latency_seconds_bucket{stage=\"%s\",le=\"" US_AS_SECONDS_FMT "\"} %" PRIu32 "\n",
+                               stage, US_AS_SECONDS(metrics_bucket_bound_us(b)), cumulative);
+            }
+        }
+        resp_printf(&w, "ioskbd_latency_seconds_sum{stage=\"%s\"} " US_AS_SECONDS_FMT "\n",
+                       stage, US_AS_SECONDS(hist[s].sum_us));
+        resp_printf(&w, "ioskbd_latency_seconds_count{stage=\"%s\"} %" PRIu32 "\n",
+                       stage, hist[s].count);
+    }
+
+    resp_printf(&w, "# HELP ioskbd_latency_quantile_seconds Latency quantile estimated from the histogram\n"
+                       "# TYPE ioskbd_latency_quantile_seconds gauge\n");
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        for (int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            uint32_t us = metrics_quantile_us(&hist[s], quantiles[q].q);
+            resp_printf(&w, "ioskbd_latency_quantile_seconds{stage=\"%s\",quantile=\"%s\"} " US_AS_SECONDS_FMT "\n",
+                           metrics_stage_name(s), quantiles[q].label, US_AS_SECONDS(us));
+        }
+    }
+
+    ingest_stats_t ingest[INGEST_SRC_COUNT];
+    for (int i = 0; i < INGEST_SRC_COUNT; i++) {
+        ingest_get_stats(i, &ingest[i]);
+    }
+
+    resp_printf(&w, "# HELP ioskbd_ingest_commands_total Commands per ingest source and outcome\n"
+                       "# TYPE ioskbd_ingest_commands_total counter\n");
+    for (int i = 0; i < INGEST_SRC_COUNT; i++) {
+        const char *src = ingest_source_name(i);
+        resp_printf(&w, "ioskbd_ingest_commands_total{source=\"%s\",result=\"ok\"} %" PRIu32 "\n",
+                       src, ingest[i].executed);
+        resp_printf(&w, "ioskbd_ingest_commands_total{source=\"%s\",result=\"error\"} %" PRIu32 "\n",
+                       src, ingest[i].errors);
+        resp_printf(&w, "ioskbd_ingest_commands_total{source=\"%s\",result=\"dropped\"} %" PRIu32 "\n",
+                       src, ingest[i].dropped);
+    }
+    resp_printf(&w, "# HELP ioskbd_ingest_throttled_total Commands delayed by the source rate limit\n"
+                       "# TYPE ioskbd_ingest_throttled_total counter\n");
+    for (int i = 0; i < INGEST_SRC_COUNT; i++) {
+        resp_printf(&w, "ioskbd_ingest_throttled_total{source=\"%s\"} %" PRIu32 "\n",
+                       ingest_source_name(i), ingest[i].throttled);
+    }
+    resp_printf(&w, "# HELP ioskbd_ingest_queued Commands waiting per ingest source\n"
+                       "# TYPE ioskbd_ingest_queued gauge\n");
+    for (int i = 0; i < INGEST_SRC_COUNT; i++) {
+        resp_printf(&w, "ioskbd_ingest_queued{source=\"%s\"} %" PRIu32 "\n",
+                       ingest_source_name(i), ingest[i].queued);
+    }
+
+    resp_flush(&w);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+static void flash_log_line(const log_store_line_t *line, void *ctx)
+{
+    resp_writer_t *w = ctx;
+    resp_printf(w, "[boot %" PRIu32 " +%" PRIu32 ".%03" PRIu32 "] %.*s\n", line->boot,
+                line->uptime_ms / 1000, line->uptime_ms % 1000, (int)line->len, line->text);
+}
+
+// Handler for the persistent flash log (GET /logs/flash), oldest line first
+static esp_err_t flash_log_handler(httpd_req_t *req)
+{
+    log_store_status_t st;
+    log_store_get_status(&st);
+    if (!st.enabled) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No logs partition");
+        return ESP_FAIL;
+    }
+
+    // Include what is still staged in RAM
+    log_store_flush();
+
+    resp_writer_t w = { .req = req, .len = 0 };
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"ioskbd-log.txt\"");
+    log_store_read(flash_log_line, &w);
+    resp_flush(&w);
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Send capture state as JSON
+static esp_err_t capture_send_status(httpd_req_t *req)
+{
+    trace_capture_status_t st;
+    trace_capture_get_status(&st);
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_bool(&js, "active", st.active);
+    json_stream_uint(&js, "duration_ms", st.duration_ms);
+    json_stream_uint(&js, "recorded", st.recorded);
+    json_stream_uint(&js, "dropped", st.dropped);
+    json_stream_uint(&js, "capacity", st.capacity);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
+
+// Handler to start a trace capture (POST /capture?ms=3000)
+static esp_err_t capture_start_handler(httpd_req_t *req)
+{
+    uint32_t duration_ms = query_u32(req, "ms", 3000);
+
+    esp_err_t err = trace_capture_start(duration_ms);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    debug_server_log("Trace capture started (%" PRIu32 " ms)", duration_ms);
+
+    return capture_send_status(req);
+}
+
+// Handler for capture state
+static esp_err_t capture_status_handler(httpd_req_t *req)
+{
+    return capture_send_status(req);
+}
+
+static const char *task_state_name(eTaskState state)
+{
+    switch (state) {
+        case eRunning:   return "running";
+        case eReady:     return "ready";
+        case eBlocked:   return "blocked";
+        case eSuspended: return "suspended";
+        default:         return "deleted";
+    }
+}
+
+// Write a profile report as JSON
+static esp_err_t send_profile(httpd_req_t *req, const profiler_report_t *report, const char *span)
+{
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "span", span);
+    json_stream_uint(&js, "span_ms", (uint32_t)(report->span_us / 1000));
+    json_stream_uint(&js, "cores", portNUM_PROCESSORS);
+
+    // CPU percent of the whole chip: all tasks (idle included) add up to 100
+    double capacity_us = (double)report->span_us * portNUM_PROCESSORS;
+    json_stream_array_begin(&js, "tasks");
+    for (int i = 0; i < report->task_count; i++) {
+        const profiler_task_t *t = &report->tasks[i];
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "name", t->name);
+        json_stream_number(&js, "cpu", capacity_us > 0 ? t->runtime_us * 100.0 / capacity_us : 0);
+        json_stream_uint(&js, "runtime_ms", (uint32_t)(t->runtime_us / 1000));
+        json_stream_int(&js, "core", t->core);
+        json_stream_uint(&js, "priority", t->priority);
+        json_stream_uint(&js, "stack_free", t->stack_free);
+        json_stream_string(&js, "state", task_state_name(t->state));
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+
+    json_stream_array_begin(&js, "heap");
+    for (int i = 0; i < report->heap_count; i++) {
+        const profiler_heap_t *h = &report->heaps[i];
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "caps", h->name);
+        json_stream_uint(&js, "total", h->total);
+        json_stream_uint(&js, "free", h->free);
+        json_stream_int(&js, "free_delta", h->free_delta);
+        json_stream_uint(&js, "largest_free", h->largest_free);
+        json_stream_uint(&js, "min_free", h->min_free);
+        json_stream_uint(&js, "fragmentation", h->fragmentation);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
+
+// Sample a profile window and send it (async worker)
+static esp_err_t profile_window_run(httpd_req_t *req, uint32_t window_ms)
+{
+    static profiler_report_t report;    // Worker only; too big for its stack
+    esp_err_t err = profiler_collect(window_ms, false, &report);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return send_profile(req, &report, "window");
+}
+
+// Handler for task/heap profile (GET /profile, ?ms=1000 to sample a
+// window, ?delta=1 for the span since POST /profile/mark)
+static esp_err_t profile_handler(httpd_req_t *req)
+{
+    static profiler_report_t report;    // Server task only; too big for its stack
+    uint32_t window_ms = query_u32(req, "ms", 0);
+    bool delta = query_u32(req, "delta", 0) != 0;
+    if (window_ms > CONFIG_PROFILE_MAX_WINDOW_MS) {
+        window_ms = CONFIG_PROFILE_MAX_WINDOW_MS;
+    }
+    if (window_ms > 0) {
+        return async_run(req, profile_window_run, window_ms);   // Sleeps for the window
+    }
+
+    esp_err_t err = profiler_collect(0, delta, &report);
+    if (err == ESP_ERR_INVALID_STATE) {
+        httpd_resp_set_status(req, "409 Conflict");
+        return json_stream_send_result(req, false, "No mark set (POST /profile/mark)");
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return send_profile(req, &report, delta ? "mark" : "boot");
+}
+
+// UTF-8 decode benchmark corpora, repeated to fill the buffer
+static const struct {
+    const char *name;
+    const char *text;
+} s_utf8_corpora[] = {
+    {"ascii", "The quick brown fox jumps over the lazy dog. 0123456789, (ok)?\n"},
+    {"latin", "Gr\xC3\xBC" "ezi mit\xC3\xA4nand, \xC3\xA7" "a va tr\xC3\xA8s bien, \xC3\xB6" "ffnen\n"},
+    {"cjk", "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E \xED\x95\x9C\xEA\xB5\xAD\xEC\x96\xB4 "
+            "\xF0\x9F\x98\x80\xF0\x9F\x91\x8D ok\n"},
+    {"invalid", "ab\xC0\xAF\xE0\x80\xAF\xED\xA0\x80\xF4\x90\x80\x80\x80\xFFz\n"},
+};
+
+// Bytes per second over elapsed microseconds, in MB/s
+static double bench_mbps(size_t bytes, int64_t us)
+{
+    return us > 0 ? (double)bytes / (double)us : 0;
+}
+
+// Handler for the UTF-8 decoder benchmark (GET /bench/utf8?kb=4&rounds=32)
+// "fast" uses the ASCII word skip, "bytewise" decodes one byte at a time
+static esp_err_t bench_utf8_handler(httpd_req_t *req)
+{
+    uint32_t kb = query_u32(req, "kb", 4);
+    uint32_t rounds = query_u32(req, "rounds", 32);
+    if (kb < 1 || kb > 32) {
+        kb = 4;
+    }
+    if (rounds < 1 || rounds > 1024) {
+        rounds = 32;
+    }
+
+    size_t size = kb * 1024;
+    char *buf = malloc(size);
+    if (buf == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_uint(&js, "bytes", size);
+    json_stream_uint(&js, "rounds", rounds);
+    json_stream_array_begin(&js, "corpora");
+
+    for (int c = 0; c < sizeof(s_utf8_corpora) / sizeof(s_utf8_corpora[0]); c++) {
+        // Fill with whole copies only, so no sequence is cut at the end
+        size_t n = strlen(s_utf8_corpora[c].text);
+        size_t used = 0;
+        while (used + n <= size) {
+            memcpy(buf + used, s_utf8_corpora[c].text, n);
+            used += n;
         }
 
-        // HID trace
-        int hid_start = (s_hid_trace_count < DEBUG_TRACE_SIZE) ? 0 : s_hid_trace_idx;
-        for (int i = 0; i < s_hid_trace_count; i++) {
-            int idx = (hid_start + i) % DEBUG_TRACE_SIZE;
-            cJSON_AddItemToArray(hid_arr, cJSON_CreateString(s_hid_trace[idx]));
+        utf8_decoder_t dec;
+        size_t chars = 0;
+        size_t invalid = 0;
+        int64_t start = esp_timer_get_time();
+        for (uint32_t r = 0; r < rounds; r++) {
+            utf8_decoder_reset(&dec);
+            chars = utf8_count(&dec, buf, used, &invalid);
         }
+        int64_t fast_us = esp_timer_get_time() - start;
 
-        xSemaphoreGive(s_trace_mutex);
+        start = esp_timer_get_time();
+        for (uint32_t r = 0; r < rounds; r++) {
+            utf8_decoder_reset(&dec);
+            size_t pos = 0;
+            while (utf8_decode_next(&dec, buf, used, &pos) != UTF8_NEED_MORE) {
+            }
+        }
+        int64_t bytewise_us = esp_timer_get_time() - start;
+
+        size_t total = used * rounds;
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "name", s_utf8_corpora[c].name);
+        json_stream_uint(&js, "bytes", used);
+        json_stream_uint(&js, "chars", chars);
+        json_stream_uint(&js, "invalid", invalid);
+        json_stream_number(&js, "fast_mbps", bench_mbps(total, fast_us));
+        json_stream_number(&js, "bytewise_mbps", bench_mbps(total, bytewise_us));
+        json_stream_object_end(&js);
     }
 
-    cJSON_AddItemToObject(root, "ble", ble_arr);
-    cJSON_AddItemToObject(root, "hid", hid_arr);
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    free(buf);
+    return json_stream_finish(&js);
+}
 
-    char *json = cJSON_PrintUnformatted(root);
+// Handler to start a delta profile (e.g. at dictation start)
+static esp_err_t profile_mark_handler(httpd_req_t *req)
+{
+    esp_err_t err = profiler_mark();
+    if (err == ESP_OK) {
+        debug_server_log("Profile mark set");
+    }
+    return json_stream_send_result(req, err == ESP_OK,
+                                   err == ESP_OK ? "Mark set" : esp_err_to_name(err));
+}
+
+// Look up a task name in a system state snapshot
+static const char *capture_task_name(const TaskStatus_t *tasks, UBaseType_t count, void *handle)
+{
+    for (UBaseType_t i = 0; i < count; i++) {
+        if (tasks[i].xHandle == handle) {
+            return tasks[i].pcTaskName;
+        }
+    }
+    return "exited";
+}
+
+// Handler for the Chrome/Perfetto trace-event export of the last capture
+static esp_err_t capture_trace_handler(httpd_req_t *req)
+{
+    trace_capture_status_t st;
+    trace_capture_get_status(&st);
+    if (st.active) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_send(req, "Capture in progress", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    // Task names for thread labels (tasks deleted since the capture show as "exited")
+    UBaseType_t task_max = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = malloc(task_max * sizeof(TaskStatus_t));
+    UBaseType_t task_count = tasks ? uxTaskGetSystemState(tasks, task_max, NULL) : 0;
+
+    resp_writer_t w = { .req = req, .len = 0 };
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"ioskbd-trace.json\"");
+
+    // pid 1: pipeline spans per task, pid 2: which task ran on each core
+    resp_printf(&w, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+                    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"pipeline\"}},"
+                    "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"cpu\"}}");
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        resp_printf(&w, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":%d,\"args\":{\"name\":\"core %d\"}}",
+                    core, core);
+    }
+    for (UBaseType_t i = 0; i < task_count; i++) {
+        resp_printf(&w, ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" PRIu32 ",\"args\":{\"name\":\"%s\"}}",
+                    (uint32_t)(uintptr_t)tasks[i].xHandle, tasks[i].pcTaskName);
+    }
 
-    free(json);
-    cJSON_Delete(root);
+    // Task switches become complete events lasting until the next switch on that core
+    tc_record_t running[portNUM_PROCESSORS] = {0};
+    bool have_running[portNUM_PROCESSORS] = {0};
+
+    for (uint32_t i = 0; i < st.recorded; i++) {
+        tc_record_t rec;
+        if (!trace_capture_read(i, &rec)) {
+            continue;
+        }
+        uint32_t tid = (uint32_t)(uintptr_t)rec.task;
+        const char *name = trace_capture_event_name(rec.event);
+
+        switch (rec.phase) {
+            case TC_PH_SWITCH:
+                if (rec.core < portNUM_PROCESSORS) {
+                    tc_record_t *prev = &running[rec.core];
+                    if (have_running[rec.core]) {
+                        resp_printf(&w, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":2,\"tid\":%d,\"ts\":%" PRIu32 ",\"dur\":%" PRIu32 "}",
+                                    capture_task_name(tasks, task_count, prev->task), rec.core,
+                                    prev->ts_us, rec.ts_us - prev->ts_us);
+                    }
+                    *prev = rec;
+                    have_running[rec.core] = true;
+                }
+                break;
+            case TC_PH_ASYNC_BEGIN:
+            case TC_PH_ASYNC_END:
+                resp_printf(&w, ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":%" PRIu32 ",\"pid\":1,\"tid\":%" PRIu32 ",\"ts\":%" PRIu32 "}",
+                            name, name, rec.phase, rec.arg, tid, rec.ts_us);
+                break;
+            default:
+                resp_printf(&w, ",{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%" PRIu32 ",\"ts\":%" PRIu32 ",\"args\":{\"arg\":%" PRIu32 "}}",
+                            name, rec.phase, tid, rec.ts_us, rec.arg);
+                break;
+        }
+    }
+
+    // Close the last running task on each core at the end of the window
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        if (have_running[core] && running[core].ts_us < st.duration_ms * 1000) {
+            resp_printf(&w, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":2,\"tid\":%d,\"ts\":%" PRIu32 ",\"dur\":%" PRIu32 "}",
+                        capture_task_name(tasks, task_count, running[core].task), core,
+                        running[core].ts_us, st.duration_ms * 1000 - running[core].ts_us);
+        }
+    }
+
+    resp_printf(&w, "],\"otherData\":{\"duration_ms\":%" PRIu32 ",\"recorded\":%" PRIu32 ",\"dropped\":%" PRIu32 "}}",
+                st.duration_ms, st.recorded, st.dropped);
+    resp_flush(&w);
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    free(tasks);
+    return ESP_OK;
+}
+
+// Server-Sent Events: each dashboard keeps one /events connection open and
+// is pushed new log lines, trace records and status changes. While clients
+// are connected a timer compares the ring counters; socket work only happens
+// when something changed and always runs in the httpd task (httpd_queue_work),
+// so the typing path is never touched.
+#define SSE_KEEPALIVE_US (15 * 1000 * 1000)
+
+typedef struct {
+    int fd;                 // -1 when the slot is free
+    uint32_t log_seq;       // Next log line to send
+    uint32_t trace_seq;     // Next trace record to send
+    uint32_t status_hash;   // Hash of the last status sent (0 = none yet)
+    int64_t last_send_us;
+} sse_client_t;
+
+// Per-client send buffer
+typedef struct {
+    int fd;
+    bool ok;
+    size_t len;
+    char buf[512];
+} sse_writer_t;
+
+static sse_client_t s_sse_clients[CONFIG_SSE_MAX_CLIENTS];
+static atomic_int s_sse_count = 0;
+static atomic_bool s_sse_work_pending = false;
+static esp_timer_handle_t s_sse_timer = NULL;
+static uint32_t s_sse_pushed_log_seq = 0;
+static uint32_t s_sse_pushed_trace_seq = 0;
+static int64_t s_sse_status_us = 0;
+
+static void sse_flush(sse_writer_t *w)
+{
+    if (w->ok && w->len > 0) {
+        w->ok = httpd_socket_send(s_server, w->fd, w->buf, w->len, 0) == w->len;
+    }
+    w->len = 0;
+}
+
+static void sse_write(sse_writer_t *w, const char *data, size_t len)
+{
+    if (w->len + len > sizeof(w->buf)) {
+        sse_flush(w);
+    }
+    if (len > sizeof(w->buf)) {
+        if (w->ok) {
+            w->ok = httpd_socket_send(s_server, w->fd, data, len, 0) == len;
+        }
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+// Append one event; data must be a single line
+static void sse_event(sse_writer_t *w, const char *event, const char *data)
+{
+    char head[24];
+    int n = snprintf(head, sizeof(head), "event: %s\ndata: ", event);
+    sse_write(w, head, n);
+    sse_write(w, data, strlen(data));
+    sse_write(w, "\n\n", 2);
+}
+
+#define FNV1A_INIT 2166136261u
+#define FNV1A_VALUE(hash, v) fnv1a((hash), &(v), sizeof(v))
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len--) {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash;
+}
+
+// Hash of the status fields that change on events. Heap, RSSI, written
+// counters and the average duty cycle move on almost every tick and are
+// left out; they ride along whenever a status goes out.
+static uint32_t status_key(void)
+{
+    wifi_manager_status_t wifi = wifi_manager_get_status();
+    ota_progress_t ota = ota_handler_get_progress();
+    uint32_t h = FNV1A_INIT;
+    h = fnv1a(h, wifi.ssid, strlen(wifi.ssid));
+    h = fnv1a(h, wifi.ip_addr, strlen(wifi.ip_addr));
+    h = FNV1A_VALUE(h, ota.status);
+    h = FNV1A_VALUE(h, ota.progress);
+
+    deferred_log_stats_t dlog;
+    deferred_log_get_stats(&dlog);
+    h = FNV1A_VALUE(h, dlog.dropped);
+
+    log_store_status_t flog;
+    log_store_get_status(&flog);
+    h = FNV1A_VALUE(h, flog.enabled);
+    h = FNV1A_VALUE(h, flog.segments_used);
+    h = FNV1A_VALUE(h, flog.head_erases);
+    h = FNV1A_VALUE(h, flog.dropped);
+
+    host_os_status_t host;
+    host_os_get_status(&host);
+    h = FNV1A_VALUE(h, host.os);
+    h = FNV1A_VALUE(h, host.guess);
+    h = FNV1A_VALUE(h, host.overridden);
+    h = FNV1A_VALUE(h, host.calibrated);
+
+    settings_stats_t cfg;
+    settings_get_stats(&cfg);
+    h = FNV1A_VALUE(h, cfg.commits);
+    h = FNV1A_VALUE(h, cfg.errors);
+    h = FNV1A_VALUE(h, cfg.pending);
+
+#if CONFIG_ENABLE_BLE
+    ble_gatt_adv_stats_t adv;
+    ble_gatt_get_adv_stats(&adv);
+    ble_gatt_state_t state = ble_gatt_get_state();
+    h = FNV1A_VALUE(h, state);
+    h = FNV1A_VALUE(h, adv.adv_phase);
+    h = FNV1A_VALUE(h, adv.adv_interval_us);
+    h = FNV1A_VALUE(h, adv.adv_duty_ppm);
+    h = FNV1A_VALUE(h, adv.uuid_in_primary);
+    h = FNV1A_VALUE(h, adv.last_discovery_ms);
+    h = FNV1A_VALUE(h, adv.connect_count);
+#endif
+    return h ? h : 1;
+}
+
+// Send everything the client has not seen yet
+static void sse_push_client(sse_client_t *c, const char *status, uint32_t status_hash, int64_t now)
+{
+    sse_writer_t w = { .fd = c->fd, .ok = true, .len = 0 };
+
+    // Log lines (copied out one at a time so the mutex is never held over a send)
+    char line[LOG_MSG_MAX_LEN];
+    for (;;) {
+        xSemaphoreTake(s_log_mutex, portMAX_DELAY);
+        uint32_t oldest = s_log_seq - s_log_count;
+        if ((int32_t)(c->log_seq - oldest) < 0) {
+            c->log_seq = oldest;    // Lines lost to wraparound
+        }
+        bool have = c->log_seq != s_log_seq;
+        if (have) {
+            memcpy(line, log_line(c->log_seq), sizeof(line));
+            c->log_seq++;
+        }
+        xSemaphoreGive(s_log_mutex);
+        if (!have) {
+            break;
+        }
+        for (char *p = line; *p; p++) {
+            if (*p == '\n' || *p == '\r') {
+                *p = ' ';
+            }
+        }
+        sse_event(&w, "log", line);
+    }
+
+    // Trace records
+    uint32_t end = atomic_load_explicit(&s_trace_seq, memory_order_acquire);
+    if ((int32_t)(end - c->trace_seq) > CONFIG_TRACE_RING_SIZE) {
+        c->trace_seq = end - CONFIG_TRACE_RING_SIZE;
+    }
+    for (; c->trace_seq != end; c->trace_seq++) {
+        trace_record_t rec;
+        if (!trace_read(c->trace_seq, &rec)) {
+            continue;
+        }
+        char msg[TRACE_MSG_LEN];
+        trace_format(&rec, msg, sizeof(msg));
+        sse_event(&w, rec.stage == TRACE_STAGE_BLE ? "ble" : "hid", msg);
+    }
+
+    // Status when it changed, and in place of a keepalive so the live
+    // numbers (heap, RSSI) stay roughly current on an idle device
+    if (status != NULL &&
+        (status_hash != c->status_hash || now - c->last_send_us > SSE_KEEPALIVE_US)) {
+        sse_event(&w, "status", status);
+        c->status_hash = status_hash;
+    }
+
+    if (w.len > 0) {
+        c->last_send_us = now;
+    } else if (now - c->last_send_us > SSE_KEEPALIVE_US) {
+        sse_write(&w, ":\n\n", 3);
+        c->last_send_us = now;
+    }
+    sse_flush(&w);
+
+    if (!w.ok) {
+        // close_fn releases the slot
+        httpd_sess_trigger_close(s_server, c->fd);
+    }
+}
+
+// Runs in the httpd task
+static void sse_push_work(void *arg)
+{
+    atomic_store(&s_sse_work_pending, false);
+
+    // Only touched from the httpd task. Worst case is about 1050 bytes:
+    // every number at its widest and a 32-byte SSID escaped to \u00XX.
+    static char status_buf[1280];
+
+    int64_t now = esp_timer_get_time();
+    const char *status = NULL;
+    uint32_t status_hash = 0;
+
+    // Uptime is left out so that an idle device does not resend its status
+    if (now - s_sse_status_us >= CONFIG_SSE_STATUS_MS * 1000LL) {
+        s_sse_status_us = now;
+        json_stream_t js;
+        json_stream_init_buffer(&js, status_buf, sizeof(status_buf));
+        json_stream_object_begin(&js, NULL);
+        status_write(&js);
+        json_stream_object_end(&js);
+        esp_err_t err = json_stream_finish(&js);
+        if (err == ESP_OK) {
+            status = status_buf;
+            status_hash = status_key();
+        } else {
+            ESP_LOGW(TAG, "Status event not sent: %s", esp_err_to_name(err));
+        }
+    }
+
+    s_sse_pushed_log_seq = s_log_seq;
+    s_sse_pushed_trace_seq = atomic_load_explicit(&s_trace_seq, memory_order_relaxed);
+
+    for (int i = 0; i < CONFIG_SSE_MAX_CLIENTS; i++) {
+        if (s_sse_clients[i].fd >= 0) {
+            sse_push_client(&s_sse_clients[i], status, status_hash, now);
+        }
+    }
+}
+
+static void sse_queue_push(void)
+{
+    if (!atomic_exchange(&s_sse_work_pending, true)) {
+        if (httpd_queue_work(s_server, sse_push_work, NULL) != ESP_OK) {
+            atomic_store(&s_sse_work_pending, false);
+        }
+    }
+}
+
+// Periodic check: only wakes the httpd task if there is something to send
+static void sse_timer_cb(void *arg)
+{
+    if (atomic_load(&s_sse_count) == 0 || s_server == NULL) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (s_log_seq != s_sse_pushed_log_seq ||
+        atomic_load_explicit(&s_trace_seq, memory_order_relaxed) != s_sse_pushed_trace_seq ||
+        now - s_sse_status_us >= CONFIG_SSE_STATUS_MS * 1000LL) {
+        sse_queue_push();
+    }
+}
+
+// Session close hook: release the event stream slot
+static void sse_close_fn(httpd_handle_t hd, int sockfd)
+{
+    for (int i = 0; i < CONFIG_SSE_MAX_CLIENTS; i++) {
+        if (s_sse_clients[i].fd == sockfd) {
+            s_sse_clients[i].fd = -1;
+            atomic_fetch_sub(&s_sse_count, 1);
+        }
+    }
+    close(sockfd);
+}
+
+// Handler for the event stream (text/event-stream, kept open)
+static esp_err_t events_handler(httpd_req_t *req)
+{
+    sse_client_t *client = NULL;
+    for (int i = 0; i < CONFIG_SSE_MAX_CLIENTS; i++) {
+        if (s_sse_clients[i].fd < 0) {
+            client = &s_sse_clients[i];
+            break;
+        }
+    }
+    if (client == NULL) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, "Too many event streams", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    // Raw response header: the body is written later with httpd_socket_send
+    static const char header[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+        "retry: 3000\n\n";
+    if (httpd_send(req, header, sizeof(header) - 1) != sizeof(header) - 1) {
+        return ESP_FAIL;
+    }
+
+    // Start with whatever the rings still hold
+    uint32_t trace_end = atomic_load_explicit(&s_trace_seq, memory_order_relaxed);
+    client->fd = httpd_req_to_sockfd(req);
+    client->log_seq = s_log_seq - CONFIG_LOG_BUFFER_SIZE;
+    client->trace_seq = trace_end - CONFIG_TRACE_RING_SIZE;
+    client->status_hash = 0;
+    client->last_send_us = esp_timer_get_time();
+    atomic_fetch_add(&s_sse_count, 1);
+
+    s_sse_status_us = 0;    // New client needs a status now
+    sse_queue_push();
+    return ESP_OK;
+}
+
+// Handler for asset pack upload (raw tools/pack_assets.py output)
+static esp_err_t assets_upload_handler(httpd_req_t *req)
+{
+    esp_err_t err = web_assets_receive(req);
+    if (err != ESP_OK) {
+        debug_server_log("Asset upload failed: %s", esp_err_to_name(err));
+        return json_stream_send_result(req, false, esp_err_to_name(err));
+    }
+    debug_server_log("Asset pack updated (%d bytes)", req->content_len);
+    return json_stream_send_result(req, true, "Asset pack updated");
+}
+
+// Handler for asset pack contents
+static esp_err_t assets_list_handler(httpd_req_t *req)
+{
+    static const char *store_names[] = {
+        [WEB_ASSETS_STORE_EMPTY] = "empty",
+        [WEB_ASSETS_STORE_VALID] = "valid",
+        [WEB_ASSETS_STORE_INVALID] = "invalid",
+        [WEB_ASSETS_STORE_STALE] = "stale",
+    };
+    int count = 0;
+    web_assets_store_t store = web_assets_get_store(&count);
+
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_string(&js, "store", store_names[store]);
+    json_stream_array_begin(&js, "files");
+    for (int i = 0; i < count; i++) {
+        web_asset_info_t info;
+        if (!web_assets_get_info(i, &info)) {
+            continue;
+        }
+        char etag[12];
+        snprintf(etag, sizeof(etag), "%08" PRIx32, info.etag);
+        json_stream_object_begin(&js, NULL);
+        json_stream_string(&js, "name", info.name);
+        json_stream_string(&js, "type", info.type);
+        json_stream_uint(&js, "size", info.size);
+        json_stream_string(&js, "etag", etag);
+        json_stream_object_end(&js);
+    }
+    json_stream_array_end(&js);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
+
+// Handler for a single UI file (/assets/<name>)
+static esp_err_t assets_file_handler(httpd_req_t *req)
+{
+    char name[32];
+    const char *start = req->uri + strlen("/assets/");
+    size_t len = strcspn(start, "?");
+    if (len == 0 || len >= sizeof(name)) {
+        httpd_resp_send_404(req);
+        return ESP_OK;
+    }
+    memcpy(name, start, len);
+    name[len] = '\0';
+
+    web_assets_send(req, name);
     return ESP_OK;
 }
 
@@ -605,18 +1870,21 @@ esp_err_t debug_server_start(void)
         s_log_mutex = xSemaphoreCreateMutex();
     }
 
-    // Initialize trace mutex
-    if (s_trace_mutex == NULL) {
-        s_trace_mutex = xSemaphoreCreateMutex();
-    }
-
     // Record boot time
     if (s_boot_time == 0) {
         s_boot_time = esp_timer_get_time();
     }
 
+    for (int i = 0; i < CONFIG_SSE_MAX_CLIENTS; i++) {
+        s_sse_clients[i].fd = -1;
+    }
+    atomic_store(&s_sse_count, 0);
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_uri_handlers = 14;
+    config.max_uri_handlers = 32;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    config.close_fn = sse_close_fn;
+    config.lru_purge_enable = true;     // Idle event streams must not lock out new clients
 
     ESP_LOGI(TAG, "Starting debug server on port %d", config.server_port);
 
@@ -632,18 +1900,50 @@ esp_err_t debug_server_start(void)
         {.uri = "/status", .method = HTTP_GET, .handler = status_handler},
         {.uri = "/logs", .method = HTTP_GET, .handler = logs_handler},
         {.uri = "/trace", .method = HTTP_GET, .handler = trace_handler},
+        {.uri = "/events", .method = HTTP_GET, .handler = events_handler},
+        {.uri = "/metrics", .method = HTTP_GET, .handler = metrics_handler},
+        {.uri = "/capture", .method = HTTP_POST, .handler = capture_start_handler},
+        {.uri = "/capture", .method = HTTP_GET, .handler = capture_status_handler},
+        {.uri = "/capture/trace.json", .method = HTTP_GET, .handler = capture_trace_handler},
         {.uri = "/ota", .method = HTTP_POST, .handler = ota_handler},
         {.uri = "/type", .method = HTTP_POST, .handler = type_handler},
+#if CONFIG_ENABLE_HID
+        {.uri = "/type/job", .method = HTTP_GET, .handler = type_job_status_handler},
+        {.uri = "/type/job", .method = HTTP_DELETE, .handler = type_job_cancel_handler},
+        {.uri = "/ws", .method = HTTP_GET, .handler = ws_ingest_handler, .is_websocket = true},
+#endif
         {.uri = "/reset-wifi", .method = HTTP_POST, .handler = reset_wifi_handler},
         {.uri = "/reboot", .method = HTTP_POST, .handler = reboot_handler},
         {.uri = "/keyboard", .method = HTTP_GET, .handler = keyboard_get_handler},
         {.uri = "/keyboard", .method = HTTP_POST, .handler = keyboard_post_handler},
+        {.uri = "/host", .method = HTTP_GET, .handler = host_get_handler},
+        {.uri = "/host", .method = HTTP_POST, .handler = host_post_handler},
+        {.uri = "/host/calibrate", .method = HTTP_POST, .handler = host_calibrate_handler},
+        {.uri = "/host/calibrate", .method = HTTP_DELETE, .handler = host_calibrate_delete_handler},
+        {.uri = "/keyboard/pack", .method = HTTP_POST, .handler = keyboard_pack_handler},
+        {.uri = "/keyboard/plan", .method = HTTP_POST, .handler = keyboard_plan_handler},
+        {.uri = "/logs/flash", .method = HTTP_GET, .handler = flash_log_handler},
+        {.uri = "/profile", .method = HTTP_GET, .handler = profile_handler},
+        {.uri = "/profile/mark", .method = HTTP_POST, .handler = profile_mark_handler},
+        {.uri = "/bench/utf8", .method = HTTP_GET, .handler = bench_utf8_handler},
+        {.uri = "/assets", .method = HTTP_POST, .handler = assets_upload_handler},
+        {.uri = "/assets", .method = HTTP_GET, .handler = assets_list_handler},
+        {.uri = "/assets/*", .method = HTTP_GET, .handler = assets_file_handler},
     };
 
     for (int i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
         httpd_register_uri_handler(s_server, &handlers[i]);
     }
 
+    if (s_sse_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = sse_timer_cb,
+            .name = "sse",
+        };
+        esp_timer_create(&timer_args, &s_sse_timer);
+    }
+    esp_timer_start_periodic(s_sse_timer, CONFIG_SSE_PUSH_MS * 1000);
+
     debug_server_log("Debug server started");
     ESP_LOGI(TAG, "Debug server started");
     return ESP_OK;
@@ -655,6 +1955,10 @@ esp_err_t debug_server_stop(void)
         return ESP_OK;
     }
 
+    if (s_sse_timer != NULL) {
+        esp_timer_stop(s_sse_timer);
+    }
+
     esp_err_t ret = httpd_stop(s_server);
     s_server = NULL;
     ESP_LOGI(TAG, "Debug server stopped");
@@ -2,8 +2,17 @@
 #define DEBUG_SERVER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
 
+/**
+ * Trace pipeline stage
+ */
+typedef enum {
+    TRACE_STAGE_BLE,    // Command received from BLE
+    TRACE_STAGE_HID,    // Keystroke sent to the PC
+} trace_stage_t;
+
 /**
  * Start the debug web server
  * Serves debug dashboard when connected to WiFi in STA mode
@@ -26,13 +35,15 @@ bool debug_server_is_running(void);
 void debug_server_log(const char *format, ...);
 
 /**
- * Add a BLE trace message (what was received from BLE)
- */
-void debug_server_trace_ble(const char *format, ...);
-
-/**
- * Add a HID trace message (what was sent to the PC)
+ * Add a binary trace record (lock-free, safe from any task)
+ * Text is only rendered when /trace is requested.
+ * @param stage Pipeline stage
+ * @param opcode Command the record belongs to (CMD_BACKSPACE, CMD_INSERT, ...)
+ * @param keycode HID keycode (HID stage) or 0
+ * @param modifiers HID modifiers (HID stage) or 0
+ * @param arg Stage/opcode specific: count, text length, character or key
  */
-void debug_server_trace_hid(const char *format, ...);
+void debug_server_trace(trace_stage_t stage, uint8_t opcode, uint8_t keycode,
+                        uint8_t modifiers, uint16_t arg);
 
 #endif // DEBUG_SERVER_H
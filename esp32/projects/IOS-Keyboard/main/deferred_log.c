@@ -0,0 +1,174 @@
+#include "deferred_log.h"
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "dlog";
+
+#if (CONFIG_DLOG_RING_SIZE & (CONFIG_DLOG_RING_SIZE - 1)) != 0
+#error "CONFIG_DLOG_RING_SIZE must be a power of two"
+#endif
+#define RING_MASK (CONFIG_DLOG_RING_SIZE - 1)
+
+// Format table: level, tag, printf format for each dlog_fmt_t
+typedef struct {
+    esp_log_level_t level;
+    const char *tag;
+    const char *fmt;
+} dlog_format_t;
+
+static const dlog_format_t s_formats[DLOG_FMT_COUNT] = {
+    [DLOG_BLE_RX]               = { ESP_LOG_INFO, "ble_gatt", "RX: %" PRIu32 " bytes [%02" PRIx32 " %02" PRIx32 " %02" PRIx32 "...]" },
+    [DLOG_BLE_RX_EMPTY]         = { ESP_LOG_WARN, "ble_gatt", "RX: empty write received" },
+    [DLOG_BLE_RX_NO_CALLBACK]   = { ESP_LOG_WARN, "ble_gatt", "No RX callback registered!" },
+    [DLOG_BLE_GAP_CONNECT]      = { ESP_LOG_INFO, "ble_gatt", "GAP connect: status=%" PRId32 " handle=%" PRIu32 " discovery=%" PRIu32 " ms" },
+    [DLOG_BLE_GAP_DISCONNECT]   = { ESP_LOG_INFO, "ble_gatt", "GAP disconnect: reason=%" PRIu32 },
+    [DLOG_BLE_GAP_ADV_COMPLETE] = { ESP_LOG_INFO, "ble_gatt", "GAP adv complete: reason=%" PRIu32 " next phase=%" PRIu32 },
+    [DLOG_BLE_GAP_MTU]          = { ESP_LOG_INFO, "ble_gatt", "GAP MTU: %" PRIu32 },
+    [DLOG_BLE_GAP_SUBSCRIBE]    = { ESP_LOG_INFO, "ble_gatt", "GAP subscribe: attr_handle=%" PRIu32 " notify=%" PRIu32 " indicate=%" PRIu32 },
+    [DLOG_BLE_GAP_NOTIFY_TX]    = { ESP_LOG_DEBUG, "ble_gatt", "GAP notify tx: status=%" PRIu32 },
+    [DLOG_BLE_GAP_OTHER]        = { ESP_LOG_DEBUG, "ble_gatt", "Unhandled GAP event: %" PRIu32 },
+    [DLOG_BLE_ADV_START]        = { ESP_LOG_INFO, "ble_gatt", "Advertising phase %" PRIu32 ": interval %" PRIu32 " us" },
+    [DLOG_CMD_BACKSPACE]        = { ESP_LOG_INFO, "cmd_parser", "Backspace x%" PRIu32 },
+    [DLOG_CMD_INSERT]           = { ESP_LOG_INFO, "cmd_parser", "Insert: %" PRIu32 " bytes" },
+    [DLOG_CMD_ENTER]            = { ESP_LOG_INFO, "cmd_parser", "Enter" },
+    [DLOG_CMD_CTRL_KEY]         = { ESP_LOG_INFO, "cmd_parser", "Ctrl+%c" },
+    [DLOG_CMD_LAYOUT]           = { ESP_LOG_INFO, "cmd_parser", "Layout %" PRIu32 " selected" },
+    [DLOG_CMD_SHORTCUT]         = { ESP_LOG_INFO, "cmd_parser", "Shortcut %" PRIu32 },
+    [DLOG_HID_TYPED]            = { ESP_LOG_INFO, "usb_hid", "Typed %" PRIu32 " characters (%" PRIu32 " bytes)" },
+    [DLOG_LAYOUT_UNMAPPED]      = { ESP_LOG_WARN, "kbd_layout", "No keycode for char U+%04" PRIX32 },
+};
+
+// Ring slot. seq implements a bounded MPSC queue (Vyukov): a slot is free
+// for position p when seq == p, and holds data for position p when seq == p + 1.
+typedef struct {
+    atomic_uint_fast32_t seq;
+    uint32_t timestamp_ms;
+    uint32_t fmt;
+    uint32_t args[4];
+} dlog_slot_t;
+
+static dlog_slot_t s_ring[CONFIG_DLOG_RING_SIZE];
+static atomic_uint_fast32_t s_head = 0;     // Next position to reserve (producers)
+static uint32_t s_tail = 0;                 // Next position to drain (consumer only)
+static atomic_uint_fast32_t s_written = 0;
+static atomic_uint_fast32_t s_dropped = 0;
+static bool s_initialized = false;
+static TaskHandle_t s_drain_task = NULL;
+
+void deferred_log_write(dlog_fmt_t fmt, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    if (!s_initialized || fmt >= DLOG_FMT_COUNT) {
+        return;
+    }
+
+    // Reserve a slot
+    uint_fast32_t pos = atomic_load_explicit(&s_head, memory_order_relaxed);
+    dlog_slot_t *slot;
+    for (;;) {
+        slot = &s_ring[pos & RING_MASK];
+        uint_fast32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&s_head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Ring full - never block the caller
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&s_head, memory_order_relaxed);
+        }
+    }
+
+    slot->timestamp_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    slot->fmt = fmt;
+    slot->args[0] = a0;
+    slot->args[1] = a1;
+    slot->args[2] = a2;
+    slot->args[3] = a3;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    atomic_fetch_add_explicit(&s_written, 1, memory_order_relaxed);
+}
+
+// Format and print one record
+static void drain_one(const dlog_slot_t *slot)
+{
+    const dlog_format_t *f = &s_formats[slot->fmt];
+    if (f->level > CONFIG_LOG_MAXIMUM_LEVEL) {
+        return;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), f->fmt, slot->args[0], slot->args[1], slot->args[2], slot->args[3]);
+
+    static const char level_char[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    esp_log_write(f->level, f->tag, "%c (%" PRIu32 ") %s: %s\n",
+                  level_char[f->level], slot->timestamp_ms, f->tag, msg);
+}
+
+// Low-priority task: drain the ring to the console
+static void drain_task(void *param)
+{
+    uint32_t reported_drops = 0;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_DLOG_FLUSH_MS));
+
+        for (;;) {
+            dlog_slot_t *slot = &s_ring[s_tail & RING_MASK];
+            uint_fast32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            if ((int32_t)(seq - (s_tail + 1)) < 0) {
+                break;  // Empty (or producer still filling this slot)
+            }
+
+            drain_one(slot);
+            atomic_store_explicit(&slot->seq, s_tail + CONFIG_DLOG_RING_SIZE, memory_order_release);
+            s_tail++;
+        }
+
+        uint32_t drops = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+        if (drops != reported_drops) {
+            ESP_LOGW(TAG, "%" PRIu32 " log records dropped (ring full)", drops - reported_drops);
+            reported_drops = drops;
+        }
+    }
+}
+
+esp_err_t deferred_log_init(void)
+{
+    if (s_initialized) {
+        return ESP_OK;
+    }
+
+    for (uint32_t i = 0; i < CONFIG_DLOG_RING_SIZE; i++) {
+        atomic_init(&s_ring[i].seq, i);
+    }
+
+    BaseType_t ret = xTaskCreate(drain_task, "dlog", 3072, NULL, tskIDLE_PRIORITY + 1, &s_drain_task);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create drain task");
+        return ESP_FAIL;
+    }
+
+    s_initialized = true;
+    ESP_LOGI(TAG, "Deferred log initialized (%d records)", CONFIG_DLOG_RING_SIZE);
+    return ESP_OK;
+}
+
+void deferred_log_get_stats(deferred_log_stats_t *stats)
+{
+    stats->written = atomic_load_explicit(&s_written, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+    stats->pending = atomic_load_explicit(&s_head, memory_order_relaxed) - s_tail;
+}
@@ -0,0 +1,68 @@
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+#include "esp_err.h"
+#include <stdint.h>
+
+/**
+ * Format IDs for deferred log records
+ * Each ID maps to a level, tag and printf format in deferred_log.c.
+ * Arguments are stored raw (up to 4 x uint32_t) - no strings.
+ */
+typedef enum {
+    // ble_gatt
+    DLOG_BLE_RX,                // len, byte0, byte1, byte2
+    DLOG_BLE_RX_EMPTY,
+    DLOG_BLE_RX_NO_CALLBACK,
+    DLOG_BLE_GAP_CONNECT,       // status (signed, int32_t), conn_handle, discovery_ms
+    DLOG_BLE_GAP_DISCONNECT,    // reason
+    DLOG_BLE_GAP_ADV_COMPLETE,  // reason, next phase
+    DLOG_BLE_GAP_MTU,           // mtu
+    DLOG_BLE_GAP_SUBSCRIBE,     // attr_handle, notify, indicate
+    DLOG_BLE_GAP_NOTIFY_TX,     // status
+    DLOG_BLE_GAP_OTHER,         // event type
+    DLOG_BLE_ADV_START,         // phase, interval (us)
+    // command_parser
+    DLOG_CMD_BACKSPACE,         // count
+    DLOG_CMD_INSERT,            // text length (bytes)
+    DLOG_CMD_ENTER,
+    DLOG_CMD_CTRL_KEY,          // key
+    DLOG_CMD_LAYOUT,            // layout index
+    DLOG_CMD_SHORTCUT,          // shortcut id
+    // usb_hid / keyboard_layout
+    DLOG_HID_TYPED,             // characters typed, text length (bytes)
+    DLOG_LAYOUT_UNMAPPED,       // codepoint
+    DLOG_FMT_COUNT
+} dlog_fmt_t;
+
+/**
+ * Deferred log statistics
+ */
+typedef struct {
+    uint32_t written;   // Records accepted into the ring
+    uint32_t dropped;   // Records dropped because the ring was full
+    uint32_t pending;   // Records waiting to be drained
+} deferred_log_stats_t;
+
+/**
+ * Initialize the ring and start the low-priority drain task
+ */
+esp_err_t deferred_log_init(void);
+
+/**
+ * Append a log record (lock-free, safe from any task)
+ * Never blocks; drops the record and counts it if the ring is full.
+ */
+void deferred_log_write(dlog_fmt_t fmt, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+/**
+ * Get deferred log statistics
+ */
+void deferred_log_get_stats(deferred_log_stats_t *stats);
+
+// DLOG(id, args...) - up to 4 integer arguments, missing ones are zero
+#define DLOG(...) DLOG_(__VA_ARGS__, 0, 0, 0, 0, 0)
+#define DLOG_(id, a0, a1, a2, a3, ...) \
+    deferred_log_write((id), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2), (uint32_t)(a3))
+
+#endif // DEFERRED_LOG_H
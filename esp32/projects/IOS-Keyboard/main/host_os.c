@@ -0,0 +1,304 @@
+#include "host_os.h"
+#include "config.h"
+#include "keyboard_layout.h"
+#include "settings.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "class/hid/hid.h"
+
+static const char *TAG = "host_os";
+
+static const char *const s_names[HOST_OS_COUNT] = {
+    [HOST_OS_UNKNOWN] = "unknown",
+    [HOST_OS_WINDOWS] = "windows",
+    [HOST_OS_MACOS]   = "macos",
+    [HOST_OS_LINUX]   = "linux",
+    [HOST_OS_BOOT]    = "boot",
+};
+
+// Typing speed per host until calibrated. Press and release are each at
+// least 20 ms (two ticks at 100 Hz, so a full 10 ms polling interval
+// passes before the next report); only calibration goes faster. Unknown
+// and boot hosts keep the global delay with its original tick timing.
+static const host_speed_t s_speeds[HOST_OS_COUNT] = {
+    [HOST_OS_UNKNOWN] = { CONFIG_TYPING_DELAY_MS, CONFIG_TYPING_DELAY_MS / 2 },
+    [HOST_OS_WINDOWS] = { 20, 20 },
+    [HOST_OS_MACOS]   = { 30, 20 },
+    [HOST_OS_LINUX]   = { 20, 20 },
+    [HOST_OS_BOOT]    = { CONFIG_TYPING_DELAY_MS, CONFIG_TYPING_DELAY_MS / 2 },
+};
+
+// Calibrated speeds (press_ms 0: none), per host OS
+static host_speed_t s_calibrated[HOST_OS_COUNT];
+
+// Shortcut: a letter (found through the current layout, so Ctrl+Z stays
+// on Z with QWERTZ) or a fixed keycode
+typedef struct {
+    char letter;
+    uint8_t keycode;
+    uint8_t modifiers;
+} shortcut_def_t;
+
+#define CTRL    KEYBOARD_MODIFIER_LEFTCTRL
+#define ALT     KEYBOARD_MODIFIER_LEFTALT
+#define GUI     KEYBOARD_MODIFIER_LEFTGUI
+
+static const shortcut_def_t s_pc_shortcuts[HOST_SHORTCUT_COUNT] = {
+    [HOST_SHORTCUT_DELETE_WORD] = { 0,   HID_KEY_BACKSPACE, CTRL },
+    [HOST_SHORTCUT_SELECT_ALL]  = { 'a', 0,                 CTRL },
+    [HOST_SHORTCUT_UNDO]        = { 'z', 0,                 CTRL },
+    [HOST_SHORTCUT_LINE_START]  = { 0,   HID_KEY_HOME,      0 },
+    [HOST_SHORTCUT_LINE_END]    = { 0,   HID_KEY_END,       0 },
+};
+
+static const shortcut_def_t s_mac_shortcuts[HOST_SHORTCUT_COUNT] = {
+    [HOST_SHORTCUT_DELETE_WORD] = { 0,   HID_KEY_BACKSPACE,   ALT },
+    [HOST_SHORTCUT_SELECT_ALL]  = { 'a', 0,                   GUI },
+    [HOST_SHORTCUT_UNDO]        = { 'z', 0,                   GUI },
+    [HOST_SHORTCUT_LINE_START]  = { 0,   HID_KEY_ARROW_LEFT,  GUI },
+    [HOST_SHORTCUT_LINE_END]    = { 0,   HID_KEY_ARROW_RIGHT, GUI },
+};
+
+// Evidence and result; written from the TinyUSB task and the detect timer
+static host_os_status_t s_status = { .protocol = -1, .first_led_ms = -1 };
+static int64_t s_mount_us = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_detect_timer = NULL;
+
+// Match the enumeration sequence against known host stacks (s_lock held)
+static host_os_t classify(const host_os_status_t *st)
+{
+    if (st->protocol == 0) {
+        return HOST_OS_BOOT;        // Only boot-protocol hosts switch to it
+    }
+    if (st->set_idle) {
+        // Linux usbhid sends SET_IDLE before reading the report descriptor,
+        // Windows after
+        return st->idle_before_desc ? HOST_OS_LINUX : HOST_OS_WINDOWS;
+    }
+    if (st->report_desc_requests > 0) {
+        return HOST_OS_MACOS;       // Reads the descriptor, never sets idle
+    }
+    return HOST_OS_UNKNOWN;
+}
+
+static void detect_timer_cb(void *arg)
+{
+    taskENTER_CRITICAL(&s_lock);
+    s_status.guess = classify(&s_status);
+    s_status.settled = true;
+    if (!s_status.overridden) {
+        s_status.os = s_status.guess;
+    }
+    host_os_status_t st = s_status;
+    taskEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Host looks like %s (desc %u, idle %s, protocol %d, leds %u); using %s",
+             s_names[st.guess], st.report_desc_requests,
+             st.set_idle ? (st.idle_before_desc ? "first" : "after") : "none",
+             st.protocol, st.led_reports, s_names[st.os]);
+}
+
+esp_err_t host_os_init(void)
+{
+    uint32_t saved = 0;
+    if (settings_get_u32(SETTING_HOST_OS, &saved) == ESP_OK &&
+        saved > HOST_OS_UNKNOWN && saved < HOST_OS_COUNT) {
+        s_status.os = (host_os_t)saved;
+        s_status.overridden = true;
+        ESP_LOGI(TAG, "Host OS override: %s", s_names[saved]);
+    }
+
+    for (int i = 0; i < HOST_OS_COUNT; i++) {
+        uint32_t packed = 0;
+        if (settings_get_u32(SETTING_SPEED_UNKNOWN + i, &packed) == ESP_OK && (packed & 0xFFFF) != 0) {
+            s_calibrated[i].press_ms = packed & 0xFFFF;
+            s_calibrated[i].release_ms = packed >> 16;
+        }
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = detect_timer_cb,
+        .name = "host_os",
+    };
+    return esp_timer_create(&timer_args, &s_detect_timer);
+}
+
+void host_os_on_mount(void)
+{
+    taskENTER_CRITICAL(&s_lock);
+    host_os_t os = s_status.os;
+    bool overridden = s_status.overridden;
+    memset(&s_status, 0, sizeof(s_status));
+    s_status.protocol = -1;
+    s_status.first_led_ms = -1;
+    s_status.overridden = overridden;
+    s_status.os = overridden ? os : HOST_OS_UNKNOWN;
+    s_mount_us = esp_timer_get_time();
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (s_detect_timer != NULL) {
+        esp_timer_stop(s_detect_timer);
+        esp_timer_start_once(s_detect_timer, CONFIG_HOST_OS_DETECT_MS * 1000);
+    }
+}
+
+void host_os_on_unmount(void)
+{
+    if (s_detect_timer != NULL) {
+        esp_timer_stop(s_detect_timer);
+    }
+}
+
+void host_os_on_report_descriptor(void)
+{
+    taskENTER_CRITICAL(&s_lock);
+    if (s_status.report_desc_requests < UINT8_MAX) {
+        s_status.report_desc_requests++;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+void host_os_on_set_idle(uint8_t idle_rate)
+{
+    taskENTER_CRITICAL(&s_lock);
+    if (!s_status.set_idle) {
+        s_status.set_idle = true;
+        s_status.idle_before_desc = s_status.report_desc_requests == 0;
+    }
+    s_status.idle_rate = idle_rate;
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+void host_os_on_set_protocol(uint8_t protocol)
+{
+    taskENTER_CRITICAL(&s_lock);
+    s_status.protocol = (int8_t)protocol;
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+void host_os_on_led_report(uint8_t leds)
+{
+    (void)leds;
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&s_lock);
+    if (s_status.led_reports < UINT8_MAX) {
+        s_status.led_reports++;
+    }
+    if (s_status.first_led_ms < 0) {
+        s_status.first_led_ms = (int32_t)((now - s_mount_us) / 1000);
+    }
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+host_os_t host_os_get(void)
+{
+    taskENTER_CRITICAL(&s_lock);
+    host_os_t os = s_status.os;
+    taskEXIT_CRITICAL(&s_lock);
+    return os;
+}
+
+void host_os_get_status(host_os_status_t *status)
+{
+    taskENTER_CRITICAL(&s_lock);
+    *status = s_status;
+    status->calibrated = s_calibrated[s_status.os].press_ms != 0;
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+esp_err_t host_os_set_override(host_os_t os)
+{
+    if (os >= HOST_OS_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&s_lock);
+    s_status.overridden = os != HOST_OS_UNKNOWN;
+    s_status.os = s_status.overridden ? os : s_status.guess;
+    taskEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Host OS %s", os == HOST_OS_UNKNOWN ? "detected again" : s_names[os]);
+    return os == HOST_OS_UNKNOWN ? settings_erase(SETTING_HOST_OS)
+                                 : settings_set_u32(SETTING_HOST_OS, os);
+}
+
+host_speed_t host_os_get_speed(void)
+{
+    taskENTER_CRITICAL(&s_lock);
+    host_os_t os = s_status.os;
+    host_speed_t speed = s_calibrated[os].press_ms != 0 ? s_calibrated[os] : s_speeds[os];
+    taskEXIT_CRITICAL(&s_lock);
+    return speed;
+}
+
+esp_err_t host_os_set_speed(host_os_t os, const host_speed_t *speed)
+{
+    if (os >= HOST_OS_COUNT || (speed != NULL && speed->press_ms == 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&s_lock);
+    if (speed != NULL) {
+        s_calibrated[os] = *speed;
+    } else {
+        memset(&s_calibrated[os], 0, sizeof(s_calibrated[os]));
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    setting_id_t id = (setting_id_t)(SETTING_SPEED_UNKNOWN + os);
+    if (speed == NULL) {
+        ESP_LOGI(TAG, "%s: built-in speed", s_names[os]);
+        return settings_erase(id);
+    }
+    ESP_LOGI(TAG, "%s: calibrated speed %u/%u ms", s_names[os], speed->press_ms, speed->release_ms);
+    return settings_set_u32(id, speed->press_ms | ((uint32_t)speed->release_ms << 16));
+}
+
+esp_err_t host_os_get_shortcut(host_shortcut_t shortcut, host_key_t *key)
+{
+    if (shortcut >= HOST_SHORTCUT_COUNT || key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const shortcut_def_t *def = host_os_get() == HOST_OS_MACOS ? &s_mac_shortcuts[shortcut]
+                                                                : &s_pc_shortcuts[shortcut];
+    key->keycode = def->keycode;
+    key->modifiers = def->modifiers;
+    if (def->letter != 0) {
+        uint16_t kc = keyboard_layout_char_to_keycode((uint8_t)def->letter);
+        key->keycode = kc & 0xFF;
+        key->modifiers |= kc >> 8;
+        if (key->keycode == 0) {
+            key->keycode = HID_KEY_A + (def->letter - 'a');     // Not in layout: US position
+        }
+    }
+    return ESP_OK;
+}
+
+const char *host_os_name(host_os_t os)
+{
+    return os < HOST_OS_COUNT ? s_names[os] : "?";
+}
+
+esp_err_t host_os_from_name(const char *name, host_os_t *os)
+{
+    if (name == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strcmp(name, "auto") == 0) {
+        *os = HOST_OS_UNKNOWN;
+        return ESP_OK;
+    }
+    for (int i = 0; i < HOST_OS_COUNT; i++) {
+        if (strcmp(name, s_names[i]) == 0) {
+            *os = (host_os_t)i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
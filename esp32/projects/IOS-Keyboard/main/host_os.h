@@ -0,0 +1,132 @@
+#ifndef HOST_OS_H
+#define HOST_OS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * USB host OS detection
+ *
+ * The TinyUSB callbacks report what the host does after SET_CONFIGURATION
+ * (report descriptor fetch, SET_IDLE, SET_PROTOCOL, LED output reports).
+ * CONFIG_HOST_OS_DETECT_MS after mount the sequence is matched against
+ * known host stacks; the result picks the typing speed profile and the
+ * shortcut set. It is a guess: a saved override always wins.
+ */
+
+typedef enum {
+    HOST_OS_UNKNOWN,
+    HOST_OS_WINDOWS,
+    HOST_OS_MACOS,
+    HOST_OS_LINUX,
+    HOST_OS_BOOT,       // BIOS/UEFI or KVM switch (boot protocol)
+    HOST_OS_COUNT
+} host_os_t;
+
+/**
+ * Editing shortcuts that differ between hosts
+ */
+typedef enum {
+    HOST_SHORTCUT_DELETE_WORD,  // Delete the word before the cursor
+    HOST_SHORTCUT_SELECT_ALL,
+    HOST_SHORTCUT_UNDO,
+    HOST_SHORTCUT_LINE_START,
+    HOST_SHORTCUT_LINE_END,
+    HOST_SHORTCUT_COUNT
+} host_shortcut_t;
+
+/**
+ * Key combination for a shortcut
+ */
+typedef struct {
+    uint8_t keycode;
+    uint8_t modifiers;
+} host_key_t;
+
+/**
+ * Keystroke timing for a host
+ */
+typedef struct {
+    uint16_t press_ms;      // Key held down
+    uint16_t release_ms;    // Pause after the release report
+} host_speed_t;
+
+/**
+ * Detection state and the evidence it was based on
+ */
+typedef struct {
+    host_os_t os;           // In use: override, else guess
+    host_os_t guess;        // From enumeration
+    bool overridden;
+    bool settled;           // Detection window over
+    bool calibrated;        // Speed for os measured (usb_hid_calibrate)
+    uint8_t report_desc_requests;
+    bool set_idle;          // SET_IDLE received
+    bool idle_before_desc;  // ... before the first report descriptor request
+    uint8_t idle_rate;      // 4 ms units
+    int8_t protocol;        // Last SET_PROTOCOL (0 boot, 1 report), -1 none
+    uint8_t led_reports;
+    int32_t first_led_ms;   // After mount, -1 none
+} host_os_status_t;
+
+/**
+ * Load the saved override (settings_init must run first)
+ */
+esp_err_t host_os_init(void);
+
+/**
+ * Enumeration events (called from the TinyUSB callbacks)
+ */
+void host_os_on_mount(void);
+void host_os_on_unmount(void);
+void host_os_on_report_descriptor(void);
+void host_os_on_set_idle(uint8_t idle_rate);
+void host_os_on_set_protocol(uint8_t protocol);
+void host_os_on_led_report(uint8_t leds);
+
+/**
+ * Get the host OS in use (override, else guess)
+ */
+host_os_t host_os_get(void);
+
+/**
+ * Get detection state
+ */
+void host_os_get_status(host_os_status_t *status);
+
+/**
+ * Force a host OS and save it; HOST_OS_UNKNOWN returns to detection
+ */
+esp_err_t host_os_set_override(host_os_t os);
+
+/**
+ * Typing speed for the host in use: calibrated if measured, else the
+ * built-in profile for its OS
+ */
+host_speed_t host_os_get_speed(void);
+
+/**
+ * Save a calibrated speed for a host OS; NULL returns to the built-in
+ * profile
+ */
+esp_err_t host_os_set_speed(host_os_t os, const host_speed_t *speed);
+
+/**
+ * Key combination for a shortcut on the host in use
+ * @return ESP_ERR_INVALID_ARG for an unknown shortcut
+ */
+esp_err_t host_os_get_shortcut(host_shortcut_t shortcut, host_key_t *key);
+
+/**
+ * Name for a host OS ("windows", "macos", ...)
+ */
+const char *host_os_name(host_os_t os);
+
+/**
+ * Parse a name from host_os_name ("auto" gives HOST_OS_UNKNOWN)
+ * @return ESP_ERR_NOT_FOUND if not a known name
+ */
+esp_err_t host_os_from_name(const char *name, host_os_t *os);
+
+#endif // HOST_OS_H
@@ -0,0 +1,221 @@
+#include "ingest.h"
+#include "config.h"
+#include "command_parser.h"
+#include "metrics.h"
+
+#include <string.h>
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "ingest";
+
+// One queued command packet
+typedef struct {
+    int64_t received_us;
+    ingest_done_cb_t done;
+    void *ctx;
+    uint64_t cookie;
+    uint16_t len;
+    uint8_t data[CONFIG_INGEST_MAX_CMD];
+} ingest_cmd_t;
+
+typedef struct {
+    const char *name;
+    uint32_t rate;          // Commands per second (0 = unlimited)
+    QueueHandle_t queue;
+    int64_t tat_us;         // Rate limiter: theoretical arrival time (GCRA)
+    bool throttling;        // Head command is waiting for the rate limit
+    ingest_stats_t stats;
+} ingest_source_state_t;
+
+static ingest_source_state_t s_sources[INGEST_SRC_COUNT] = {
+    [INGEST_SRC_BLE]  = { .name = "ble",  .rate = CONFIG_INGEST_RATE_BLE },
+    [INGEST_SRC_HTTP] = { .name = "http", .rate = CONFIG_INGEST_RATE_HTTP },
+    [INGEST_SRC_WS]   = { .name = "ws",   .rate = CONFIG_INGEST_RATE_WS },
+};
+
+static TaskHandle_t s_engine = NULL;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define STAT_INC(src, field) do {               \
+        portENTER_CRITICAL(&s_lock);            \
+        s_sources[src].stats.field++;           \
+        portEXIT_CRITICAL(&s_lock);             \
+    } while (0)
+
+// Microseconds until the source may run its next command (0 = now)
+static int64_t rate_wait_us(ingest_source_state_t *s, int64_t now)
+{
+    if (s->rate == 0) {
+        return 0;
+    }
+    int64_t burst_us = (int64_t)CONFIG_INGEST_BURST * 1000000 / s->rate;
+    int64_t allowed_at = s->tat_us - burst_us;
+    return allowed_at > now ? allowed_at - now : 0;
+}
+
+static void rate_take(ingest_source_state_t *s, int64_t now)
+{
+    if (s->rate != 0) {
+        s->tat_us = (s->tat_us > now ? s->tat_us : now) + 1000000 / s->rate;
+    }
+}
+
+static void run(ingest_source_t src, const ingest_cmd_t *cmd)
+{
+    metrics_cmd_received(cmd->received_us);
+    esp_err_t ret = command_parser_execute(cmd->data, cmd->len);
+    if (ret == ESP_OK) {
+        STAT_INC(src, executed);
+    } else {
+        STAT_INC(src, errors);
+    }
+    if (cmd->done != NULL) {
+        cmd->done(ret, cmd->data, cmd->len, cmd->ctx, cmd->cookie);
+    }
+}
+
+// Round-robin over sources, one whole command per turn
+static void engine_task(void *arg)
+{
+    static ingest_cmd_t cmd;
+    int next = 0;
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        bool ran = false;
+        int64_t now = esp_timer_get_time();
+
+        for (int n = 0; n < INGEST_SRC_COUNT && !ran; n++) {
+            ingest_source_t src = (next + n) % INGEST_SRC_COUNT;
+            ingest_source_state_t *s = &s_sources[src];
+            if (uxQueueMessagesWaiting(s->queue) == 0) {
+                continue;
+            }
+
+            int64_t hold_us = rate_wait_us(s, now);
+            if (hold_us > 0) {
+                s->throttling = true;
+                TickType_t ticks = pdMS_TO_TICKS(hold_us / 1000) + 1;
+                if (ticks < wait) {
+                    wait = ticks;
+                }
+                continue;
+            }
+
+            if (xQueueReceive(s->queue, &cmd, 0) != pdTRUE) {
+                continue;   // Flushed meanwhile
+            }
+            if (s->throttling) {
+                s->throttling = false;
+                STAT_INC(src, throttled);
+            }
+            rate_take(s, now);
+            run(src, &cmd);
+            next = (src + 1) % INGEST_SRC_COUNT;
+            ran = true;
+        }
+
+        if (!ran) {
+            ulTaskNotifyTake(pdTRUE, wait);
+        }
+    }
+}
+
+esp_err_t ingest_init(void)
+{
+    if (s_engine != NULL) {
+        return ESP_OK;
+    }
+
+    for (int i = 0; i < INGEST_SRC_COUNT; i++) {
+        s_sources[i].queue = xQueueCreate(CONFIG_INGEST_QUEUE_LEN, sizeof(ingest_cmd_t));
+        if (s_sources[i].queue == NULL) {
+            ESP_LOGE(TAG, "Failed to create %s queue", s_sources[i].name);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (xTaskCreate(engine_task, "ingest", 4096, NULL, 5, &s_engine) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create engine task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Ingest bus ready (%d sources, queue %d)", INGEST_SRC_COUNT, CONFIG_INGEST_QUEUE_LEN);
+    return ESP_OK;
+}
+
+esp_err_t ingest_submit(ingest_source_t src, const uint8_t *data, size_t len, TickType_t wait,
+                        ingest_done_cb_t done, void *ctx, uint64_t cookie)
+{
+    if (src >= INGEST_SRC_COUNT || data == NULL || len == 0 || len > CONFIG_INGEST_MAX_CMD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (s_engine == NULL) {
+        STAT_INC(src, dropped);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ingest_cmd_t cmd = {
+        .received_us = esp_timer_get_time(),
+        .done = done,
+        .ctx = ctx,
+        .cookie = cookie,
+        .len = len,
+    };
+    memcpy(cmd.data, data, len);
+
+    if (xQueueSend(s_sources[src].queue, &cmd, wait) != pdTRUE) {
+        STAT_INC(src, dropped);
+        metrics_inc(METRIC_DROPS, 1);
+        return ESP_ERR_TIMEOUT;
+    }
+    STAT_INC(src, submitted);
+    xTaskNotifyGive(s_engine);
+    return ESP_OK;
+}
+
+void ingest_flush(ingest_source_t src, ingest_done_cb_t done)
+{
+    if (src >= INGEST_SRC_COUNT || s_sources[src].queue == NULL) {
+        return;
+    }
+
+    // One pass over what is queued now; commands that stay go back to the
+    // tail in their original order
+    ingest_cmd_t cmd;
+    UBaseType_t count = uxQueueMessagesWaiting(s_sources[src].queue);
+    while (count-- > 0 && xQueueReceive(s_sources[src].queue, &cmd, 0) == pdTRUE) {
+        if (done != NULL && cmd.done != done &&
+            xQueueSendToBack(s_sources[src].queue, &cmd, 0) == pdTRUE) {
+            continue;
+        }
+        STAT_INC(src, dropped);
+        if (cmd.done != NULL) {
+            cmd.done(ESP_ERR_NOT_FINISHED, cmd.data, cmd.len, cmd.ctx, cmd.cookie);
+        }
+    }
+}
+
+uint32_t ingest_pending(ingest_source_t src)
+{
+    if (src >= INGEST_SRC_COUNT || s_sources[src].queue == NULL) {
+        return 0;
+    }
+    return uxQueueMessagesWaiting(s_sources[src].queue);
+}
+
+void ingest_get_stats(ingest_source_t src, ingest_stats_t *out)
+{
+    portENTER_CRITICAL(&s_lock);
+    *out = s_sources[src].stats;
+    portEXIT_CRITICAL(&s_lock);
+    out->queued = ingest_pending(src);
+}
+
+const char *ingest_source_name(ingest_source_t src)
+{
+    return src < INGEST_SRC_COUNT ? s_sources[src].name : "unknown";
+}
@@ -0,0 +1,86 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Command sources feeding the HID engine
+ */
+typedef enum {
+    INGEST_SRC_BLE,         // NUS RX characteristic
+    INGEST_SRC_HTTP,        // /type and typing jobs
+    INGEST_SRC_WS,          // /ws WebSocket ingest
+    INGEST_SRC_COUNT
+} ingest_source_t;
+
+/**
+ * Per-source counters
+ */
+typedef struct {
+    uint32_t submitted;     // Accepted into the queue
+    uint32_t executed;      // Ran successfully
+    uint32_t errors;        // Parser or HID error
+    uint32_t dropped;       // Queue full, or flushed before running
+    uint32_t throttled;     // Held back by the source rate limit
+    uint32_t queued;        // Waiting right now
+} ingest_stats_t;
+
+/**
+ * Called once a command has run (on the engine task), or was flushed
+ * @param result Outcome of command_parser_execute, ESP_ERR_NOT_FINISHED if flushed
+ * @param data Command packet
+ * @param ctx, cookie Values passed to ingest_submit
+ */
+typedef void (*ingest_done_cb_t)(esp_err_t result, const uint8_t *data, size_t len,
+                                 void *ctx, uint64_t cookie);
+
+/**
+ * Create the per-source queues and the HID engine task
+ *
+ * Every transport submits command packets (BLE format, see
+ * command_parser.h) to its own queue. The engine takes one command at a
+ * time, round-robin across sources, so keystrokes from two sources never
+ * interleave inside a command and a busy source cannot starve the others.
+ * Each source can be rate limited (CONFIG_INGEST_RATE_*).
+ */
+esp_err_t ingest_init(void);
+
+/**
+ * Queue a command packet
+ * @param wait Ticks to wait for queue space (0 from HTTP server tasks; BLE
+ *        waits up to CONFIG_BLE_RX_WAIT_MS to pace the phone)
+ * @param done Optional completion callback
+ * @return ESP_ERR_TIMEOUT if the queue stayed full (counted as dropped),
+ *         ESP_ERR_INVALID_SIZE if longer than CONFIG_INGEST_MAX_CMD,
+ *         ESP_ERR_INVALID_STATE before ingest_init
+ */
+esp_err_t ingest_submit(ingest_source_t src, const uint8_t *data, size_t len, TickType_t wait,
+                        ingest_done_cb_t done, void *ctx, uint64_t cookie);
+
+/**
+ * Drop the queued commands of a source submitted with completion callback
+ * done, or every queued command if done is NULL (dropped commands' callbacks
+ * get ESP_ERR_NOT_FINISHED). Other commands keep their order. A command
+ * already running is not interrupted.
+ */
+void ingest_flush(ingest_source_t src, ingest_done_cb_t done);
+
+/**
+ * Get number of commands waiting in a source queue
+ */
+uint32_t ingest_pending(ingest_source_t src);
+
+/**
+ * Get counters for a source
+ */
+void ingest_get_stats(ingest_source_t src, ingest_stats_t *out);
+
+/**
+ * Get source name for metrics/JSON ("ble", "http", "ws")
+ */
+const char *ingest_source_name(ingest_source_t src);
+
+#endif // INGEST_H
@@ -0,0 +1,230 @@
+#include "json_stream.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Hand staged output to the sink
+static void flush(json_stream_t *js)
+{
+    if (js->len == 0) {
+        return;
+    }
+
+    if (js->err == ESP_OK) {
+        if (js->req != NULL) {
+            js->err = httpd_resp_send_chunk(js->req, js->buf, js->len);
+        } else if (js->out_len + js->len < js->out_size) {
+            memcpy(js->out + js->out_len, js->buf, js->len);
+            js->out_len += js->len;
+        } else {
+            js->err = ESP_ERR_NO_MEM;
+        }
+    }
+    js->len = 0;
+}
+
+static void put(json_stream_t *js, const char *data, size_t len)
+{
+    while (len > 0) {
+        if (js->len == sizeof(js->buf)) {
+            flush(js);
+        }
+        size_t n = sizeof(js->buf) - js->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(js->buf + js->len, data, n);
+        js->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void put_char(json_stream_t *js, char c)
+{
+    if (js->len == sizeof(js->buf)) {
+        flush(js);
+    }
+    js->buf[js->len++] = c;
+}
+
+static void put_escaped(json_stream_t *js, const char *str)
+{
+    put_char(js, '"');
+    for (const char *p = str; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        switch (c) {
+            case '"':  put(js, "\\\"", 2); break;
+            case '\\': put(js, "\\\\", 2); break;
+            case '\n': put(js, "\\n", 2); break;
+            case '\r': put(js, "\\r", 2); break;
+            case '\t': put(js, "\\t", 2); break;
+            default:
+                if (c < 0x20) {
+                    char esc[8];
+                    snprintf(esc, sizeof(esc), "\\u%04x", c);
+                    put(js, esc, 6);
+                } else {
+                    put_char(js, (char)c);
+                }
+                break;
+        }
+    }
+    put_char(js, '"');
+}
+
+// Separator and member name before a value
+static void put_key(json_stream_t *js, const char *key)
+{
+    uint32_t bit = 1u << js->depth;
+    if (js->first & bit) {
+        js->first &= ~bit;
+    } else if (js->depth > 0) {
+        put_char(js, ',');
+    }
+    if (key != NULL) {
+        put_escaped(js, key);
+        put_char(js, ':');
+    }
+}
+
+static void open_level(json_stream_t *js, const char *key, char bracket)
+{
+    put_key(js, key);
+    put_char(js, bracket);
+    if (js->depth + 1 >= JSON_STREAM_MAX_DEPTH) {
+        js->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    js->depth++;
+    js->first |= 1u << js->depth;
+}
+
+static void close_level(json_stream_t *js, char bracket)
+{
+    if (js->depth > 0) {
+        js->depth--;
+    }
+    put_char(js, bracket);
+}
+
+static void init(json_stream_t *js)
+{
+    js->err = ESP_OK;
+    js->first = 1;
+    js->depth = 0;
+    js->len = 0;
+}
+
+void json_stream_init_http(json_stream_t *js, httpd_req_t *req)
+{
+    init(js);
+    js->req = req;
+    js->out = NULL;
+    js->out_size = 0;
+    js->out_len = 0;
+    httpd_resp_set_type(req, "application/json");
+}
+
+void json_stream_init_buffer(json_stream_t *js, char *out, size_t size)
+{
+    init(js);
+    js->req = NULL;
+    js->out = out;
+    js->out_size = size;
+    js->out_len = 0;
+}
+
+void json_stream_object_begin(json_stream_t *js, const char *key)
+{
+    open_level(js, key, '{');
+}
+
+void json_stream_object_end(json_stream_t *js)
+{
+    close_level(js, '}');
+}
+
+void json_stream_array_begin(json_stream_t *js, const char *key)
+{
+    open_level(js, key, '[');
+}
+
+void json_stream_array_end(json_stream_t *js)
+{
+    close_level(js, ']');
+}
+
+void json_stream_string(json_stream_t *js, const char *key, const char *value)
+{
+    put_key(js, key);
+    if (value == NULL) {
+        put(js, "null", 4);
+    } else {
+        put_escaped(js, value);
+    }
+}
+
+void json_stream_int(json_stream_t *js, const char *key, int64_t value)
+{
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%" PRId64, value);
+    put_key(js, key);
+    put(js, num, n);
+}
+
+void json_stream_uint(json_stream_t *js, const char *key, uint32_t value)
+{
+    char num[12];
+    int n = snprintf(num, sizeof(num), "%" PRIu32, value);
+    put_key(js, key);
+    put(js, num, n);
+}
+
+void json_stream_number(json_stream_t *js, const char *key, double value)
+{
+    put_key(js, key);
+    if (!isfinite(value)) {
+        put(js, "null", 4);
+        return;
+    }
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%.6g", value);
+    put(js, num, n);
+}
+
+void json_stream_bool(json_stream_t *js, const char *key, bool value)
+{
+    put_key(js, key);
+    if (value) {
+        put(js, "true", 4);
+    } else {
+        put(js, "false", 5);
+    }
+}
+
+esp_err_t json_stream_finish(json_stream_t *js)
+{
+    flush(js);
+    if (js->req != NULL) {
+        if (js->err == ESP_OK) {
+            js->err = httpd_resp_send_chunk(js->req, NULL, 0);
+        }
+    } else if (js->out_size > 0) {
+        js->out[js->out_len < js->out_size ? js->out_len : js->out_size - 1] = '\0';
+    }
+    return js->err;
+}
+
+esp_err_t json_stream_send_result(httpd_req_t *req, bool success, const char *message)
+{
+    json_stream_t js;
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_bool(&js, "success", success);
+    json_stream_string(&js, "message", message);
+    json_stream_object_end(&js);
+    return json_stream_finish(&js);
+}
@@ -0,0 +1,70 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "config.h"
+
+#define JSON_STREAM_MAX_DEPTH 16
+
+/**
+ * Streaming JSON writer
+ * Output is staged in a small fixed buffer inside the struct (keep it on
+ * the stack) and flushed either as HTTP chunks or into a caller buffer,
+ * so no tree or output string is ever allocated on the heap.
+ */
+typedef struct {
+    httpd_req_t *req;       // HTTP sink (NULL for a buffer sink)
+    char *out;              // Buffer sink
+    size_t out_size;
+    size_t out_len;
+    esp_err_t err;          // First error; later writes are dropped
+    uint32_t first;         // Bit per nesting level: next value needs no comma
+    uint8_t depth;
+    size_t len;
+    char buf[CONFIG_JSON_STREAM_BUF_SIZE];
+} json_stream_t;
+
+/**
+ * Start a JSON response (sets Content-Type, sends chunked)
+ */
+void json_stream_init_http(json_stream_t *js, httpd_req_t *req);
+
+/**
+ * Start writing into a caller buffer (NUL terminated on finish)
+ */
+void json_stream_init_buffer(json_stream_t *js, char *out, size_t size);
+
+/**
+ * Open/close an object or array
+ * @param key Member name inside an object, NULL inside an array or at top level
+ */
+void json_stream_object_begin(json_stream_t *js, const char *key);
+void json_stream_object_end(json_stream_t *js);
+void json_stream_array_begin(json_stream_t *js, const char *key);
+void json_stream_array_end(json_stream_t *js);
+
+/**
+ * Write a value (key as above)
+ */
+void json_stream_string(json_stream_t *js, const char *key, const char *value);
+void json_stream_int(json_stream_t *js, const char *key, int64_t value);
+void json_stream_uint(json_stream_t *js, const char *key, uint32_t value);
+void json_stream_number(json_stream_t *js, const char *key, double value);
+void json_stream_bool(json_stream_t *js, const char *key, bool value);
+
+/**
+ * Flush remaining output and end the response/buffer
+ * @return First error seen (ESP_ERR_NO_MEM if a buffer sink overflowed)
+ */
+esp_err_t json_stream_finish(json_stream_t *js);
+
+/**
+ * Send {"success":..,"message":".."} as a complete response
+ */
+esp_err_t json_stream_send_result(httpd_req_t *req, bool success, const char *message);
+
+#endif // JSON_STREAM_H
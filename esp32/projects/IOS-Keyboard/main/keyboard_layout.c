@@ -1,572 +1,204 @@
 #include "keyboard_layout.h"
+#include "layout_pack.h"
+#include "layout_tables.h"
 #include "config.h"
+#include "deferred_log.h"
+#include "metrics.h"
+#include "settings.h"
+#include "trace_capture.h"
+#include "utf8.h"
 
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
-#include "nvs_flash.h"
-#include "nvs.h"
-#include "class/hid/hid.h"
 
 static const char *TAG = "kbd_layout";
 
-// NVS key for storing layout
-#define NVS_KEY_LAYOUT "kbd_layout"
+// HID usages of the Num Lock dependent keypad keys (1-9, 0, decimal point)
+#define HID_KEYPAD_1        0x59
+#define HID_KEYPAD_DECIMAL  0x63
 
-// Current layout
+#define LAYOUT_MAX          (LAYOUT_COUNT + CONFIG_LAYOUT_PACK_MAX)
+#define LAYOUT_DEFAULT      LAYOUT_CH_DE
+
+// Built-in layouts, then the layout pack
+static keyboard_layout_info_t s_layouts[LAYOUT_MAX];
+static layout_table_t s_tables[LAYOUT_MAX];
+static int s_layout_count = 0;
+
+// Pack layout names copied to RAM, so readers never touch a pack being replaced
+static struct {
+    char code[8];
+    char name[24];
+} s_pack_text[CONFIG_LAYOUT_PACK_MAX];
+
+// Held by lookups; a pack install takes it to swap the tables
+static SemaphoreHandle_t s_layout_mutex = NULL;
+
+// Current layout, and the saved default it starts from; a session selection
+// (keyboard_layout_select) changes only the current one
 static keyboard_layout_t s_current_layout = LAYOUT_US;
+static keyboard_layout_t s_default_layout = LAYOUT_US;
 
-// Modifier flags
-#define MOD_NONE   0
-#define MOD_SHIFT  KEYBOARD_MODIFIER_LEFTSHIFT
-#define MOD_ALTGR  KEYBOARD_MODIFIER_RIGHTALT
-
-// Keycode entry: keycode | (modifier << 8)
-#define KC(k)       (k)
-#define KC_S(k)     ((k) | (MOD_SHIFT << 8))
-#define KC_A(k)     ((k) | (MOD_ALTGR << 8))
-#define KC_SA(k)    ((k) | ((MOD_SHIFT | MOD_ALTGR) << 8))
-
-// Layout info table
-static const keyboard_layout_info_t s_layout_info[] = {
-    { LAYOUT_US,    "us",    "US English" },
-    { LAYOUT_CH_DE, "ch-de", "Swiss German" },
-    { LAYOUT_DE,    "de",    "German" },
-    { LAYOUT_FR,    "fr",    "French" },
-    { LAYOUT_UK,    "uk",    "UK English" },
-    { LAYOUT_ES,    "es",    "Spanish" },
-    { LAYOUT_IT,    "it",    "Italian" },
-};
+// Host Num Lock LED: keypad digits type digits only while it is on
+static volatile bool s_numlock = false;
 
 // ============================================================================
-// US English Layout (QWERTY) - Base reference
+// Table Lookup
 // ============================================================================
-static uint16_t layout_us_lookup(uint32_t cp) {
-    // Basic ASCII
-    if (cp >= 'a' && cp <= 'z') return KC(HID_KEY_A + (cp - 'a'));
-    if (cp >= 'A' && cp <= 'Z') return KC_S(HID_KEY_A + (cp - 'A'));
-    if (cp >= '1' && cp <= '9') return KC(HID_KEY_1 + (cp - '1'));
-    if (cp == '0') return KC(HID_KEY_0);
-
-    switch (cp) {
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-        case '!':  return KC_S(HID_KEY_1);
-        case '@':  return KC_S(HID_KEY_2);
-        case '#':  return KC_S(HID_KEY_3);
-        case '$':  return KC_S(HID_KEY_4);
-        case '%':  return KC_S(HID_KEY_5);
-        case '^':  return KC_S(HID_KEY_6);
-        case '&':  return KC_S(HID_KEY_7);
-        case '*':  return KC_S(HID_KEY_8);
-        case '(':  return KC_S(HID_KEY_9);
-        case ')':  return KC_S(HID_KEY_0);
-        case '-':  return KC(HID_KEY_MINUS);
-        case '_':  return KC_S(HID_KEY_MINUS);
-        case '=':  return KC(HID_KEY_EQUAL);
-        case '+':  return KC_S(HID_KEY_EQUAL);
-        case '[':  return KC(HID_KEY_BRACKET_LEFT);
-        case ']':  return KC(HID_KEY_BRACKET_RIGHT);
-        case '{':  return KC_S(HID_KEY_BRACKET_LEFT);
-        case '}':  return KC_S(HID_KEY_BRACKET_RIGHT);
-        case '\\': return KC(HID_KEY_BACKSLASH);
-        case '|':  return KC_S(HID_KEY_BACKSLASH);
-        case ';':  return KC(HID_KEY_SEMICOLON);
-        case ':':  return KC_S(HID_KEY_SEMICOLON);
-        case '\'': return KC(HID_KEY_APOSTROPHE);
-        case '"':  return KC_S(HID_KEY_APOSTROPHE);
-        case '`':  return KC(HID_KEY_GRAVE);
-        case '~':  return KC_S(HID_KEY_GRAVE);
-        case ',':  return KC(HID_KEY_COMMA);
-        case '.':  return KC(HID_KEY_PERIOD);
-        case '<':  return KC_S(HID_KEY_COMMA);
-        case '>':  return KC_S(HID_KEY_PERIOD);
-        case '/':  return KC(HID_KEY_SLASH);
-        case '?':  return KC_S(HID_KEY_SLASH);
-        default:   return 0;
-    }
+// Layouts are data: main/layouts/*.layout compiled into flash tables by
+// tools/gen_layouts.py, or a mapped layout pack in the same format. ASCII
+// is a direct index; other codepoints go through a minimal perfect hash
+// whose mix()/reduce() must match the generator.
+
+static inline uint32_t layout_mix(uint32_t cp, uint32_t seed)
+{
+    uint32_t h = (cp ^ seed) * 0x9E3779B1u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
 }
 
-// ============================================================================
-// Swiss German Layout (QWERTZ)
-// Physical key positions differ from US layout
-// ============================================================================
-static uint16_t layout_ch_de_lookup(uint32_t cp) {
-    // Letters - Z and Y are swapped in QWERTZ
-    if (cp >= 'a' && cp <= 'z') {
-        if (cp == 'y') return KC(HID_KEY_Z);
-        if (cp == 'z') return KC(HID_KEY_Y);
-        return KC(HID_KEY_A + (cp - 'a'));
-    }
-    if (cp >= 'A' && cp <= 'Z') {
-        if (cp == 'Y') return KC_S(HID_KEY_Z);
-        if (cp == 'Z') return KC_S(HID_KEY_Y);
-        return KC_S(HID_KEY_A + (cp - 'A'));
-    }
-
-    // Numbers (unshifted are same)
-    if (cp >= '1' && cp <= '9') return KC(HID_KEY_1 + (cp - '1'));
-    if (cp == '0') return KC(HID_KEY_0);
-
-    switch (cp) {
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-
-        // Swiss German shifted numbers (Windows layout)
-        case '+':  return KC_S(HID_KEY_1);
-        case '"':  return KC_S(HID_KEY_2);
-        case '*':  return KC_S(HID_KEY_3);
-        // case 'ç':  return KC_S(HID_KEY_4);  // handled in unicode
-        case '%':  return KC_S(HID_KEY_5);
-        case '&':  return KC_S(HID_KEY_6);
-
-        // ! is on the § key (Shift+§) on Swiss German Windows keyboard
-        case '!':  return KC_S(HID_KEY_GRAVE);  // § key is at HID_KEY_GRAVE position
-        case '/':  return KC_S(HID_KEY_7);
-        case '(':  return KC_S(HID_KEY_8);
-        case ')':  return KC_S(HID_KEY_9);
-        case '=':  return KC_S(HID_KEY_0);
-
-        // Special characters on Swiss German (Windows keyboard)
-        // Key right of 0: ' (unshifted) and ? (shifted)
-        case '\'': return KC(HID_KEY_MINUS);           // ' key
-        case '?':  return KC_S(HID_KEY_MINUS);         // ? key
-        // Key right of ': ^ (dead key, unshifted) and ` (shifted)
-        case '^':  return KC(HID_KEY_EQUAL);           // ^ dead key
-        case '`':  return KC_S(HID_KEY_EQUAL);         // ` dead key
-
-        // Umlauts and special characters on Swiss German keyboard
-        case 0xFC: return KC(HID_KEY_BRACKET_LEFT);    // ü
-        case 0xDC: return KC_S(HID_KEY_BRACKET_LEFT);  // Ü
-        case 0xE8: return KC(HID_KEY_BRACKET_RIGHT);   // è (¨ key unshifted gives dead umlaut/è)
-        // Note: Shift+BRACKET_RIGHT = ! on Swiss German (not È)
-
-        case 0xF6: return KC(HID_KEY_SEMICOLON);       // ö
-        case 0xD6: return KC_S(HID_KEY_SEMICOLON);     // Ö
-        case 0xE4: return KC(HID_KEY_APOSTROPHE);      // ä
-        case 0xC4: return KC_S(HID_KEY_APOSTROPHE);    // Ä
-
-        case '$':  return KC(HID_KEY_BACKSLASH);       // $ on Swiss keyboard
-        case 0xA3: return KC_S(HID_KEY_BACKSLASH);     // £
-
-        case '<':  return KC(HID_KEY_EUROPE_2);        // < (key left of Y)
-        case '>':  return KC_S(HID_KEY_EUROPE_2);      // >
-
-        case ',':  return KC(HID_KEY_COMMA);
-        case ';':  return KC_S(HID_KEY_COMMA);
-        case '.':  return KC(HID_KEY_PERIOD);
-        case ':':  return KC_S(HID_KEY_PERIOD);
-        case '-':  return KC(HID_KEY_SLASH);
-        case '_':  return KC_S(HID_KEY_SLASH);
-
-        // AltGr combinations for Swiss German
-        case '@':  return KC_A(HID_KEY_2);
-        case '#':  return KC_A(HID_KEY_3);
-        case 0xAC: return KC_A(HID_KEY_6);             // ¬
-        case 0xA6: return KC_A(HID_KEY_7);             // ¦
-        case 0xA2: return KC_A(HID_KEY_8);             // ¢
-        case '[':  return KC_A(HID_KEY_BRACKET_LEFT);
-        case ']':  return KC_A(HID_KEY_BRACKET_RIGHT);
-        case '{':  return KC_A(HID_KEY_APOSTROPHE);
-        case '}':  return KC_A(HID_KEY_BACKSLASH);
-        case '\\': return KC_A(HID_KEY_EUROPE_2);
-        case '|':  return KC_A(HID_KEY_7);
-        case '~':  return KC_A(HID_KEY_EQUAL);
-
-        default:   return 0;
-    }
+static inline uint32_t layout_reduce(uint32_t h, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)h * n) >> 32);
 }
 
-// ============================================================================
-// German Layout (QWERTZ)
-// ============================================================================
-static uint16_t layout_de_lookup(uint32_t cp) {
-    // Letters - Z and Y swapped
-    if (cp >= 'a' && cp <= 'z') {
-        if (cp == 'y') return KC(HID_KEY_Z);
-        if (cp == 'z') return KC(HID_KEY_Y);
-        return KC(HID_KEY_A + (cp - 'a'));
-    }
-    if (cp >= 'A' && cp <= 'Z') {
-        if (cp == 'Y') return KC_S(HID_KEY_Z);
-        if (cp == 'Z') return KC_S(HID_KEY_Y);
-        return KC_S(HID_KEY_A + (cp - 'A'));
-    }
-
-    if (cp >= '1' && cp <= '9') return KC(HID_KEY_1 + (cp - '1'));
-    if (cp == '0') return KC(HID_KEY_0);
-
-    switch (cp) {
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-
-        // German shifted numbers
-        case '!':  return KC_S(HID_KEY_1);
-        case '"':  return KC_S(HID_KEY_2);
-        case 0xA7: return KC_S(HID_KEY_3);  // §
-        case '$':  return KC_S(HID_KEY_4);
-        case '%':  return KC_S(HID_KEY_5);
-        case '&':  return KC_S(HID_KEY_6);
-        case '/':  return KC_S(HID_KEY_7);
-        case '(':  return KC_S(HID_KEY_8);
-        case ')':  return KC_S(HID_KEY_9);
-        case '=':  return KC_S(HID_KEY_0);
-
-        // German layout special keys
-        case 0xDF: return KC(HID_KEY_MINUS);           // ß
-        case '?':  return KC_S(HID_KEY_MINUS);
-        case 0xB4: return KC(HID_KEY_EQUAL);           // ´ (acute accent)
-        case '`':  return KC_S(HID_KEY_EQUAL);
-
-        // Umlauts
-        case 0xFC: return KC(HID_KEY_BRACKET_LEFT);    // ü
-        case 0xDC: return KC_S(HID_KEY_BRACKET_LEFT);  // Ü
-        case '+':  return KC(HID_KEY_BRACKET_RIGHT);
-        case '*':  return KC_S(HID_KEY_BRACKET_RIGHT);
-        case 0xF6: return KC(HID_KEY_SEMICOLON);       // ö
-        case 0xD6: return KC_S(HID_KEY_SEMICOLON);     // Ö
-        case 0xE4: return KC(HID_KEY_APOSTROPHE);      // ä
-        case 0xC4: return KC_S(HID_KEY_APOSTROPHE);    // Ä
-
-        case '#':  return KC(HID_KEY_BACKSLASH);
-        case '\'': return KC_S(HID_KEY_BACKSLASH);
-
-        case '<':  return KC(HID_KEY_EUROPE_2);
-        case '>':  return KC_S(HID_KEY_EUROPE_2);
-        case '|':  return KC_A(HID_KEY_EUROPE_2);
-
-        case ',':  return KC(HID_KEY_COMMA);
-        case ';':  return KC_S(HID_KEY_COMMA);
-        case '.':  return KC(HID_KEY_PERIOD);
-        case ':':  return KC_S(HID_KEY_PERIOD);
-        case '-':  return KC(HID_KEY_SLASH);
-        case '_':  return KC_S(HID_KEY_SLASH);
-
-        // AltGr
-        case '@':  return KC_A(HID_KEY_Q);
-        case 0x20AC: return KC_A(HID_KEY_E);           // €
-        case '{':  return KC_A(HID_KEY_7);
-        case '[':  return KC_A(HID_KEY_8);
-        case ']':  return KC_A(HID_KEY_9);
-        case '}':  return KC_A(HID_KEY_0);
-        case '\\': return KC_A(HID_KEY_MINUS);
-        case '~':  return KC_A(HID_KEY_BRACKET_RIGHT);
-
-        default:   return 0;
+static uint16_t layout_lookup(const layout_table_t *t, uint32_t cp)
+{
+    if (cp < 128) {
+        return t->ascii[cp];
     }
+    uint32_t n = t->ext_count;
+    if (n == 0) {
+        return 0;
+    }
+    uint32_t bucket = layout_reduce(layout_mix(cp, 0), n);
+    uint32_t slot = layout_reduce(layout_mix(cp, t->ext_seed[bucket]), n);
+    return t->ext_cp[slot] == cp ? t->ext_key[slot] : 0;
 }
 
-// ============================================================================
-// French Layout (AZERTY)
-// ============================================================================
-static uint16_t layout_fr_lookup(uint32_t cp) {
-    // AZERTY letter mapping
-    if (cp >= 'a' && cp <= 'z') {
-        switch (cp) {
-            case 'a': return KC(HID_KEY_Q);
-            case 'q': return KC(HID_KEY_A);
-            case 'z': return KC(HID_KEY_W);
-            case 'w': return KC(HID_KEY_Z);
-            case 'm': return KC(HID_KEY_SEMICOLON);
-            default:  return KC(HID_KEY_A + (cp - 'a'));
-        }
+// Alternative entries of a codepoint (LAYOUT_ALT_MAX, 0-padded), or NULL
+static const uint16_t *layout_lookup_alt(const layout_table_t *t, uint32_t cp)
+{
+    if (cp < 128 && !(t->alt_ascii[cp / 32] & (1u << (cp % 32)))) {
+        return NULL;
     }
-    if (cp >= 'A' && cp <= 'Z') {
-        switch (cp) {
-            case 'A': return KC_S(HID_KEY_Q);
-            case 'Q': return KC_S(HID_KEY_A);
-            case 'Z': return KC_S(HID_KEY_W);
-            case 'W': return KC_S(HID_KEY_Z);
-            case 'M': return KC_S(HID_KEY_SEMICOLON);
-            default:  return KC_S(HID_KEY_A + (cp - 'A'));
+    int lo = 0;
+    int hi = (int)t->alt_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (t->alt_cp[mid] == cp) {
+            return t->alt[mid];
+        }
+        if (t->alt_cp[mid] < cp) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
         }
     }
+    return NULL;
+}
 
-    // French numbers need shift!
-    switch (cp) {
-        case '&':  return KC(HID_KEY_1);
-        case 0xE9: return KC(HID_KEY_2);  // é
-        case '"':  return KC(HID_KEY_3);
-        case '\'': return KC(HID_KEY_4);
-        case '(':  return KC(HID_KEY_5);
-        case '-':  return KC(HID_KEY_6);
-        case 0xE8: return KC(HID_KEY_7);  // è
-        case '_':  return KC(HID_KEY_8);
-        case 0xE7: return KC(HID_KEY_9);  // ç
-        case 0xE0: return KC(HID_KEY_0);  // à
-
-        // Shifted numbers give actual numbers
-        case '1':  return KC_S(HID_KEY_1);
-        case '2':  return KC_S(HID_KEY_2);
-        case '3':  return KC_S(HID_KEY_3);
-        case '4':  return KC_S(HID_KEY_4);
-        case '5':  return KC_S(HID_KEY_5);
-        case '6':  return KC_S(HID_KEY_6);
-        case '7':  return KC_S(HID_KEY_7);
-        case '8':  return KC_S(HID_KEY_8);
-        case '9':  return KC_S(HID_KEY_9);
-        case '0':  return KC_S(HID_KEY_0);
-
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-
-        case ')':  return KC(HID_KEY_MINUS);
-        case 0xB0: return KC_S(HID_KEY_MINUS);  // °
-        case '=':  return KC(HID_KEY_EQUAL);
-        case '+':  return KC_S(HID_KEY_EQUAL);
-
-        case '^':  return KC(HID_KEY_BRACKET_LEFT);
-        case '$':  return KC(HID_KEY_BRACKET_RIGHT);
-        case 0xF9: return KC(HID_KEY_APOSTROPHE);  // ù
-        case '%':  return KC_S(HID_KEY_APOSTROPHE);
-        case '*':  return KC(HID_KEY_BACKSLASH);
-        case 0xB5: return KC_S(HID_KEY_BACKSLASH);  // µ
-
-        case '<':  return KC(HID_KEY_EUROPE_2);
-        case '>':  return KC_S(HID_KEY_EUROPE_2);
-
-        case ',':  return KC(HID_KEY_M);
-        case '?':  return KC_S(HID_KEY_M);
-        case ';':  return KC(HID_KEY_COMMA);
-        case '.':  return KC_S(HID_KEY_COMMA);
-        case ':':  return KC(HID_KEY_PERIOD);
-        case '/':  return KC_S(HID_KEY_PERIOD);
-        case '!':  return KC(HID_KEY_SLASH);
-        case 0xA7: return KC_S(HID_KEY_SLASH);  // §
-
-        // AltGr
-        case '~':  return KC_A(HID_KEY_2);
-        case '#':  return KC_A(HID_KEY_3);
-        case '{':  return KC_A(HID_KEY_4);
-        case '[':  return KC_A(HID_KEY_5);
-        case '|':  return KC_A(HID_KEY_6);
-        case '`':  return KC_A(HID_KEY_7);
-        case '\\': return KC_A(HID_KEY_8);
-        case ']':  return KC_A(HID_KEY_MINUS);
-        case '}':  return KC_A(HID_KEY_EQUAL);
-        case '@':  return KC_A(HID_KEY_0);
-        case 0x20AC: return KC_A(HID_KEY_E);  // €
-
-        default:   return 0;
+// Keystrokes of an entry: the entry itself or its sequence
+static int entry_strokes(const layout_table_t *t, const uint16_t *entry, const uint16_t **strokes)
+{
+    if (!LAYOUT_ENTRY_IS_SEQ(*entry)) {
+        *strokes = entry;
+        return 1;
+    }
+    *strokes = t->seq[LAYOUT_ENTRY_SEQ(*entry)];
+    int count = 0;
+    while (count < LAYOUT_SEQ_MAX && (*strokes)[count] != 0) {
+        count++;
     }
+    return count;
 }
 
-// ============================================================================
-// UK English Layout
-// ============================================================================
-static uint16_t layout_uk_lookup(uint32_t cp) {
-    // Same as US for most letters
-    if (cp >= 'a' && cp <= 'z') return KC(HID_KEY_A + (cp - 'a'));
-    if (cp >= 'A' && cp <= 'Z') return KC_S(HID_KEY_A + (cp - 'A'));
-    if (cp >= '1' && cp <= '9') return KC(HID_KEY_1 + (cp - '1'));
-    if (cp == '0') return KC(HID_KEY_0);
-
-    switch (cp) {
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-
-        // UK differs from US here
-        case '"':  return KC_S(HID_KEY_2);
-        case 0xA3: return KC_S(HID_KEY_3);  // £
-        case '#':  return KC(HID_KEY_BACKSLASH);
-        case '~':  return KC_S(HID_KEY_BACKSLASH);
-        case '@':  return KC_S(HID_KEY_APOSTROPHE);
-        case '\'': return KC(HID_KEY_APOSTROPHE);
-
-        // Rest similar to US
-        case '!':  return KC_S(HID_KEY_1);
-        case '$':  return KC_S(HID_KEY_4);
-        case '%':  return KC_S(HID_KEY_5);
-        case '^':  return KC_S(HID_KEY_6);
-        case '&':  return KC_S(HID_KEY_7);
-        case '*':  return KC_S(HID_KEY_8);
-        case '(':  return KC_S(HID_KEY_9);
-        case ')':  return KC_S(HID_KEY_0);
-        case '-':  return KC(HID_KEY_MINUS);
-        case '_':  return KC_S(HID_KEY_MINUS);
-        case '=':  return KC(HID_KEY_EQUAL);
-        case '+':  return KC_S(HID_KEY_EQUAL);
-        case '[':  return KC(HID_KEY_BRACKET_LEFT);
-        case ']':  return KC(HID_KEY_BRACKET_RIGHT);
-        case '{':  return KC_S(HID_KEY_BRACKET_LEFT);
-        case '}':  return KC_S(HID_KEY_BRACKET_RIGHT);
-        case '\\': return KC(HID_KEY_EUROPE_1);
-        case '|':  return KC_S(HID_KEY_EUROPE_1);
-        case ';':  return KC(HID_KEY_SEMICOLON);
-        case ':':  return KC_S(HID_KEY_SEMICOLON);
-        case '`':  return KC(HID_KEY_GRAVE);
-        case 0xAC: return KC_S(HID_KEY_GRAVE);  // ¬
-        case ',':  return KC(HID_KEY_COMMA);
-        case '.':  return KC(HID_KEY_PERIOD);
-        case '<':  return KC_S(HID_KEY_COMMA);
-        case '>':  return KC_S(HID_KEY_PERIOD);
-        case '/':  return KC(HID_KEY_SLASH);
-        case '?':  return KC_S(HID_KEY_SLASH);
-
-        // AltGr
-        case 0x20AC: return KC_A(HID_KEY_4);  // €
-        case 0xE9:   return KC_A(HID_KEY_E);  // é
-        case 0xFA:   return KC_A(HID_KEY_U);  // ú
-        case 0xED:   return KC_A(HID_KEY_I);  // í
-        case 0xF3:   return KC_A(HID_KEY_O);  // ó
-        case 0xE1:   return KC_A(HID_KEY_A);  // á
-
-        default:   return 0;
+// Keypad digits and decimal point depend on the host's Num Lock
+static bool entry_usable(const layout_table_t *t, uint16_t entry)
+{
+    const uint16_t *strokes;
+    int count = entry_strokes(t, &entry, &strokes);
+    for (int i = 0; i < count; i++) {
+        uint8_t keycode = strokes[i] & 0xFF;
+        if (keycode >= HID_KEYPAD_1 && keycode <= HID_KEYPAD_DECIMAL && !s_numlock) {
+            return false;
+        }
     }
+    return true;
 }
 
-// ============================================================================
-// Spanish Layout
-// ============================================================================
-static uint16_t layout_es_lookup(uint32_t cp) {
-    if (cp >= 'a' && cp <= 'z') return KC(HID_KEY_A + (cp - 'a'));
-    if (cp >= 'A' && cp <= 'Z') return KC_S(HID_KEY_A + (cp - 'A'));
-    if (cp >= '1' && cp <= '9') return KC(HID_KEY_1 + (cp - '1'));
-    if (cp == '0') return KC(HID_KEY_0);
-
-    switch (cp) {
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-
-        // Spanish shifted numbers
-        case '!':  return KC_S(HID_KEY_1);
-        case '"':  return KC_S(HID_KEY_2);
-        case 0xB7: return KC_S(HID_KEY_3);  // ·
-        case '$':  return KC_S(HID_KEY_4);
-        case '%':  return KC_S(HID_KEY_5);
-        case '&':  return KC_S(HID_KEY_6);
-        case '/':  return KC_S(HID_KEY_7);
-        case '(':  return KC_S(HID_KEY_8);
-        case ')':  return KC_S(HID_KEY_9);
-        case '=':  return KC_S(HID_KEY_0);
-
-        case '\'': return KC(HID_KEY_MINUS);
-        case '?':  return KC_S(HID_KEY_MINUS);
-        case 0xBF: return KC_S(HID_KEY_EQUAL);  // ¿
-        case 0xA1: return KC(HID_KEY_EQUAL);    // ¡
-
-        case '`':  return KC(HID_KEY_BRACKET_LEFT);
-        case '^':  return KC_S(HID_KEY_BRACKET_LEFT);
-        case '+':  return KC(HID_KEY_BRACKET_RIGHT);
-        case '*':  return KC_S(HID_KEY_BRACKET_RIGHT);
-
-        case 0xF1: return KC(HID_KEY_SEMICOLON);    // ñ
-        case 0xD1: return KC_S(HID_KEY_SEMICOLON);  // Ñ
-
-        case 0xB4: return KC(HID_KEY_APOSTROPHE);   // ´
-        case 0xA8: return KC_S(HID_KEY_APOSTROPHE); // ¨
-
-        case 0xE7: return KC(HID_KEY_BACKSLASH);    // ç
-        case 0xC7: return KC_S(HID_KEY_BACKSLASH);  // Ç
-
-        case '<':  return KC(HID_KEY_EUROPE_2);
-        case '>':  return KC_S(HID_KEY_EUROPE_2);
-
-        case ',':  return KC(HID_KEY_COMMA);
-        case ';':  return KC_S(HID_KEY_COMMA);
-        case '.':  return KC(HID_KEY_PERIOD);
-        case ':':  return KC_S(HID_KEY_PERIOD);
-        case '-':  return KC(HID_KEY_SLASH);
-        case '_':  return KC_S(HID_KEY_SLASH);
-
-        // AltGr
-        case '|':  return KC_A(HID_KEY_1);
-        case '@':  return KC_A(HID_KEY_2);
-        case '#':  return KC_A(HID_KEY_3);
-        case '~':  return KC_A(HID_KEY_4);
-        case 0x20AC: return KC_A(HID_KEY_5);  // €
-        case '[':  return KC_A(HID_KEY_BRACKET_LEFT);
-        case ']':  return KC_A(HID_KEY_BRACKET_RIGHT);
-        case '{':  return KC_A(HID_KEY_APOSTROPHE);
-        case '}':  return KC_A(HID_KEY_BACKSLASH);
-        case '\\': return KC_A(HID_KEY_GRAVE);
-
-        default:   return 0;
+// Every way to type a codepoint, primary first; 0 if unmapped
+static int layout_paths(const layout_table_t *t, uint32_t cp, uint16_t paths[1 + LAYOUT_ALT_MAX])
+{
+    paths[0] = layout_lookup(t, cp);
+    if (paths[0] == 0) {
+        return 0;
     }
+    int count = 1;
+    const uint16_t *alt = layout_lookup_alt(t, cp);
+    for (int i = 0; alt != NULL && i < LAYOUT_ALT_MAX && alt[i] != 0; i++) {
+        if (entry_usable(t, alt[i])) {
+            paths[count++] = alt[i];
+        }
+    }
+    return count;
 }
 
 // ============================================================================
-// Italian Layout
+// Layout List
 // ============================================================================
-static uint16_t layout_it_lookup(uint32_t cp) {
-    if (cp >= 'a' && cp <= 'z') return KC(HID_KEY_A + (cp - 'a'));
-    if (cp >= 'A' && cp <= 'Z') return KC_S(HID_KEY_A + (cp - 'A'));
-    if (cp >= '1' && cp <= '9') return KC(HID_KEY_1 + (cp - '1'));
-    if (cp == '0') return KC(HID_KEY_0);
-
-    switch (cp) {
-        case ' ':  return KC(HID_KEY_SPACE);
-        case '\n': return KC(HID_KEY_ENTER);
-        case '\t': return KC(HID_KEY_TAB);
-
-        case '!':  return KC_S(HID_KEY_1);
-        case '"':  return KC_S(HID_KEY_2);
-        case 0xA3: return KC_S(HID_KEY_3);  // £
-        case '$':  return KC_S(HID_KEY_4);
-        case '%':  return KC_S(HID_KEY_5);
-        case '&':  return KC_S(HID_KEY_6);
-        case '/':  return KC_S(HID_KEY_7);
-        case '(':  return KC_S(HID_KEY_8);
-        case ')':  return KC_S(HID_KEY_9);
-        case '=':  return KC_S(HID_KEY_0);
-
-        case '\'': return KC(HID_KEY_MINUS);
-        case '?':  return KC_S(HID_KEY_MINUS);
-        case 0xEC: return KC(HID_KEY_EQUAL);   // ì
-        case '^':  return KC_S(HID_KEY_EQUAL);
-
-        case 0xE8: return KC(HID_KEY_BRACKET_LEFT);   // è
-        case 0xE9: return KC_S(HID_KEY_BRACKET_LEFT); // é
-        case '+':  return KC(HID_KEY_BRACKET_RIGHT);
-        case '*':  return KC_S(HID_KEY_BRACKET_RIGHT);
-
-        case 0xF2: return KC(HID_KEY_SEMICOLON);      // ò
-        case 0xE7: return KC_S(HID_KEY_SEMICOLON);    // ç
-        case 0xE0: return KC(HID_KEY_APOSTROPHE);     // à
-        case 0xB0: return KC_S(HID_KEY_APOSTROPHE);   // °
-        case 0xF9: return KC(HID_KEY_BACKSLASH);      // ù
-        case 0xA7: return KC_S(HID_KEY_BACKSLASH);    // §
-
-        case '<':  return KC(HID_KEY_EUROPE_2);
-        case '>':  return KC_S(HID_KEY_EUROPE_2);
-
-        case ',':  return KC(HID_KEY_COMMA);
-        case ';':  return KC_S(HID_KEY_COMMA);
-        case '.':  return KC(HID_KEY_PERIOD);
-        case ':':  return KC_S(HID_KEY_PERIOD);
-        case '-':  return KC(HID_KEY_SLASH);
-        case '_':  return KC_S(HID_KEY_SLASH);
-
-        // AltGr
-        case '@':  return KC_A(HID_KEY_SEMICOLON);
-        case '#':  return KC_A(HID_KEY_APOSTROPHE);
-        case '[':  return KC_A(HID_KEY_BRACKET_LEFT);
-        case ']':  return KC_A(HID_KEY_BRACKET_RIGHT);
-        case '{':  return KC_A(HID_KEY_7);
-        case '}':  return KC_A(HID_KEY_0);
-        case 0x20AC: return KC_A(HID_KEY_E);  // €
-
-        default:   return 0;
+
+// Index of a layout code, -1 if none (layout mutex held, or init)
+static int find_layout(const char *code)
+{
+    for (int i = 0; i < s_layout_count; i++) {
+        if (strcmp(s_layouts[i].code, code) == 0) {
+            return i;
+        }
     }
+    return -1;
 }
 
-// ============================================================================
-// Layout Dispatcher
-// ============================================================================
-static uint16_t (*s_layout_lookup[])(uint32_t) = {
-    [LAYOUT_US]    = layout_us_lookup,
-    [LAYOUT_CH_DE] = layout_ch_de_lookup,
-    [LAYOUT_DE]    = layout_de_lookup,
-    [LAYOUT_FR]    = layout_fr_lookup,
-    [LAYOUT_UK]    = layout_uk_lookup,
-    [LAYOUT_ES]    = layout_es_lookup,
-    [LAYOUT_IT]    = layout_it_lookup,
-};
+// Rebuild the list from the built-in tables and the mapped pack
+static void load_layouts(void)
+{
+    memcpy(s_tables, layout_tables, sizeof(layout_tables));
+    memcpy(s_layouts, layout_table_info, sizeof(layout_table_info));
+    s_layout_count = LAYOUT_COUNT;
+
+    int packed = layout_pack_count();
+    for (int i = 0; i < packed; i++) {
+        layout_pack_layout_t layout;
+        if (!layout_pack_get(i, &layout)) {
+            break;
+        }
+        if (s_layout_count == LAYOUT_MAX) {
+            ESP_LOGW(TAG, "Layout pack has more than %d layouts", CONFIG_LAYOUT_PACK_MAX);
+            break;
+        }
+        if (find_layout(layout.code) >= 0) {
+            ESP_LOGW(TAG, "Skipping packed layout '%s': code already in use", layout.code);
+            continue;
+        }
+
+        int slot = s_layout_count - LAYOUT_COUNT;
+        strncpy(s_pack_text[slot].code, layout.code, sizeof(s_pack_text[slot].code) - 1);
+        strncpy(s_pack_text[slot].name, layout.name, sizeof(s_pack_text[slot].name) - 1);
+        s_layouts[s_layout_count] = (keyboard_layout_info_t){
+            .id = (keyboard_layout_t)s_layout_count,
+            .code = s_pack_text[slot].code,
+            .name = s_pack_text[slot].name,
+            .hid_country = layout.hid_country,
+            .packed = true,
+        };
+        s_tables[s_layout_count] = layout.table;
+        s_layout_count++;
+    }
+}
 
 // ============================================================================
 // Public API
@@ -574,22 +206,31 @@ static uint16_t (*s_layout_lookup[])(uint32_t) = {
 
 esp_err_t keyboard_layout_init(void)
 {
-    nvs_handle_t nvs;
-    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs);
-    if (err == ESP_OK) {
-        uint8_t layout = 0;
-        err = nvs_get_u8(nvs, NVS_KEY_LAYOUT, &layout);
-        if (err == ESP_OK && layout < LAYOUT_COUNT) {
-            s_current_layout = (keyboard_layout_t)layout;
-            ESP_LOGI(TAG, "Loaded keyboard layout: %s", s_layout_info[s_current_layout].name);
-        }
-        nvs_close(nvs);
+    s_layout_mutex = xSemaphoreCreateMutex();
+    if (s_layout_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    layout_pack_init();
+    load_layouts();
+
+    // Saved by code (any layout); older firmware saved a built-in index
+    int index = -1;
+    char code[sizeof(s_pack_text[0].code)];
+    uint32_t layout = 0;
+    if (settings_get_str(SETTING_LAYOUT, code, sizeof(code)) == ESP_OK) {
+        index = find_layout(code);
+    } else if (settings_get_u32(SETTING_LAYOUT_LEGACY, &layout) == ESP_OK && layout < LAYOUT_COUNT) {
+        index = (int)layout;
     }
 
-    if (err != ESP_OK) {
-        s_current_layout = LAYOUT_CH_DE;  // Default to Swiss German
-        ESP_LOGI(TAG, "Using default layout: %s", s_layout_info[s_current_layout].name);
+    if (index >= 0) {
+        s_current_layout = (keyboard_layout_t)index;
+        ESP_LOGI(TAG, "Loaded keyboard layout: %s", s_layouts[s_current_layout].name);
+    } else {
+        s_current_layout = LAYOUT_DEFAULT;  // Default to Swiss German
+        ESP_LOGI(TAG, "Using default layout: %s", s_layouts[s_current_layout].name);
     }
+    s_default_layout = s_current_layout;
 
     return ESP_OK;
 }
@@ -599,106 +240,406 @@ keyboard_layout_t keyboard_layout_get(void)
     return s_current_layout;
 }
 
-esp_err_t keyboard_layout_set(keyboard_layout_t layout)
+keyboard_layout_t keyboard_layout_get_default(void)
 {
-    if (layout >= LAYOUT_COUNT) {
-        return ESP_ERR_INVALID_ARG;
-    }
+    return s_default_layout;
+}
 
-    s_current_layout = layout;
+esp_err_t keyboard_layout_select(keyboard_layout_t layout)
+{
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+    bool valid = layout < s_layout_count;
+    if (valid) {
+        s_current_layout = layout;
+    }
+    xSemaphoreGive(s_layout_mutex);
+    return valid ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
 
-    // Save to NVS
-    nvs_handle_t nvs;
-    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
-    if (err == ESP_OK) {
-        err = nvs_set_u8(nvs, NVS_KEY_LAYOUT, (uint8_t)layout);
-        if (err == ESP_OK) {
-            err = nvs_commit(nvs);
-        }
-        nvs_close(nvs);
+esp_err_t keyboard_layout_select_by_code(const char *code)
+{
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+    int index = (code == NULL || code[0] == '\0') ? (int)s_default_layout : find_layout(code);
+    if (index >= 0) {
+        s_current_layout = (keyboard_layout_t)index;
     }
+    xSemaphoreGive(s_layout_mutex);
+    return index >= 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
 
-    ESP_LOGI(TAG, "Keyboard layout set to: %s", s_layout_info[layout].name);
+// Make a layout current and the saved default (layout mutex held). Saved
+// by code, so a packed layout survives pack updates (committed to flash
+// by the settings task)
+static esp_err_t set_layout(keyboard_layout_t layout)
+{
+    s_current_layout = layout;
+    s_default_layout = layout;
+    ESP_LOGI(TAG, "Keyboard layout set to: %s", s_layouts[layout].name);
+    return settings_set_str(SETTING_LAYOUT, s_layouts[layout].code);
+}
+
+esp_err_t keyboard_layout_set(keyboard_layout_t layout)
+{
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+    esp_err_t err = layout < s_layout_count ? set_layout(layout) : ESP_ERR_INVALID_ARG;
+    xSemaphoreGive(s_layout_mutex);
     return err;
 }
 
 esp_err_t keyboard_layout_set_by_code(const char *code)
 {
-    for (int i = 0; i < LAYOUT_COUNT; i++) {
-        if (strcmp(s_layout_info[i].code, code) == 0) {
-            return keyboard_layout_set((keyboard_layout_t)i);
-        }
-    }
-    return ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+    int index = code != NULL ? find_layout(code) : -1;
+    esp_err_t err = index >= 0 ? set_layout((keyboard_layout_t)index) : ESP_ERR_NOT_FOUND;
+    xSemaphoreGive(s_layout_mutex);
+    return err;
 }
 
 const keyboard_layout_info_t *keyboard_layout_get_info(keyboard_layout_t layout)
 {
-    if (layout >= LAYOUT_COUNT) {
+    if (layout >= s_layout_count) {
         return NULL;
     }
-    return &s_layout_info[layout];
+    return &s_layouts[layout];
 }
 
 const keyboard_layout_info_t *keyboard_layout_get_all(int *count)
 {
     if (count) {
-        *count = LAYOUT_COUNT;
+        *count = s_layout_count;
     }
-    return s_layout_info;
+    return s_layouts;
+}
+
+esp_err_t keyboard_layout_install_pack(const uint8_t *data, size_t len)
+{
+    esp_err_t err = layout_pack_validate(data, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+
+    char current[sizeof(s_pack_text[0].code)] = "";
+    char saved[sizeof(s_pack_text[0].code)] = "";
+    strncpy(current, s_layouts[s_current_layout].code, sizeof(current) - 1);
+    strncpy(saved, s_layouts[s_default_layout].code, sizeof(saved) - 1);
+
+    err = layout_pack_write(data, len);
+    load_layouts();     // Even on failure: the old pack is unmapped
+
+    int index = find_layout(saved);
+    if (index < 0) {
+        ESP_LOGW(TAG, "Layout '%s' is gone, using %s", saved, s_layouts[LAYOUT_DEFAULT].name);
+        index = LAYOUT_DEFAULT;
+    }
+    s_default_layout = (keyboard_layout_t)index;
+    index = find_layout(current);
+    s_current_layout = index >= 0 ? (keyboard_layout_t)index : s_default_layout;
+
+    xSemaphoreGive(s_layout_mutex);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Layout pack installed: %d layouts", s_layout_count - LAYOUT_COUNT);
+    }
+    return err;
+}
+
+void keyboard_layout_set_numlock(bool on)
+{
+    s_numlock = on;
 }
 
 uint16_t keyboard_layout_char_to_keycode(uint32_t codepoint)
 {
-    if (s_current_layout >= LAYOUT_COUNT) {
-        return 0;
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+    uint16_t keydata = layout_lookup(&s_tables[s_current_layout], codepoint);
+    xSemaphoreGive(s_layout_mutex);
+    return LAYOUT_ENTRY_IS_SEQ(keydata) ? 0 : keydata;
+}
+
+// ============================================================================
+// Planner
+// ============================================================================
+// Most characters have one path and are written straight through. A run of
+// characters with alternatives (keypad, second key, dead key) is held back
+// until the next single-path character, then the cheapest combination is
+// picked: keystrokes first, then modifier changes, including those to the
+// keystrokes on either side of the run.
+
+// One keystroke (press and release report) costs this many modifier changes
+#define PLAN_KEY_COST   2
+// Characters with alternatives decided together
+#define PLAN_RUN_MAX    8
+
+typedef struct {
+    uint16_t paths[1 + LAYOUT_ALT_MAX];
+    uint8_t count;
+    uint32_t offset;
+} plan_run_char_t;
+
+typedef struct {
+    const layout_table_t *table;
+    keyboard_keystroke_t *keys;
+    size_t max_keys;
+    keyboard_plan_t *plan;
+    uint8_t mods;               // Modifiers of the last keystroke written
+    plan_run_char_t run[PLAN_RUN_MAX];
+    int run_len;
+    size_t run_reserve;         // Keystrokes the run needs at most
+} planner_t;
+
+static int mod_changes(uint8_t from, uint8_t to)
+{
+    return __builtin_popcount(from ^ to);
+}
+
+// Cost of typing an entry after a keystroke with mods; *mods_out gets the
+// modifiers of its last keystroke
+static int entry_cost(const layout_table_t *t, uint16_t entry, uint8_t mods, uint8_t *mods_out)
+{
+    const uint16_t *strokes;
+    int count = entry_strokes(t, &entry, &strokes);
+    int cost = count * PLAN_KEY_COST;
+    for (int i = 0; i < count; i++) {
+        uint8_t m = strokes[i] >> 8;
+        cost += mod_changes(mods, m);
+        mods = m;
     }
-    return s_layout_lookup[s_current_layout](codepoint);
+    *mods_out = mods;
+    return cost;
 }
 
-// UTF-8 decoder helper
-static int utf8_decode(const char *str, uint32_t *codepoint)
+static void plan_entry(planner_t *p, uint16_t entry, uint32_t offset)
 {
-    uint8_t c = (uint8_t)str[0];
+    const uint16_t *strokes;
+    int count = entry_strokes(p->table, &entry, &strokes);
+    for (int i = 0; i < count; i++) {
+        p->keys[p->plan->keys++] = (keyboard_keystroke_t){
+            .keycode = strokes[i] & 0xFF,
+            .modifiers = strokes[i] >> 8,
+            .offset = offset,
+        };
+    }
+    p->mods = strokes[count - 1] >> 8;
+    p->plan->chars++;
+}
 
-    if ((c & 0x80) == 0) {
-        *codepoint = c;
-        return 1;
-    } else if ((c & 0xE0) == 0xC0) {
-        *codepoint = ((c & 0x1F) << 6) | (str[1] & 0x3F);
-        return 2;
-    } else if ((c & 0xF0) == 0xE0) {
-        *codepoint = ((c & 0x0F) << 12) | ((str[1] & 0x3F) << 6) | (str[2] & 0x3F);
-        return 3;
-    } else if ((c & 0xF8) == 0xF0) {
-        *codepoint = ((c & 0x07) << 18) | ((str[1] & 0x3F) << 12) | ((str[2] & 0x3F) << 6) | (str[3] & 0x3F);
-        return 4;
-    }
-
-    *codepoint = 0;
-    return 1;
+// Write the held run, choosing paths by dynamic programming over the
+// modifiers each path ends with; next_mods is where the text continues
+static void plan_flush(planner_t *p, int next_mods)
+{
+    uint16_t cost[PLAN_RUN_MAX][1 + LAYOUT_ALT_MAX];
+    uint8_t end_mods[PLAN_RUN_MAX][1 + LAYOUT_ALT_MAX];
+    uint8_t from[PLAN_RUN_MAX][1 + LAYOUT_ALT_MAX];
+
+    for (int i = 0; i < p->run_len; i++) {
+        const plan_run_char_t *c = &p->run[i];
+        for (int a = 0; a < c->count; a++) {
+            if (i == 0) {
+                cost[i][a] = entry_cost(p->table, c->paths[a], p->mods, &end_mods[i][a]);
+                continue;
+            }
+            // Ties keep the earlier (primary) path
+            int best = -1;
+            for (int b = 0; b < p->run[i - 1].count; b++) {
+                uint8_t m;
+                int total = cost[i - 1][b] + entry_cost(p->table, c->paths[a], end_mods[i - 1][b], &m);
+                if (best < 0 || total < cost[i][a]) {
+                    best = b;
+                    cost[i][a] = total;
+                    end_mods[i][a] = m;
+                }
+            }
+            from[i][a] = best;
+        }
+    }
+
+    if (p->run_len > 0) {
+        int last = p->run_len - 1;
+        int pick = 0;
+        int best = -1;
+        for (int a = 0; a < p->run[last].count; a++) {
+            int total = cost[last][a] + (next_mods >= 0 ? mod_changes(end_mods[last][a], next_mods) : 0);
+            if (best < 0 || total < best) {
+                best = total;
+                pick = a;
+            }
+        }
+        uint8_t choice[PLAN_RUN_MAX];
+        for (int i = last; i >= 0; i--) {
+            choice[i] = pick;
+            if (i > 0) {
+                pick = from[i][pick];
+            }
+        }
+        for (int i = 0; i <= last; i++) {
+            plan_entry(p, p->run[i].paths[choice[i]], p->run[i].offset);
+        }
+    }
+    p->run_len = 0;
+    p->run_reserve = 0;
 }
 
-int keyboard_layout_string_to_keycodes(const char *utf8_str, keycode_callback_t callback, void *ctx)
+// Plan one character; false if its keystrokes may not fit
+static bool plan_char(planner_t *p, uint32_t cp, uint32_t offset)
 {
-    int count = 0;
-    const char *p = utf8_str;
+    keyboard_plan_t *plan = p->plan;
+    uint16_t paths[1 + LAYOUT_ALT_MAX];
+    int count = layout_paths(p->table, cp, paths);
+    if (count == 0) {
+        if (plan->unmapped < KEYBOARD_PLAN_MAX_UNMAPPED) {
+            plan->unmapped_offsets[plan->unmapped] = offset;
+        }
+        plan->unmapped++;
+        DLOG(DLOG_LAYOUT_UNMAPPED, cp);
+        return true;
+    }
 
-    while (*p) {
-        uint32_t cp;
-        int len = utf8_decode(p, &cp);
+    // Reserve for the longest path; the one chosen may be shorter
+    int need = 0;
+    for (int a = 0; a < count; a++) {
+        const uint16_t *strokes;
+        int n = entry_strokes(p->table, &paths[a], &strokes);
+        need = n > need ? n : need;
+    }
+    if (plan->keys + p->run_reserve + need > p->max_keys) {
+        return false;
+    }
 
-        uint16_t keydata = keyboard_layout_char_to_keycode(cp);
-        if (keydata != 0) {
-            uint8_t keycode = keydata & 0xFF;
-            uint8_t modifiers = (keydata >> 8) & 0xFF;
-            callback(keycode, modifiers, ctx);
-            count++;
-        } else {
-            ESP_LOGW(TAG, "No keycode for char 0x%02X '%c'", (unsigned)cp, (cp >= 32 && cp < 127) ? (char)cp : '?');
+    if (count == 1) {
+        const uint16_t *strokes;
+        entry_strokes(p->table, &paths[0], &strokes);
+        plan_flush(p, strokes[0] >> 8);
+        plan_entry(p, paths[0], offset);
+        return true;
+    }
+
+    if (p->run_len == PLAN_RUN_MAX) {
+        plan_flush(p, -1);
+    }
+    plan_run_char_t *c = &p->run[p->run_len++];
+    memcpy(c->paths, paths, sizeof(paths));
+    c->count = count;
+    c->offset = offset;
+    p->run_reserve += need;
+    return true;
+}
+
+// True if none of four ASCII characters has an alternative path
+static inline bool ascii_single_path(const layout_table_t *t, const uint8_t *b)
+{
+    return !((t->alt_ascii[b[0] >> 5] >> (b[0] & 31)) & 1) &&
+           !((t->alt_ascii[b[1] >> 5] >> (b[1] & 31)) & 1) &&
+           !((t->alt_ascii[b[2] >> 5] >> (b[2] & 31)) & 1) &&
+           !((t->alt_ascii[b[3] >> 5] >> (b[3] & 31)) & 1);
+}
+
+size_t keyboard_layout_plan(utf8_decoder_t *dec, const char *text, size_t len,
+                            keyboard_keystroke_t *keys, size_t max_keys, keyboard_plan_t *plan)
+{
+    utf8_decoder_t local;
+    if (dec == NULL) {
+        utf8_decoder_reset(&local);
+        dec = &local;
+    }
+    memset(plan, 0, sizeof(*plan));
+
+    trace_capture_begin(TC_EV_LAYOUT, len);
+    xSemaphoreTake(s_layout_mutex, portMAX_DELAY);
+    planner_t p = {
+        .table = &s_tables[s_current_layout],
+        .keys = keys,
+        .max_keys = max_keys,
+        .plan = plan,
+    };
+    const layout_table_t *table = p.table;
+
+    size_t pos = 0;
+    size_t seq_start = 0;   // Start of the sequence being decoded
+    while (pos < len) {
+        if (!utf8_decoder_pending(dec)) {
+            size_t end = pos + utf8_ascii_span(text + pos, len - pos);
+            while (pos < end) {
+                // Four plain single-path ASCII keystrokes at a time
+                if (end - pos >= 4 && p.run_len == 0 && plan->keys + 4 <= max_keys) {
+                    const uint8_t *b = (const uint8_t *)text + pos;
+                    uint16_t e0 = table->ascii[b[0]], e1 = table->ascii[b[1]];
+                    uint16_t e2 = table->ascii[b[2]], e3 = table->ascii[b[3]];
+                    // Plain keys have a keycode; 0 and sequences go one by one
+                    if ((e0 & 0xFF) && (e1 & 0xFF) && (e2 & 0xFF) && (e3 & 0xFF) &&
+                        ascii_single_path(table, b)) {
+                        keyboard_keystroke_t *k = &keys[plan->keys];
+                        k[0] = (keyboard_keystroke_t){ e0 & 0xFF, e0 >> 8, 0, pos };
+                        k[1] = (keyboard_keystroke_t){ e1 & 0xFF, e1 >> 8, 0, pos + 1 };
+                        k[2] = (keyboard_keystroke_t){ e2 & 0xFF, e2 >> 8, 0, pos + 2 };
+                        k[3] = (keyboard_keystroke_t){ e3 & 0xFF, e3 >> 8, 0, pos + 3 };
+                        plan->keys += 4;
+                        plan->chars += 4;
+                        p.mods = e3 >> 8;
+                        pos += 4;
+                        continue;
+                    }
+                }
+                if (!plan_char(&p, (uint8_t)text[pos], pos)) {
+                    goto full;
+                }
+                pos++;
+            }
+            if (pos == len) {
+                break;
+            }
+            seq_start = pos;
         }
 
-        p += len;
+        // Multi-byte (or malformed) character; undo it if it does not fit
+        utf8_decoder_t saved = *dec;
+        size_t start = pos;
+        uint32_t cp = utf8_decode_next(dec, text, len, &pos);
+        if (cp == UTF8_NEED_MORE) {
+            break;      // Held in the decoder until the next buffer
+        }
+        if (!plan_char(&p, cp, seq_start)) {
+            *dec = saved;
+            pos = start;
+            break;
+        }
+        seq_start = pos;
+    }
+full:
+    plan_flush(&p, -1);
+    xSemaphoreGive(s_layout_mutex);
+    trace_capture_end(TC_EV_LAYOUT, len);
+
+    plan->consumed = pos;
+    if (dec == &local && utf8_decoder_pending(dec)) {
+        plan->consumed = seq_start;     // No state to carry: leave the tail unread
+    }
+    if (plan->unmapped > 0) {
+        metrics_inc(METRIC_UNMAPPED, plan->unmapped);
+    }
+    return plan->keys;
+}
+
+int keyboard_layout_string_to_keycodes(const char *utf8_str, keycode_callback_t callback, void *ctx)
+{
+    keyboard_keystroke_t keys[16];
+    const char *p = utf8_str;
+    size_t remaining = strlen(utf8_str);
+    int count = 0;
+
+    while (remaining > 0) {
+        keyboard_plan_t plan;
+        keyboard_layout_plan(NULL, p, remaining, keys, sizeof(keys) / sizeof(keys[0]), &plan);
+        for (size_t i = 0; i < plan.keys; i++) {
+            callback(keys[i].keycode, keys[i].modifiers, ctx);
+        }
+        count += plan.chars;
+        if (plan.consumed == 0) {
+            break;      // String ends inside a UTF-8 sequence
+        }
+        p += plan.consumed;
+        remaining -= plan.consumed;
     }
 
     return count;
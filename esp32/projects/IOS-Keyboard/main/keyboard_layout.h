@@ -2,6 +2,8 @@
 #define KEYBOARD_LAYOUT_H
 
 #include "esp_err.h"
+#include "utf8.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -14,7 +16,8 @@ typedef enum {
     LAYOUT_UK,            // UK English
     LAYOUT_ES,            // Spanish
     LAYOUT_IT,            // Italian
-    LAYOUT_COUNT          // Number of layouts
+    LAYOUT_COUNT          // Number of built-in layouts; layouts from the
+                          // layout pack follow from here
 } keyboard_layout_t;
 
 // Layout info structure
@@ -22,10 +25,12 @@ typedef struct {
     keyboard_layout_t id;
     const char *code;     // Short code (e.g., "ch-de")
     const char *name;     // Display name (e.g., "Swiss German")
+    uint8_t hid_country;  // HID descriptor country code
+    bool packed;          // From the layout pack rather than the firmware
 } keyboard_layout_info_t;
 
 /**
- * Initialize keyboard layout module and load saved layout from NVS
+ * Initialize keyboard layout module and load the saved layout (settings_init must run first)
  */
 esp_err_t keyboard_layout_init(void);
 
@@ -35,10 +40,30 @@ esp_err_t keyboard_layout_init(void);
 keyboard_layout_t keyboard_layout_get(void);
 
 /**
- * Set the keyboard layout and save to NVS
+ * Set the keyboard layout and save it (the new default)
  */
 esp_err_t keyboard_layout_set(keyboard_layout_t layout);
 
+/**
+ * Switch the layout for the following text without saving it
+ * Takes effect at once and does not write flash; the saved default is
+ * used again after a reboot or keyboard_layout_select_by_code("").
+ */
+esp_err_t keyboard_layout_select(keyboard_layout_t layout);
+
+/**
+ * Switch the layout by code without saving it; NULL or "" selects the
+ * saved default
+ * @return ESP_ERR_NOT_FOUND for an unknown code
+ */
+esp_err_t keyboard_layout_select_by_code(const char *code);
+
+/**
+ * Get the saved default layout (differs from keyboard_layout_get() after
+ * keyboard_layout_select())
+ */
+keyboard_layout_t keyboard_layout_get_default(void);
+
 /**
  * Set keyboard layout by code string (e.g., "ch-de")
  */
@@ -50,17 +75,75 @@ esp_err_t keyboard_layout_set_by_code(const char *code);
 const keyboard_layout_info_t *keyboard_layout_get_info(keyboard_layout_t layout);
 
 /**
- * Get all available layouts
+ * Get all available layouts (built-in, then layout pack)
  */
 const keyboard_layout_info_t *keyboard_layout_get_all(int *count);
 
+/**
+ * Replace the layout pack (tools/gen_layouts.py --pack output)
+ * Waits for typing in progress, writes the "layouts" partition and
+ * reloads the layout list. If the current layout came from the old pack
+ * and is missing from the new one, the default layout is used.
+ * @return ESP_ERR_INVALID_CRC etc. for a damaged pack (old pack kept)
+ */
+esp_err_t keyboard_layout_install_pack(const uint8_t *data, size_t len);
+
 /**
  * Convert a Unicode codepoint to HID keycode + modifiers for current layout
  * Returns keycode in lower byte, modifiers in upper byte
- * Returns 0 if character is not supported
+ * Returns 0 if character is not supported or needs a key sequence
+ * (keyboard_layout_string_to_keycodes types those)
  */
 uint16_t keyboard_layout_char_to_keycode(uint32_t codepoint);
 
+/**
+ * Report the host's Num Lock state (from its LED output report)
+ * Keypad digits are used as an alternative path only while it is on.
+ */
+void keyboard_layout_set_numlock(bool on);
+
+/**
+ * One keystroke of a typing plan
+ */
+typedef struct {
+    uint8_t keycode;
+    uint8_t modifiers;
+    uint16_t reserved;
+    uint32_t offset;      // Byte offset of the source character in the input
+} keyboard_keystroke_t;
+
+#define KEYBOARD_PLAN_MAX_UNMAPPED 8
+
+/**
+ * Result of keyboard_layout_plan()
+ */
+typedef struct {
+    size_t keys;          // Keystrokes written
+    size_t chars;         // Characters converted to keystrokes
+    size_t consumed;      // Input bytes converted (< len if keys ran out, or
+                          // without a decoder, if the input ends inside a
+                          // UTF-8 sequence)
+    size_t unmapped;      // Characters the layout cannot type (skipped)
+    uint32_t unmapped_offsets[KEYBOARD_PLAN_MAX_UNMAPPED];  // First ones
+} keyboard_plan_t;
+
+/**
+ * Convert a UTF-8 buffer into keystrokes for the current layout in one pass
+ * Characters that can be typed several ways (keypad, dead key, second key)
+ * get the path with the fewest keystrokes and modifier changes next to the
+ * characters around them; the others use their only path.
+ * Stops at a character boundary when max_keys would be exceeded; convert
+ * the rest from text + plan->consumed. max_keys must be at least 4 (the
+ * longest key sequence). Key sequences (e.g. dead keys) come out as
+ * consecutive keystrokes with the same offset. Malformed UTF-8 counts as
+ * unmapped and types nothing.
+ * @param dec Decoder carrying a sequence split across buffers (e.g. BLE
+ *        inserts); NULL to treat the buffer on its own
+ * @return Number of keystrokes written (plan->keys)
+ */
+size_t keyboard_layout_plan(utf8_decoder_t *dec, const char *text, size_t len,
+                            keyboard_keystroke_t *keys, size_t max_keys, keyboard_plan_t *plan);
+
 /**
  * Convert a UTF-8 string to keycodes, calling callback for each
  * Returns number of characters processed
@@ -0,0 +1,255 @@
+#include "layout_pack.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "layout_pack";
+
+// Layout pack layout (see tools/gen_layouts.py)
+#define PACK_MAGIC      0x4B504C4B  // "KLPK"
+#define PACK_VERSION    1
+#define PACK_PARTITION  "layouts"
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t size;          // Whole pack including this header
+    uint32_t crc;           // CRC32 of everything after the header
+} pack_header_t;
+
+typedef struct __attribute__((packed)) {
+    char code[8];
+    char name[24];
+    uint8_t hid_country;
+    uint8_t reserved;
+    uint16_t ext_count;
+    uint16_t seq_count;
+    uint16_t alt_count;     // Reserved (0) in packs without alternatives
+    uint32_t offset;        // From the start of the pack, 4-byte aligned
+    uint32_t length;
+} pack_entry_t;
+
+// Table offsets within one layout's data
+#define ALIGN4(n)               (((n) + 3) & ~3u)
+#define OFF_SEED                (128 * sizeof(uint16_t))
+#define OFF_CP(n)               ALIGN4(OFF_SEED + (n) * sizeof(uint16_t))
+#define OFF_KEY(n)              (OFF_CP(n) + (n) * sizeof(uint32_t))
+#define OFF_SEQ(n)              ALIGN4(OFF_KEY(n) + (n) * sizeof(uint16_t))
+#define OFF_ALT_CP(n, seqs)     ALIGN4(OFF_SEQ(n) + (seqs) * LAYOUT_SEQ_MAX * sizeof(uint16_t))
+#define OFF_ALT(n, seqs, alts)  (OFF_ALT_CP(n, seqs) + (alts) * sizeof(uint32_t))
+#define DATA_SIZE(n, seqs, alts) \
+    (OFF_ALT(n, seqs, alts) + (alts) * LAYOUT_ALT_MAX * sizeof(uint16_t))
+
+static const esp_partition_t *s_partition = NULL;
+static const uint8_t *s_pack = NULL;            // Mapped pack (flash, read-only)
+static esp_partition_mmap_handle_t s_pack_handle;
+
+static const pack_entry_t *pack_entries(const uint8_t *pack)
+{
+    return (const pack_entry_t *)(pack + sizeof(pack_header_t));
+}
+
+static layout_table_t entry_table(const uint8_t *pack, const pack_entry_t *e)
+{
+    const uint8_t *data = pack + e->offset;
+    uint16_t n = e->ext_count;
+    layout_table_t t = {
+        .ascii = (const uint16_t *)data,
+        .ext_count = n,
+        .seq_count = e->seq_count,
+        .ext_seed = (const uint16_t *)(data + OFF_SEED),
+        .ext_cp = (const uint32_t *)(data + OFF_CP(n)),
+        .ext_key = (const uint16_t *)(data + OFF_KEY(n)),
+        .seq = (const uint16_t (*)[LAYOUT_SEQ_MAX])(data + OFF_SEQ(n)),
+        .alt_count = e->alt_count,
+        .alt_cp = (const uint32_t *)(data + OFF_ALT_CP(n, e->seq_count)),
+        .alt = (const uint16_t (*)[LAYOUT_ALT_MAX])(data + OFF_ALT(n, e->seq_count, e->alt_count)),
+    };
+    // The bitmap is not stored in the pack
+    for (int i = 0; i < t.alt_count && t.alt_cp[i] < 128; i++) {
+        t.alt_ascii[t.alt_cp[i] / 32] |= 1u << (t.alt_cp[i] % 32);
+    }
+    return t;
+}
+
+// Entries may only name a key or an existing sequence
+static bool entry_valid(uint16_t entry, uint16_t seq_count)
+{
+    return !LAYOUT_ENTRY_IS_SEQ(entry) || LAYOUT_ENTRY_SEQ(entry) < seq_count;
+}
+
+static bool table_valid(const layout_table_t *t)
+{
+    for (int i = 0; i < 128; i++) {
+        if (!entry_valid(t->ascii[i], t->seq_count)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < t->ext_count; i++) {
+        if (!entry_valid(t->ext_key[i], t->seq_count)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < t->alt_count; i++) {
+        if (i > 0 && t->alt_cp[i] <= t->alt_cp[i - 1]) {
+            return false;   // Not ascending
+        }
+        for (int k = 0; k < LAYOUT_ALT_MAX; k++) {
+            if (!entry_valid(t->alt[i][k], t->seq_count)) {
+                return false;
+            }
+        }
+    }
+    for (int i = 0; i < t->seq_count; i++) {
+        if (t->seq[i][0] == 0) {
+            return false;   // Empty sequence
+        }
+        for (int k = 0; k < LAYOUT_SEQ_MAX; k++) {
+            if (LAYOUT_ENTRY_IS_SEQ(t->seq[i][k])) {
+                return false;   // Sequences hold plain keystrokes only
+            }
+        }
+    }
+    return true;
+}
+
+esp_err_t layout_pack_validate(const uint8_t *pack, size_t size)
+{
+    const pack_header_t *hdr = (const pack_header_t *)pack;
+    if (size < sizeof(pack_header_t) || hdr->magic != PACK_MAGIC) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (hdr->version != PACK_VERSION || hdr->size != size ||
+        sizeof(pack_header_t) + hdr->count * sizeof(pack_entry_t) > size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (esp_rom_crc32_le(0, pack + sizeof(pack_header_t), size - sizeof(pack_header_t)) != hdr->crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    const pack_entry_t *entries = pack_entries(pack);
+    for (int i = 0; i < hdr->count; i++) {
+        const pack_entry_t *e = &entries[i];
+        if ((e->offset & 3) != 0 || e->offset > size || e->length > size - e->offset ||
+            e->length < DATA_SIZE(e->ext_count, e->seq_count, e->alt_count) ||
+            memchr(e->code, '\0', sizeof(e->code)) == NULL || e->code[0] == '\0' ||
+            memchr(e->name, '\0', sizeof(e->name)) == NULL) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        layout_table_t t = entry_table(pack, e);
+        if (!table_valid(&t)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+static void pack_unmap(void)
+{
+    if (s_pack != NULL) {
+        esp_partition_munmap(s_pack_handle);
+        s_pack = NULL;
+    }
+}
+
+static esp_err_t pack_map(void)
+{
+    pack_unmap();
+
+    pack_header_t hdr;
+    esp_err_t ret = esp_partition_read(s_partition, 0, &hdr, sizeof(hdr));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (hdr.magic != PACK_MAGIC) {
+        return ESP_OK;  // Erased or never written
+    }
+    if (hdr.size < sizeof(hdr) || hdr.size > s_partition->size) {
+        ESP_LOGW(TAG, "Layout pack is damaged");
+        return ESP_OK;
+    }
+
+    const void *ptr;
+    ret = esp_partition_mmap(s_partition, 0, hdr.size, ESP_PARTITION_MMAP_DATA, &ptr, &s_pack_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "mmap failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = layout_pack_validate(ptr, hdr.size);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Layout pack is damaged: %s", esp_err_to_name(ret));
+        esp_partition_munmap(s_pack_handle);
+        return ESP_OK;
+    }
+
+    s_pack = ptr;
+    ESP_LOGI(TAG, "Layout pack mapped: %d layouts, %" PRIu32 " bytes", hdr.count, hdr.size);
+    return ESP_OK;
+}
+
+esp_err_t layout_pack_init(void)
+{
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PACK_PARTITION);
+    if (s_partition == NULL) {
+        ESP_LOGW(TAG, "No '%s' partition, built-in layouts only", PACK_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    return pack_map();
+}
+
+int layout_pack_count(void)
+{
+    return s_pack != NULL ? ((const pack_header_t *)s_pack)->count : 0;
+}
+
+bool layout_pack_get(int index, layout_pack_layout_t *layout)
+{
+    if (index < 0 || index >= layout_pack_count()) {
+        return false;
+    }
+    const pack_entry_t *e = &pack_entries(s_pack)[index];
+    layout->code = e->code;
+    layout->name = e->name;
+    layout->hid_country = e->hid_country;
+    layout->table = entry_table(s_pack, e);
+    return true;
+}
+
+esp_err_t layout_pack_write(const uint8_t *data, size_t len)
+{
+    if (s_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (len > s_partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pack_unmap();
+
+    size_t erase_len = (len + s_partition->erase_size - 1) & ~(s_partition->erase_size - 1);
+    esp_err_t ret = esp_partition_erase_range(s_partition, 0, erase_len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // Magic last: an interrupted write leaves an empty pack, not a damaged one
+    ret = esp_partition_write(s_partition, sizeof(uint32_t), data + sizeof(uint32_t),
+                              len - sizeof(uint32_t));
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(s_partition, 0, data, sizeof(uint32_t));
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = pack_map();
+    if (ret == ESP_OK && s_pack == NULL) {
+        ret = ESP_ERR_INVALID_CRC;  // Did not read back intact
+    }
+    return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef LAYOUT_PACK_H
+#define LAYOUT_PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "layout_tables.h"
+
+/**
+ * Layout pack in the "layouts" partition (tools/gen_layouts.py --pack)
+ *
+ * The pack is memory-mapped; its tables are used in place, so lookups
+ * into a packed layout cost the same as into a built-in one.
+ */
+
+/**
+ * One layout in the pack (pointers into mapped flash)
+ */
+typedef struct {
+    const char *code;
+    const char *name;
+    uint8_t hid_country;
+    layout_table_t table;
+} layout_pack_layout_t;
+
+/**
+ * Map the pack from the "layouts" partition (if present)
+ * @return ESP_ERR_NOT_FOUND without the partition; an empty or damaged
+ *         pack is not an error (no layouts)
+ */
+esp_err_t layout_pack_init(void);
+
+/**
+ * Number of layouts in the mapped pack
+ */
+int layout_pack_count(void);
+
+/**
+ * Get a layout from the pack
+ * @return false if index is out of range
+ */
+bool layout_pack_get(int index, layout_pack_layout_t *layout);
+
+/**
+ * Check a pack image: CRC, bounds and every table entry
+ */
+esp_err_t layout_pack_validate(const uint8_t *data, size_t len);
+
+/**
+ * Write a validated pack to the partition and remap it
+ * Invalidates everything returned by layout_pack_get(); the caller must
+ * make sure no lookup is running.
+ */
+esp_err_t layout_pack_write(const uint8_t *data, size_t len);
+
+#endif // LAYOUT_PACK_H
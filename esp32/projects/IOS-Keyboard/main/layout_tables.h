@@ -0,0 +1,44 @@
+#ifndef LAYOUT_TABLES_H
+#define LAYOUT_TABLES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "keyboard_layout.h"
+
+/**
+ * Compiled keyboard layout
+ *
+ * Built-in layouts are generated at build time by tools/gen_layouts.py from
+ * main/layouts/<code>.layout (layout_tables.c in the build directory);
+ * layouts from a layout pack point into the mapped "layouts" partition.
+ *
+ * Entries are keycode | modifiers << 8, 0 for unmapped. An entry with
+ * keycode 0 and a non-zero high byte n is a key sequence: seq[n - 1].
+ * ascii/ext hold the primary path of each character; characters that can
+ * also be typed another way (keypad, a second key, a dead key) are listed
+ * in alt_cp with up to LAYOUT_ALT_MAX more entries each.
+ */
+#define LAYOUT_SEQ_MAX 4        // Keystrokes per sequence (unused tail is 0)
+#define LAYOUT_ALT_MAX 3        // Alternatives per character (unused tail is 0)
+
+typedef struct {
+    const uint16_t *ascii;      // [128], indexed by codepoint
+    uint16_t ext_count;         // Non-ASCII characters (hash slots)
+    uint16_t seq_count;
+    const uint16_t *ext_seed;   // [ext_count] displacement per hash bucket
+    const uint32_t *ext_cp;     // [ext_count] codepoint held by each slot
+    const uint16_t *ext_key;    // [ext_count]
+    const uint16_t (*seq)[LAYOUT_SEQ_MAX];
+    uint16_t alt_count;
+    uint32_t alt_ascii[4];      // Bitmap: ASCII codepoints listed in alt_cp
+    const uint32_t *alt_cp;     // [alt_count] ascending
+    const uint16_t (*alt)[LAYOUT_ALT_MAX];
+} layout_table_t;
+
+#define LAYOUT_ENTRY_IS_SEQ(e)  (((e) & 0xFF) == 0 && (e) != 0)
+#define LAYOUT_ENTRY_SEQ(e)     (((e) >> 8) - 1)
+
+extern const keyboard_layout_info_t layout_table_info[LAYOUT_COUNT];
+extern const layout_table_t layout_tables[LAYOUT_COUNT];
+
+#endif // LAYOUT_TABLES_H
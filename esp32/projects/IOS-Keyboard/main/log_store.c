@@ -0,0 +1,378 @@
+#include "log_store.h"
+#include "config.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static const char *TAG = "log_store";
+
+#define LOG_PARTITION       "logs"
+#define SEG_MAGIC           0x474C534B  // "KSLG"
+#define STAGE_MAGIC         0x53544731  // "1GTS"
+#define REC_END             0xFFFF      // Erased length field: no more records
+
+// Segment = one erase sector; header, then records up to the end
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t seq;           // +1 per segment, never reused
+    uint32_t boot;          // Boot the lines belong to
+    uint32_t erases;        // Times the store erased this sector
+} seg_header_t;
+
+// Record, 4-byte aligned; text follows. The body is written before the
+// header, so a record torn by power loss still reads as erased.
+typedef struct __attribute__((packed)) {
+    uint32_t uptime_ms;
+    uint16_t len;
+    uint16_t reserved;
+} rec_header_t;
+
+#define REC_SIZE(len)   ((sizeof(rec_header_t) + (len) + 3) & ~3u)
+
+// Staged records in flash format. Kept in no-init RAM, so lines still
+// staged at a panic or watchdog reset are written on the next boot.
+typedef struct {
+    uint32_t magic;
+    uint32_t boot;
+    uint32_t len;
+    uint32_t crc;           // CRC32 of magic, boot and len
+    uint8_t data[CONFIG_LOG_STORE_STAGE_SIZE];
+} stage_t;
+
+static __NOINIT_ATTR stage_t s_stage;
+static uint8_t s_flush_buf[CONFIG_LOG_STORE_STAGE_SIZE];
+static portMUX_TYPE s_stage_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// CRC the stage header should carry
+static uint32_t stage_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&s_stage, offsetof(stage_t, crc));
+}
+
+// Change the staged length (s_stage_lock held, or init)
+static void stage_set_len(uint32_t len)
+{
+    s_stage.len = len;
+    s_stage.crc = stage_crc();
+}
+
+static const esp_partition_t *s_partition = NULL;
+static SemaphoreHandle_t s_flush_mutex = NULL;
+static TaskHandle_t s_writer = NULL;
+static uint32_t s_seg_size = 0;
+static uint32_t s_seg_count = 0;
+static uint32_t s_segments_used = 0;
+static uint32_t s_boot = 0;
+
+// Segment being written (s_head_off == 0: none yet this boot)
+static uint32_t s_head = 0;
+static uint32_t s_head_seq = 0;
+static uint32_t s_head_boot = 0;
+static uint32_t s_head_erases = 0;
+static uint32_t s_head_off = 0;
+
+static uint32_t s_dropped = 0;
+static uint32_t s_written = 0;
+
+// Erase the next sector in the ring and start a segment there (flush mutex held)
+static esp_err_t rotate(uint32_t boot)
+{
+    uint32_t next = (s_head_off == 0 && s_head_seq == 0) ? s_head : (s_head + 1) % s_seg_count;
+    uint32_t addr = next * s_seg_size;
+
+    seg_header_t old;
+    uint32_t erases = 0;
+    if (esp_partition_read(s_partition, addr, &old, sizeof(old)) == ESP_OK && old.magic == SEG_MAGIC) {
+        erases = old.erases;
+    } else {
+        s_segments_used++;
+    }
+
+    esp_err_t err = esp_partition_erase_range(s_partition, addr, s_seg_size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    seg_header_t hdr = {
+        .magic = SEG_MAGIC,
+        .seq = s_head_seq + 1,
+        .boot = boot,
+        .erases = erases + 1,
+    };
+    err = esp_partition_write(s_partition, addr, &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    s_head = next;
+    s_head_seq = hdr.seq;
+    s_head_boot = boot;
+    s_head_erases = hdr.erases;
+    s_head_off = sizeof(hdr);
+    return ESP_OK;
+}
+
+// Write staged records for one boot (flush mutex held). Stops at the
+// first record that does not look like one log_store_append made, since
+// a stage replayed after a reset may hold stale RAM.
+static esp_err_t write_records(const uint8_t *data, size_t len, uint32_t boot)
+{
+    size_t pos = 0;
+    while (pos + sizeof(rec_header_t) <= len) {
+        const rec_header_t *rec = (const rec_header_t *)(data + pos);
+        size_t size = REC_SIZE(rec->len);
+        if (rec->len == 0 || rec->len > CONFIG_LOG_STORE_MAX_LINE || rec->reserved != 0xFFFF ||
+            pos + size > len) {
+            ESP_LOGW(TAG, "Bad staged record at %u, %u bytes skipped", (unsigned)pos, (unsigned)(len - pos));
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        if (s_head_off == 0 || s_head_boot != boot || s_head_off + size > s_seg_size) {
+            esp_err_t err = rotate(boot);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+
+        uint32_t addr = s_head * s_seg_size + s_head_off;
+        esp_err_t err = esp_partition_write(s_partition, addr + sizeof(rec_header_t),
+                                            data + pos + sizeof(rec_header_t), size - sizeof(rec_header_t));
+        if (err == ESP_OK) {
+            err = esp_partition_write(s_partition, addr, rec, sizeof(rec_header_t));
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        s_head_off += size;
+        s_written++;
+        pos += size;
+    }
+    return ESP_OK;
+}
+
+void log_store_flush(void)
+{
+    if (s_partition == NULL ||
+        xSemaphoreTake(s_flush_mutex, pdMS_TO_TICKS(CONFIG_LOG_STORE_FLUSH_MS)) != pdTRUE) {
+        return;
+    }
+
+    // Copy out, write, then release: a reset mid-write replays rather than loses
+    taskENTER_CRITICAL(&s_stage_lock);
+    size_t len = s_stage.len;
+    memcpy(s_flush_buf, s_stage.data, len);
+    taskEXIT_CRITICAL(&s_stage_lock);
+
+    if (len > 0) {
+        esp_err_t err = write_records(s_flush_buf, len, s_boot);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Flash write failed: %s", esp_err_to_name(err));
+        }
+
+        taskENTER_CRITICAL(&s_stage_lock);
+        memmove(s_stage.data, s_stage.data + len, s_stage.len - len);
+        stage_set_len(s_stage.len - len);
+        taskEXIT_CRITICAL(&s_stage_lock);
+    }
+    xSemaphoreGive(s_flush_mutex);
+}
+
+void log_store_append(const char *text, size_t len)
+{
+    if (s_partition == NULL || len == 0) {
+        return;
+    }
+    if (len > CONFIG_LOG_STORE_MAX_LINE) {
+        len = CONFIG_LOG_STORE_MAX_LINE;
+    }
+
+    rec_header_t rec = {
+        .uptime_ms = (uint32_t)(esp_timer_get_time() / 1000),
+        .len = len,
+        .reserved = 0xFFFF,
+    };
+    size_t size = REC_SIZE(len);
+    bool wake = false;
+
+    taskENTER_CRITICAL(&s_stage_lock);
+    if (s_stage.len + size > sizeof(s_stage.data)) {
+        s_dropped++;
+    } else {
+        uint8_t *p = s_stage.data + s_stage.len;
+        memcpy(p, &rec, sizeof(rec));
+        memcpy(p + sizeof(rec), text, len);
+        memset(p + sizeof(rec) + len, 0xFF, size - sizeof(rec) - len);
+        stage_set_len(s_stage.len + size);
+        wake = s_stage.len > sizeof(s_stage.data) / 2;
+    }
+    taskEXIT_CRITICAL(&s_stage_lock);
+
+    if (wake && s_writer != NULL) {
+        xTaskNotifyGive(s_writer);
+    }
+}
+
+static void writer_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_LOG_STORE_FLUSH_MS));
+        log_store_flush();
+    }
+}
+
+esp_err_t log_store_init(void)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                           ESP_PARTITION_SUBTYPE_ANY, LOG_PARTITION);
+    if (part == NULL) {
+        ESP_LOGW(TAG, "No '%s' partition, flash log disabled", LOG_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_seg_size = part->erase_size;
+    s_seg_count = part->size / s_seg_size;
+
+    // Newest segment is the head; highest boot number seen is the last run
+    seg_header_t hdr;
+    uint32_t last_boot = 0;
+    for (uint32_t i = 0; i < s_seg_count; i++) {
+        if (esp_partition_read(part, i * s_seg_size, &hdr, sizeof(hdr)) != ESP_OK ||
+            hdr.magic != SEG_MAGIC) {
+            continue;
+        }
+        s_segments_used++;
+        if (hdr.seq > s_head_seq) {
+            s_head = i;
+            s_head_seq = hdr.seq;
+            s_head_boot = hdr.boot;
+            s_head_erases = hdr.erases;
+        }
+        if (hdr.boot > last_boot) {
+            last_boot = hdr.boot;
+        }
+    }
+    s_head_off = 0;     // Never append to a previous boot's segment
+
+    s_flush_mutex = xSemaphoreCreateMutex();
+    if (s_flush_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_partition = part;
+
+    // Lines staged before a crash or watchdog reset belong to the previous boot
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool stage_valid = s_stage.magic == STAGE_MAGIC && s_stage.crc == stage_crc() &&
+                       s_stage.len <= sizeof(s_stage.data) &&
+                       reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT;
+    if (stage_valid && s_stage.len > 0) {
+        if (s_stage.boot > last_boot) {
+            last_boot = s_stage.boot;
+        }
+        xSemaphoreTake(s_flush_mutex, portMAX_DELAY);
+        esp_err_t err = write_records(s_stage.data, s_stage.len, s_stage.boot);
+        s_head_off = 0;
+        xSemaphoreGive(s_flush_mutex);
+        ESP_LOGI(TAG, "Recovered %" PRIu32 " staged bytes from boot %" PRIu32 " (%s)",
+                 s_stage.len, s_stage.boot, esp_err_to_name(err));
+    }
+
+    s_boot = last_boot + 1;
+    s_stage.magic = STAGE_MAGIC;
+    s_stage.boot = s_boot;
+    stage_set_len(0);
+
+    if (xTaskCreate(writer_task, "log_store", 3072, NULL, tskIDLE_PRIORITY + 1, &s_writer) != pdPASS) {
+        s_partition = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    esp_register_shutdown_handler(log_store_flush);
+
+    ESP_LOGI(TAG, "Flash log: boot %" PRIu32 ", %" PRIu32 "/%" PRIu32 " segments used",
+             s_boot, s_segments_used, s_seg_count);
+    return ESP_OK;
+}
+
+// Read one record of the segment with sequence number seq, under the flush
+// mutex so the writer cannot erase the sector mid-read. False at the end of
+// the segment, or if the sector has been recycled since the walk began.
+static bool read_record(uint32_t base, uint32_t seq, uint32_t off, rec_header_t *rec, char *text)
+{
+    if (off + sizeof(rec_header_t) > s_seg_size) {
+        return false;
+    }
+
+    xSemaphoreTake(s_flush_mutex, portMAX_DELAY);
+    seg_header_t hdr;
+    bool ok = esp_partition_read(s_partition, base, &hdr, sizeof(hdr)) == ESP_OK &&
+              hdr.magic == SEG_MAGIC && hdr.seq == seq &&
+              esp_partition_read(s_partition, base + off, rec, sizeof(*rec)) == ESP_OK &&
+              rec->len != REC_END && rec->len <= CONFIG_LOG_STORE_MAX_LINE &&
+              off + REC_SIZE(rec->len) <= s_seg_size &&
+              esp_partition_read(s_partition, base + off + sizeof(*rec), text, rec->len) == ESP_OK;
+    xSemaphoreGive(s_flush_mutex);
+    return ok;
+}
+
+esp_err_t log_store_read(log_store_line_cb_t cb, void *ctx)
+{
+    if (s_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char text[CONFIG_LOG_STORE_MAX_LINE];
+    xSemaphoreTake(s_flush_mutex, portMAX_DELAY);
+    uint32_t head = s_head;
+    uint32_t head_seq = s_head_seq;
+    xSemaphoreGive(s_flush_mutex);
+
+    // The ring is written in order, so the sector after the head is the
+    // oldest. Segments started after the snapshot replaced old ones; they
+    // are skipped and the walk ends at the head it began with.
+    for (uint32_t n = 1; n <= s_seg_count; n++) {
+        uint32_t base = ((head + n) % s_seg_count) * s_seg_size;
+        seg_header_t hdr;
+        xSemaphoreTake(s_flush_mutex, portMAX_DELAY);
+        esp_err_t err = esp_partition_read(s_partition, base, &hdr, sizeof(hdr));
+        xSemaphoreGive(s_flush_mutex);
+        if (err != ESP_OK || hdr.magic != SEG_MAGIC || hdr.seq > head_seq) {
+            continue;
+        }
+
+        uint32_t off = sizeof(hdr);
+        rec_header_t rec;
+        while (read_record(base, hdr.seq, off, &rec, text)) {
+            log_store_line_t line = {
+                .boot = hdr.boot,
+                .uptime_ms = rec.uptime_ms,
+                .text = text,
+                .len = rec.len,
+            };
+            cb(&line, ctx);     // Outside the mutex: may block on the network
+            off += REC_SIZE(rec.len);
+        }
+    }
+    return ESP_OK;
+}
+
+void log_store_get_status(log_store_status_t *status)
+{
+    status->enabled = s_partition != NULL;
+    status->boot = s_boot;
+    status->segments = s_seg_count;
+    status->segments_used = s_segments_used;
+    status->head_seq = s_head_seq;
+    status->head_erases = s_head_erases;
+    taskENTER_CRITICAL(&s_stage_lock);
+    status->staged = s_stage.len;
+    status->dropped = s_dropped;
+    taskEXIT_CRITICAL(&s_stage_lock);
+    status->written = s_written;
+}
@@ -0,0 +1,74 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Persistent log history in the "logs" flash partition
+ *
+ * Lines are staged in RAM and written by a background task in batches,
+ * so callers never wait for flash. The partition is a ring of one-sector
+ * segments used strictly in order (each sector is erased once per lap),
+ * and every boot starts a new segment.
+ */
+
+/**
+ * Log store state
+ */
+typedef struct {
+    bool enabled;           // Partition found and mounted
+    uint32_t boot;          // Boot number of this run (counts from 1)
+    uint32_t segments;      // Segments in the partition
+    uint32_t segments_used; // Segments holding data
+    uint32_t head_seq;      // Sequence of the segment being written
+    uint32_t head_erases;   // Erase count of that segment
+    uint32_t staged;        // Bytes waiting in RAM
+    uint32_t dropped;       // Lines lost because the staging buffer was full
+    uint32_t written;       // Lines written to flash since boot
+} log_store_status_t;
+
+/**
+ * One stored line
+ */
+typedef struct {
+    uint32_t boot;
+    uint32_t uptime_ms;
+    const char *text;       // Not NUL terminated
+    size_t len;
+} log_store_line_t;
+
+typedef void (*log_store_line_cb_t)(const log_store_line_t *line, void *ctx);
+
+/**
+ * Find the partition, locate the newest segment and start the writer task
+ * @return ESP_ERR_NOT_FOUND without a "logs" partition (appends are ignored)
+ */
+esp_err_t log_store_init(void);
+
+/**
+ * Stage a line for flash (never blocks; drops the line if staging is full)
+ */
+void log_store_append(const char *text, size_t len);
+
+/**
+ * Write staged lines now (also runs from the esp_restart shutdown hook)
+ */
+void log_store_flush(void);
+
+/**
+ * Read every stored line, oldest first
+ * Runs on the caller's task; the writer may append meanwhile. Each
+ * record is read under the writer's lock, and segments recycled during
+ * the walk are skipped rather than read half-erased.
+ */
+esp_err_t log_store_read(log_store_line_cb_t cb, void *ctx);
+
+/**
+ * Get store state
+ */
+void log_store_get_status(log_store_status_t *status);
+
+#endif // LOG_STORE_H
@@ -11,6 +11,12 @@
 #include "debug_server.h"
 #include "ota_handler.h"
 #include "keyboard_layout.h"
+#include "deferred_log.h"
+#include "web_assets.h"
+#include "ingest.h"
+#include "log_store.h"
+#include "settings.h"
+#include "host_os.h"
 #if CONFIG_ENABLE_HID
 #include "usb_hid.h"
 #endif
@@ -21,6 +27,17 @@
 
 static const char *TAG = "main";
 
+#if CONFIG_ENABLE_BLE
+// BLE writes are queued on the ingest bus; the HID engine task runs them.
+// A full queue holds back the write response (the phone waits for it
+// before the next chunk); if it stays full the write is rejected.
+static esp_err_t ble_rx(const uint8_t *data, size_t len)
+{
+    return ingest_submit(INGEST_SRC_BLE, data, len, pdMS_TO_TICKS(CONFIG_BLE_RX_WAIT_MS),
+                         NULL, NULL, 0);
+}
+#endif
+
 static void start_mdns(void)
 {
     esp_err_t err = mdns_init();
@@ -49,14 +66,30 @@ void app_main(void)
 #endif
     ESP_LOGI(TAG, "=================================");
 
+    // Start deferred logging first so hot paths never block on the console
+    ESP_ERROR_CHECK(deferred_log_init());
+
+    // Flash log history (also writes lines staged before a crash)
+    log_store_init();
+
+    // NVS and the settings cache; every module below reads its settings
+    // from RAM
+    ESP_ERROR_CHECK(settings_init());
+
     // Initialize OTA handler
     ESP_ERROR_CHECK(ota_handler_init());
 
-    // Initialize keyboard layout (loads from NVS)
+    // Initialize keyboard layout (restores the saved layout)
     ESP_ERROR_CHECK(keyboard_layout_init());
     const keyboard_layout_info_t *layout = keyboard_layout_get_info(keyboard_layout_get());
     ESP_LOGI(TAG, "Keyboard layout: %s", layout ? layout->name : "Unknown");
 
+    // USB host detection (saved override; the guess follows at enumeration)
+    ESP_ERROR_CHECK(host_os_init());
+
+    // Map the web UI asset pack (falls back to embedded assets)
+    web_assets_init();
+
     // Initialize WiFi manager
     ESP_ERROR_CHECK(wifi_manager_init());
 
@@ -94,6 +127,7 @@ void app_main(void)
             } else {
                 ESP_LOGI(TAG, "HID keyboard enabled");
                 debug_server_log("HID keyboard enabled");
+                ESP_ERROR_CHECK(ingest_init());
             }
 
 #else
@@ -108,7 +142,7 @@ void app_main(void)
             esp_err_t ble_err = ble_gatt_init();
             if (ble_err == ESP_OK) {
                 command_parser_init();
-                ble_gatt_set_rx_callback(command_parser_process);
+                ble_gatt_set_rx_callback(ble_rx);
                 ble_err = ble_gatt_start();
             }
             if (ble_err == ESP_OK) {
@@ -0,0 +1,178 @@
+#include "metrics.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+// Bucket upper bounds (us). Last bucket catches everything above.
+static const uint32_t s_bucket_bounds_us[METRICS_BUCKET_COUNT] = {
+    250, 500, 1000, 2000, 5000, 10000, 20000, 50000,
+    100000, 200000, 500000, 1000000, 2000000, 5000000, UINT32_MAX,
+};
+
+static const char *s_stage_names[METRIC_STAGE_COUNT] = {
+    [METRIC_STAGE_PARSE]        = "parse",
+    [METRIC_STAGE_ENQUEUE]      = "enqueue",
+    [METRIC_STAGE_FIRST_REPORT] = "first_report",
+    [METRIC_STAGE_LAST_ACK]     = "last_ack",
+};
+
+static metrics_histogram_t s_hist[METRIC_STAGE_COUNT];
+static uint32_t s_counters[METRIC_COUNTER_COUNT];
+
+// Command currently in flight (BLE commands are processed one at a time)
+static struct {
+    bool active;
+    bool ended;             // All reports issued
+    uint8_t stages_done;    // Bitmask of recorded stages
+    int64_t start_us;       // Transport receive time
+    uint32_t reports_sent;
+    uint32_t reports_acked;
+} s_cmd;
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Add a sample to a stage histogram (caller holds s_lock)
+static void hist_add(metrics_stage_t stage, uint32_t us)
+{
+    metrics_histogram_t *h = &s_hist[stage];
+    int b = 0;
+    while (b < METRICS_BUCKET_COUNT - 1 && us > s_bucket_bounds_us[b]) {
+        b++;
+    }
+    h->buckets[b]++;
+    h->count++;
+    h->sum_us += us;
+}
+
+// Record a stage for the in-flight command (caller holds s_lock)
+static void stage_locked(metrics_stage_t stage, int64_t now)
+{
+    if (!s_cmd.active || (s_cmd.stages_done & (1 << stage))) {
+        return;
+    }
+    s_cmd.stages_done |= 1 << stage;
+    hist_add(stage, (uint32_t)(now - s_cmd.start_us));
+}
+
+// Close the command once the host acknowledged every report (caller holds s_lock)
+static void try_finish_locked(int64_t now)
+{
+    if (s_cmd.active && s_cmd.ended && s_cmd.reports_acked >= s_cmd.reports_sent) {
+        if (s_cmd.reports_sent > 0) {
+            stage_locked(METRIC_STAGE_LAST_ACK, now);
+        }
+        s_cmd.active = false;
+    }
+}
+
+void metrics_cmd_received(int64_t received_us)
+{
+    portENTER_CRITICAL(&s_lock);
+    memset(&s_cmd, 0, sizeof(s_cmd));
+    s_cmd.active = true;
+    s_cmd.start_us = received_us;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_cmd_stage(metrics_stage_t stage)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    stage_locked(stage, now);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_cmd_end(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    s_cmd.ended = true;
+    try_finish_locked(now);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_report_sent(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    if (s_cmd.active) {
+        s_cmd.reports_sent++;
+        stage_locked(METRIC_STAGE_FIRST_REPORT, now);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_report_acked(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    if (s_cmd.active) {
+        s_cmd.reports_acked++;
+        try_finish_locked(now);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_inc(metrics_counter_t counter, uint32_t n)
+{
+    if (counter >= METRIC_COUNTER_COUNT) {
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    s_counters[counter] += n;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+uint32_t metrics_get_counter(metrics_counter_t counter)
+{
+    return counter < METRIC_COUNTER_COUNT ? s_counters[counter] : 0;
+}
+
+void metrics_get_histogram(metrics_stage_t stage, metrics_histogram_t *out)
+{
+    if (stage >= METRIC_STAGE_COUNT) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    portENTER_CRITICAL(&s_lock);
+    *out = s_hist[stage];
+    portEXIT_CRITICAL(&s_lock);
+}
+
+uint32_t metrics_bucket_bound_us(int bucket)
+{
+    if (bucket < 0 || bucket >= METRICS_BUCKET_COUNT) {
+        return UINT32_MAX;
+    }
+    return s_bucket_bounds_us[bucket];
+}
+
+uint32_t metrics_quantile_us(const metrics_histogram_t *hist, float q)
+{
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    float rank = q * hist->count;
+    uint32_t cumulative = 0;
+    for (int b = 0; b < METRICS_BUCKET_COUNT; b++) {
+        uint32_t n = hist->buckets[b];
+        if (n > 0 && cumulative + n >= rank) {
+            uint32_t lower = b > 0 ? s_bucket_bounds_us[b - 1] : 0;
+            if (b == METRICS_BUCKET_COUNT - 1) {
+                return lower;  // +Inf bucket: report its lower bound
+            }
+            uint32_t upper = s_bucket_bounds_us[b];
+            float frac = (rank - cumulative) / n;
+            return lower + (uint32_t)((upper - lower) * frac);
+        }
+        cumulative += n;
+    }
+    return s_bucket_bounds_us[METRICS_BUCKET_COUNT - 2];
+}
+
+const char *metrics_stage_name(metrics_stage_t stage)
+{
+    return stage < METRIC_STAGE_COUNT ? s_stage_names[stage] : "unknown";
+}
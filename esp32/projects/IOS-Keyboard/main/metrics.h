@@ -0,0 +1,102 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Pipeline stages, each measured from command receive (GATT write,
+ * WebSocket frame or HTTP submit)
+ */
+typedef enum {
+    METRIC_STAGE_PARSE,         // Command parsed
+    METRIC_STAGE_ENQUEUE,       // Handed to the HID engine
+    METRIC_STAGE_FIRST_REPORT,  // First HID report sent
+    METRIC_STAGE_LAST_ACK,      // Last HID report acknowledged by the host
+    METRIC_STAGE_COUNT
+} metrics_stage_t;
+
+/**
+ * Event counters
+ */
+typedef enum {
+    METRIC_COMMANDS,            // Commands processed
+    METRIC_CHARACTERS,          // Characters typed
+    METRIC_BACKSPACES,          // Backspace keystrokes sent
+    METRIC_DROPS,               // Commands dropped (malformed, HID not ready, send failure)
+    METRIC_UNMAPPED,            // Codepoints with no keycode in the current layout
+    METRIC_COUNTER_COUNT
+} metrics_counter_t;
+
+// Histogram bucket upper bounds in microseconds (last bucket is +Inf)
+#define METRICS_BUCKET_COUNT 15
+
+/**
+ * Snapshot of one stage latency histogram
+ */
+typedef struct {
+    uint32_t buckets[METRICS_BUCKET_COUNT];   // Non-cumulative counts
+    uint32_t count;
+    uint64_t sum_us;
+} metrics_histogram_t;
+
+/**
+ * Start tracking a command as the HID engine picks it up
+ * @param received_us esp_timer time the transport received it, so
+ *        time spent in the ingest queue counts towards every stage
+ */
+void metrics_cmd_received(int64_t received_us);
+
+/**
+ * Record that the current command reached a stage (first time only)
+ */
+void metrics_cmd_stage(metrics_stage_t stage);
+
+/**
+ * Record that the current command issued all of its HID reports
+ */
+void metrics_cmd_end(void);
+
+/**
+ * Record a HID report sent (called by usb_hid for every report)
+ */
+void metrics_report_sent(void);
+
+/**
+ * Record a HID report acknowledged by the host (TinyUSB complete callback)
+ */
+void metrics_report_acked(void);
+
+/**
+ * Increment an event counter
+ */
+void metrics_inc(metrics_counter_t counter, uint32_t n);
+
+/**
+ * Get counter value
+ */
+uint32_t metrics_get_counter(metrics_counter_t counter);
+
+/**
+ * Get a consistent copy of a stage histogram
+ */
+void metrics_get_histogram(metrics_stage_t stage, metrics_histogram_t *out);
+
+/**
+ * Upper bound of a histogram bucket in microseconds (UINT32_MAX for +Inf)
+ */
+uint32_t metrics_bucket_bound_us(int bucket);
+
+/**
+ * Estimate a quantile (0.0-1.0) from a histogram, in microseconds
+ * Interpolates linearly inside the bucket. Returns 0 for an empty histogram.
+ */
+uint32_t metrics_quantile_us(const metrics_histogram_t *hist, float q);
+
+/**
+ * Get stage name for display/labels (e.g. "parse")
+ */
+const char *metrics_stage_name(metrics_stage_t stage);
+
+#endif // METRICS_H
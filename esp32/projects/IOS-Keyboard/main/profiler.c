@@ -0,0 +1,145 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "profiler";
+
+static const struct {
+    const char *name;
+    uint32_t caps;
+} s_heap_caps[PROFILER_HEAP_CAPS] = {
+    { "internal", MALLOC_CAP_INTERNAL },
+    { "dma",      MALLOC_CAP_DMA },
+    { "spiram",   MALLOC_CAP_SPIRAM },
+    { "exec",     MALLOC_CAP_EXEC },
+};
+
+// Task run times and heap levels at the start of a span
+typedef struct {
+    bool valid;
+    int64_t time_us;
+    int count;
+    TaskHandle_t handles[CONFIG_PROFILE_MAX_TASKS];
+    uint64_t runtime[CONFIG_PROFILE_MAX_TASKS];
+    uint32_t heap_free[PROFILER_HEAP_CAPS];
+} baseline_t;
+
+static baseline_t s_mark;
+static baseline_t s_window;     // Start of a ?ms= sampling window
+static const baseline_t s_boot = { .valid = true };
+
+// Snapshot all tasks (caller frees); count is 0 on allocation failure
+static TaskStatus_t *snapshot_tasks(UBaseType_t *count)
+{
+    UBaseType_t max = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = malloc(max * sizeof(TaskStatus_t));
+    *count = tasks ? uxTaskGetSystemState(tasks, max, NULL) : 0;
+    return tasks;
+}
+
+static esp_err_t take_baseline(baseline_t *base)
+{
+    UBaseType_t count;
+    TaskStatus_t *tasks = snapshot_tasks(&count);
+    if (tasks == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    base->time_us = esp_timer_get_time();
+    base->count = count < CONFIG_PROFILE_MAX_TASKS ? count : CONFIG_PROFILE_MAX_TASKS;
+    for (int i = 0; i < base->count; i++) {
+        base->handles[i] = tasks[i].xHandle;
+        base->runtime[i] = tasks[i].ulRunTimeCounter;
+    }
+    for (int i = 0; i < PROFILER_HEAP_CAPS; i++) {
+        base->heap_free[i] = heap_caps_get_free_size(s_heap_caps[i].caps);
+    }
+    base->valid = true;
+    free(tasks);
+    return ESP_OK;
+}
+
+static uint64_t base_runtime(const baseline_t *base, TaskHandle_t handle)
+{
+    for (int i = 0; i < base->count; i++) {
+        if (base->handles[i] == handle) {
+            return base->runtime[i];
+        }
+    }
+    return 0;   // Task started within the span
+}
+
+esp_err_t profiler_mark(void)
+{
+    esp_err_t err = take_baseline(&s_mark);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Profile mark set");
+    }
+    return err;
+}
+
+esp_err_t profiler_collect(uint32_t window_ms, bool since_mark, profiler_report_t *out)
+{
+    const baseline_t *base = &s_boot;
+    if (window_ms > 0) {
+        esp_err_t err = take_baseline(&s_window);
+        if (err != ESP_OK) {
+            return err;
+        }
+        vTaskDelay(pdMS_TO_TICKS(window_ms));
+        base = &s_window;
+    } else if (since_mark) {
+        if (!s_mark.valid) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        base = &s_mark;
+    }
+
+    UBaseType_t count;
+    TaskStatus_t *tasks = snapshot_tasks(&count);
+    if (tasks == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    out->span_us = esp_timer_get_time() - base->time_us;
+    out->task_count = count < CONFIG_PROFILE_MAX_TASKS ? count : CONFIG_PROFILE_MAX_TASKS;
+    for (int i = 0; i < out->task_count; i++) {
+        profiler_task_t *t = &out->tasks[i];
+        strncpy(t->name, tasks[i].pcTaskName, sizeof(t->name) - 1);
+        t->name[sizeof(t->name) - 1] = '\0';
+        uint64_t start = base_runtime(base, tasks[i].xHandle);
+        t->runtime_us = tasks[i].ulRunTimeCounter >= start ? tasks[i].ulRunTimeCounter - start : 0;
+        t->stack_free = tasks[i].usStackHighWaterMark * sizeof(StackType_t);
+        t->priority = tasks[i].uxCurrentPriority;
+        BaseType_t core = xTaskGetCoreID(tasks[i].xHandle);
+        t->core = (core == tskNO_AFFINITY) ? -1 : core;
+        t->state = tasks[i].eCurrentState;
+    }
+    free(tasks);
+
+    out->heap_count = 0;
+    for (int i = 0; i < PROFILER_HEAP_CAPS; i++) {
+        uint32_t caps = s_heap_caps[i].caps;
+        if (heap_caps_get_total_size(caps) == 0) {
+            continue;   // No such memory on this board (e.g. no PSRAM)
+        }
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, caps);
+
+        profiler_heap_t *h = &out->heaps[out->heap_count++];
+        h->name = s_heap_caps[i].name;
+        h->caps = caps;
+        h->total = heap_caps_get_total_size(caps);
+        h->free = info.total_free_bytes;
+        h->free_delta = (base == &s_boot) ? 0 : (int32_t)(info.total_free_bytes - base->heap_free[i]);
+        h->largest_free = info.largest_free_block;
+        h->min_free = info.minimum_free_bytes;
+        h->fragmentation = info.total_free_bytes > 0 ?
+            100 - (uint8_t)((uint64_t)info.largest_free_block * 100 / info.total_free_bytes) : 0;
+    }
+    return ESP_OK;
+}
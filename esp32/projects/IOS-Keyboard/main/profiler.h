@@ -0,0 +1,66 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "config.h"
+
+/**
+ * One task over a profiling span
+ */
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint64_t runtime_us;        // CPU time spent in the span
+    uint32_t stack_free;        // Stack high-water mark (bytes never used, since task start)
+    uint8_t priority;
+    int8_t core;                // Pinned core, -1 if the task may run on any core
+    eTaskState state;
+} profiler_task_t;
+
+/**
+ * Heap statistics for one capability
+ */
+typedef struct {
+    const char *name;           // "internal", "dma", ...
+    uint32_t caps;
+    uint32_t total;
+    uint32_t free;
+    int32_t free_delta;         // Change in free bytes over the span
+    uint32_t largest_free;
+    uint32_t min_free;          // Lowest free since boot
+    uint8_t fragmentation;      // Percent of free memory outside the largest block
+} profiler_heap_t;
+
+#define PROFILER_HEAP_CAPS 4
+
+/**
+ * Result of a profiling span
+ */
+typedef struct {
+    uint64_t span_us;           // Wall time covered
+    int task_count;
+    profiler_task_t tasks[CONFIG_PROFILE_MAX_TASKS];
+    int heap_count;
+    profiler_heap_t heaps[PROFILER_HEAP_CAPS];
+} profiler_report_t;
+
+/**
+ * Record the current task run times and heap levels as the baseline
+ * for a later profiler_collect(..., true) (e.g. at dictation start).
+ */
+esp_err_t profiler_mark(void);
+
+/**
+ * Collect task and heap statistics
+ * @param window_ms >0: sample for this long (blocks the caller; one
+ *        window at a time, the baseline is shared)
+ * @param since_mark With window_ms 0: span starts at profiler_mark()
+ *        instead of boot
+ * @return ESP_ERR_INVALID_STATE if since_mark is set but no mark exists
+ */
+esp_err_t profiler_collect(uint32_t window_ms, bool since_mark, profiler_report_t *out);
+
+#endif // PROFILER_H
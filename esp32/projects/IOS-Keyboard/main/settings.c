@@ -0,0 +1,355 @@
+#include "settings.h"
+#include "config.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+static const char *TAG = "settings";
+
+typedef enum {
+    SETTING_TYPE_STR,
+    SETTING_TYPE_U8,
+    SETTING_TYPE_U32,
+} setting_type_t;
+
+typedef struct {
+    const char *key;        // NVS key (15 characters max)
+    setting_type_t type;
+    size_t size;            // Buffer size for strings, including the terminator
+} setting_def_t;
+
+// Order must match setting_id_t
+static const setting_def_t s_defs[SETTING_COUNT] = {
+    [SETTING_LAYOUT]        = { "kbd_code",           SETTING_TYPE_STR, 8 },
+    [SETTING_LAYOUT_LEGACY] = { "kbd_layout",         SETTING_TYPE_U8,  0 },
+    [SETTING_WIFI_SSID]     = { CONFIG_NVS_KEY_SSID,  SETTING_TYPE_STR, 33 },
+    [SETTING_WIFI_PASS]     = { CONFIG_NVS_KEY_PASS,  SETTING_TYPE_STR, 65 },
+    [SETTING_HOST_OS]       = { "host_os",            SETTING_TYPE_U8,  0 },
+    [SETTING_SPEED_UNKNOWN] = { "speed_unknown",      SETTING_TYPE_U32, 0 },
+    [SETTING_SPEED_WINDOWS] = { "speed_windows",      SETTING_TYPE_U32, 0 },
+    [SETTING_SPEED_MACOS]   = { "speed_macos",        SETTING_TYPE_U32, 0 },
+    [SETTING_SPEED_LINUX]   = { "speed_linux",        SETTING_TYPE_U32, 0 },
+    [SETTING_SPEED_BOOT]    = { "speed_boot",         SETTING_TYPE_U32, 0 },
+};
+
+typedef struct {
+    bool set;
+    bool dirty;             // Changed in RAM since the last commit
+    uint32_t num;
+    char str[SETTINGS_STR_MAX];
+} setting_value_t;
+
+// RAM copy; s_lock is held only while copying values in or out
+static setting_value_t s_values[SETTING_COUNT];
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static SemaphoreHandle_t s_flush_mutex = NULL;
+static TaskHandle_t s_writer = NULL;
+static settings_stats_t s_stats = {0};
+
+// Load one key into RAM (init only)
+static void load(nvs_handle_t nvs, setting_id_t id)
+{
+    const setting_def_t *def = &s_defs[id];
+    setting_value_t *v = &s_values[id];
+    esp_err_t err;
+
+    if (def->type == SETTING_TYPE_STR) {
+        size_t len = def->size;
+        err = nvs_get_str(nvs, def->key, v->str, &len);
+    } else if (def->type == SETTING_TYPE_U8) {
+        uint8_t u8 = 0;
+        err = nvs_get_u8(nvs, def->key, &u8);
+        v->num = u8;
+    } else {
+        err = nvs_get_u32(nvs, def->key, &v->num);
+    }
+
+    v->set = (err == ESP_OK);
+    if (!v->set) {
+        v->num = 0;
+        v->str[0] = '\0';
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Failed to read %s: %s", def->key, esp_err_to_name(err));
+        }
+    }
+}
+
+// Write one key to an open handle
+static esp_err_t store(nvs_handle_t nvs, setting_id_t id, const setting_value_t *v)
+{
+    const setting_def_t *def = &s_defs[id];
+
+    if (!v->set) {
+        esp_err_t err = nvs_erase_key(nvs, def->key);
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+    switch (def->type) {
+    case SETTING_TYPE_STR:
+        return nvs_set_str(nvs, def->key, v->str);
+    case SETTING_TYPE_U8:
+        return nvs_set_u8(nvs, def->key, (uint8_t)v->num);
+    default:
+        return nvs_set_u32(nvs, def->key, v->num);
+    }
+}
+
+void settings_flush(void)
+{
+    if (s_flush_mutex == NULL ||
+        xSemaphoreTake(s_flush_mutex, pdMS_TO_TICKS(CONFIG_SETTINGS_COMMIT_DELAY_MS)) != pdTRUE) {
+        return;
+    }
+
+    // Snapshot dirty keys and clear their flags; a change made during the
+    // write marks the key dirty again for the next commit
+    static setting_value_t snap[SETTING_COUNT];
+    bool dirty[SETTING_COUNT];
+    int count = 0;
+
+    taskENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        dirty[i] = s_values[i].dirty;
+        if (dirty[i]) {
+            snap[i] = s_values[i];
+            s_values[i].dirty = false;
+            count++;
+        }
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (count > 0) {
+        nvs_handle_t nvs;
+        esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+        if (err == ESP_OK) {
+            for (int i = 0; i < SETTING_COUNT && err == ESP_OK; i++) {
+                if (dirty[i]) {
+                    err = store(nvs, (setting_id_t)i, &snap[i]);
+                }
+            }
+            if (err == ESP_OK) {
+                err = nvs_commit(nvs);
+            }
+            nvs_close(nvs);
+        }
+
+        taskENTER_CRITICAL(&s_lock);
+        if (err == ESP_OK) {
+            s_stats.commits++;
+            s_stats.writes += count;
+        } else {
+            // Retry on the next commit
+            s_stats.errors++;
+            for (int i = 0; i < SETTING_COUNT; i++) {
+                if (dirty[i]) {
+                    s_values[i].dirty = true;
+                }
+            }
+        }
+        taskEXIT_CRITICAL(&s_lock);
+
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Commit failed: %s", esp_err_to_name(err));
+        }
+    }
+    xSemaphoreGive(s_flush_mutex);
+}
+
+static void writer_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Let a burst of changes land, then write them in one commit
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_SETTINGS_COMMIT_DELAY_MS));
+        ulTaskNotifyTake(pdTRUE, 0);
+        settings_flush();
+    }
+}
+
+// Mark a key changed (s_lock held); a change to a key still waiting for
+// its commit rides along with it
+static void mark_dirty(setting_value_t *v)
+{
+    if (v->dirty) {
+        s_stats.coalesced++;
+    }
+    v->dirty = true;
+}
+
+static void wake_writer(void)
+{
+    if (s_writer != NULL) {
+        xTaskNotifyGive(s_writer);
+    }
+}
+
+bool settings_has(setting_id_t id)
+{
+    return id < SETTING_COUNT && s_values[id].set;
+}
+
+esp_err_t settings_get_str(setting_id_t id, char *out, size_t size)
+{
+    if (id >= SETTING_COUNT || s_defs[id].type != SETTING_TYPE_STR || out == NULL || size == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&s_lock);
+    bool set = s_values[id].set;
+    strncpy(out, set ? s_values[id].str : "", size - 1);
+    out[size - 1] = '\0';
+    taskEXIT_CRITICAL(&s_lock);
+
+    return set ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t settings_get_u32(setting_id_t id, uint32_t *value)
+{
+    if (id >= SETTING_COUNT || s_defs[id].type == SETTING_TYPE_STR || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    taskENTER_CRITICAL(&s_lock);
+    bool set = s_values[id].set;
+    *value = set ? s_values[id].num : 0;
+    taskEXIT_CRITICAL(&s_lock);
+
+    return set ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t settings_set_str(setting_id_t id, const char *value)
+{
+    if (id >= SETTING_COUNT || s_defs[id].type != SETTING_TYPE_STR || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(value) >= s_defs[id].size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    bool changed = false;
+    taskENTER_CRITICAL(&s_lock);
+    setting_value_t *v = &s_values[id];
+    if (!v->set || strcmp(v->str, value) != 0) {
+        strcpy(v->str, value);  // Length checked above
+        v->set = true;
+        mark_dirty(v);
+        changed = true;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (changed) {
+        wake_writer();
+    }
+    return ESP_OK;
+}
+
+esp_err_t settings_set_u32(setting_id_t id, uint32_t value)
+{
+    if (id >= SETTING_COUNT || s_defs[id].type == SETTING_TYPE_STR) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_defs[id].type == SETTING_TYPE_U8 && value > UINT8_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    bool changed = false;
+    taskENTER_CRITICAL(&s_lock);
+    setting_value_t *v = &s_values[id];
+    if (!v->set || v->num != value) {
+        v->num = value;
+        v->set = true;
+        mark_dirty(v);
+        changed = true;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (changed) {
+        wake_writer();
+    }
+    return ESP_OK;
+}
+
+esp_err_t settings_erase(setting_id_t id)
+{
+    if (id >= SETTING_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool changed = false;
+    taskENTER_CRITICAL(&s_lock);
+    setting_value_t *v = &s_values[id];
+    if (v->set) {
+        v->set = false;
+        v->num = 0;
+        v->str[0] = '\0';
+        mark_dirty(v);
+        changed = true;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (changed) {
+        wake_writer();
+    }
+    return ESP_OK;
+}
+
+void settings_get_stats(settings_stats_t *stats)
+{
+    taskENTER_CRITICAL(&s_lock);
+    *stats = s_stats;
+    stats->pending = 0;
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        if (s_values[i].dirty) {
+            stats->pending++;
+        }
+    }
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+esp_err_t settings_init(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(TAG, "NVS partition was truncated, erasing...");
+        ret = nvs_flash_erase();
+        if (ret == ESP_OK) {
+            ret = nvs_flash_init();
+        }
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "NVS init failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // A missing namespace (first boot) just leaves every key unset
+    nvs_handle_t nvs;
+    if (nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        for (int i = 0; i < SETTING_COUNT; i++) {
+            load(nvs, (setting_id_t)i);
+        }
+        nvs_close(nvs);
+    }
+
+    s_flush_mutex = xSemaphoreCreateMutex();
+    if (s_flush_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(writer_task, "settings", 3072, NULL, tskIDLE_PRIORITY + 1, &s_writer) != pdPASS) {
+        ESP_LOGW(TAG, "Commit task not started, changes saved at restart only");
+    }
+    // Changes still waiting when esp_restart runs (portal save, OTA, reset)
+    esp_register_shutdown_handler(settings_flush);
+
+    int loaded = 0;
+    for (int i = 0; i < SETTING_COUNT; i++) {
+        loaded += s_values[i].set;
+    }
+    ESP_LOGI(TAG, "Loaded %d of %d settings", loaded, SETTING_COUNT);
+    return ESP_OK;
+}
@@ -0,0 +1,96 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Persistent settings, cached in RAM
+ *
+ * Every key is read from NVS once at boot; reads are served from RAM and
+ * writes only update RAM and mark the key dirty. A background task
+ * commits dirty keys in one NVS transaction after
+ * CONFIG_SETTINGS_COMMIT_DELAY_MS, so a burst of changes costs one commit
+ * and no caller ever waits for flash. Pending changes are also written by
+ * the esp_restart shutdown hook.
+ */
+
+typedef enum {
+    SETTING_LAYOUT,         // str: saved keyboard layout code
+    SETTING_LAYOUT_LEGACY,  // u8: built-in layout index (older firmware, read only)
+    SETTING_WIFI_SSID,      // str
+    SETTING_WIFI_PASS,      // str
+    SETTING_HOST_OS,        // u8: host_os_t override (unset: detect)
+    SETTING_SPEED_UNKNOWN,  // u32: calibrated speed per host_os_t (same order),
+    SETTING_SPEED_WINDOWS,  //      press_ms | release_ms << 16
+    SETTING_SPEED_MACOS,
+    SETTING_SPEED_LINUX,
+    SETTING_SPEED_BOOT,
+    SETTING_COUNT
+} setting_id_t;
+
+#define SETTINGS_STR_MAX 65     // Longest string value including the terminator
+
+/**
+ * Settings store statistics
+ */
+typedef struct {
+    uint32_t commits;       // NVS commits since boot
+    uint32_t writes;        // Keys written (a commit may carry several)
+    uint32_t coalesced;     // Changes merged into a later commit
+    uint32_t errors;        // Failed commits (retried)
+    uint32_t pending;       // Dirty keys now
+} settings_stats_t;
+
+/**
+ * Initialize NVS, load every key into RAM and start the commit task
+ * Must run before any other module reads a setting.
+ */
+esp_err_t settings_init(void);
+
+/**
+ * True if the key has a value
+ */
+bool settings_has(setting_id_t id);
+
+/**
+ * Copy a string setting
+ * @return ESP_ERR_NOT_FOUND if unset (out is then "")
+ */
+esp_err_t settings_get_str(setting_id_t id, char *out, size_t size);
+
+/**
+ * Get an integer setting
+ * @return ESP_ERR_NOT_FOUND if unset (*value is then 0)
+ */
+esp_err_t settings_get_u32(setting_id_t id, uint32_t *value);
+
+/**
+ * Change a string setting (RAM now, flash on the next commit)
+ * @return ESP_ERR_INVALID_SIZE if longer than SETTINGS_STR_MAX - 1
+ */
+esp_err_t settings_set_str(setting_id_t id, const char *value);
+
+/**
+ * Change an integer setting (RAM now, flash on the next commit)
+ */
+esp_err_t settings_set_u32(setting_id_t id, uint32_t value);
+
+/**
+ * Remove a setting (RAM now, flash on the next commit)
+ */
+esp_err_t settings_erase(setting_id_t id);
+
+/**
+ * Commit pending changes now (blocks on flash; for shutdown paths)
+ */
+void settings_flush(void);
+
+/**
+ * Get store statistics
+ */
+void settings_get_stats(settings_stats_t *stats);
+
+#endif // SETTINGS_H
@@ -0,0 +1,174 @@
+#include "trace_capture.h"
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "trace_cap";
+
+static const char *s_event_names[TC_EV_COUNT] = {
+    [TC_EV_GATT_RX]    = "gatt_rx",
+    [TC_EV_PARSE]      = "parse",
+    [TC_EV_LAYOUT]     = "layout",
+    [TC_EV_HID_REPORT] = "hid_report",
+    [TC_EV_TASK]       = "task",
+};
+
+// Buffer slot. phase is published last so readers skip half-written slots.
+typedef struct {
+    uint32_t ts_us;
+    void *task;
+    uint32_t arg;
+    uint8_t event;
+    uint8_t core;
+    atomic_uint_fast8_t phase;
+} tc_slot_t;
+
+// Written from the scheduler hook, so the buffer must be internal RAM
+static tc_slot_t *s_slots = NULL;
+static atomic_bool s_active = false;
+static atomic_uint_fast32_t s_next = 0;     // Next slot to reserve
+static int64_t s_start_us = 0;
+static uint32_t s_window_us = 0;
+static uint32_t s_duration_ms = 0;
+
+static IRAM_ATTR void record(tc_event_t event, uint8_t phase, void *task, uint32_t arg)
+{
+    if (!atomic_load_explicit(&s_active, memory_order_acquire)) {
+        return;
+    }
+
+    uint32_t now = (uint32_t)(esp_timer_get_time() - s_start_us);
+    if (now >= s_window_us) {
+        atomic_store_explicit(&s_active, false, memory_order_relaxed);
+        return;
+    }
+
+    // Past capacity the index keeps counting so the overflow can be reported
+    uint_fast32_t idx = atomic_fetch_add_explicit(&s_next, 1, memory_order_relaxed);
+    if (idx >= CONFIG_TRACE_CAPTURE_EVENTS) {
+        return;
+    }
+
+    tc_slot_t *slot = &s_slots[idx];
+    slot->ts_us = now;
+    slot->task = task;
+    slot->arg = arg;
+    slot->event = event;
+    slot->core = xPortGetCoreID();
+    atomic_store_explicit(&slot->phase, phase, memory_order_release);
+}
+
+void trace_capture_begin(tc_event_t event, uint32_t arg)
+{
+    record(event, TC_PH_BEGIN, xTaskGetCurrentTaskHandle(), arg);
+}
+
+void trace_capture_end(tc_event_t event, uint32_t arg)
+{
+    record(event, TC_PH_END, xTaskGetCurrentTaskHandle(), arg);
+}
+
+void trace_capture_async_begin(tc_event_t event, uint32_t id)
+{
+    record(event, TC_PH_ASYNC_BEGIN, xTaskGetCurrentTaskHandle(), id);
+}
+
+void trace_capture_async_end(tc_event_t event, uint32_t id)
+{
+    record(event, TC_PH_ASYNC_END, xTaskGetCurrentTaskHandle(), id);
+}
+
+IRAM_ATTR void trace_capture_task_switched_in(void)
+{
+    record(TC_EV_TASK, TC_PH_SWITCH, xTaskGetCurrentTaskHandle(), 0);
+}
+
+esp_err_t trace_capture_start(uint32_t duration_ms)
+{
+    if (s_slots == NULL) {
+        s_slots = heap_caps_calloc(CONFIG_TRACE_CAPTURE_EVENTS, sizeof(tc_slot_t),
+                                   MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (s_slots == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate %d capture records", CONFIG_TRACE_CAPTURE_EVENTS);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (duration_ms == 0 || duration_ms > CONFIG_TRACE_CAPTURE_MAX_MS) {
+        duration_ms = CONFIG_TRACE_CAPTURE_MAX_MS;
+    }
+
+    // Stop writers, then give any in-flight record() a tick to finish
+    atomic_store_explicit(&s_active, false, memory_order_release);
+    vTaskDelay(1);
+
+    for (uint32_t i = 0; i < CONFIG_TRACE_CAPTURE_EVENTS; i++) {
+        atomic_store_explicit(&s_slots[i].phase, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&s_next, 0, memory_order_relaxed);
+    s_duration_ms = duration_ms;
+    s_window_us = duration_ms * 1000;
+    s_start_us = esp_timer_get_time();
+    atomic_store_explicit(&s_active, true, memory_order_release);
+
+    ESP_LOGI(TAG, "Capture started (%" PRIu32 " ms, %d records)", duration_ms, CONFIG_TRACE_CAPTURE_EVENTS);
+    return ESP_OK;
+}
+
+void trace_capture_stop(void)
+{
+    atomic_store_explicit(&s_active, false, memory_order_release);
+}
+
+void trace_capture_get_status(trace_capture_status_t *status)
+{
+    uint32_t next = atomic_load_explicit(&s_next, memory_order_relaxed);
+    bool active = atomic_load_explicit(&s_active, memory_order_acquire);
+
+    // Window may have elapsed without any event to notice it
+    if (active && esp_timer_get_time() - s_start_us >= s_window_us) {
+        atomic_store_explicit(&s_active, false, memory_order_relaxed);
+        active = false;
+    }
+
+    status->active = active;
+    status->duration_ms = s_duration_ms;
+    status->capacity = CONFIG_TRACE_CAPTURE_EVENTS;
+    status->recorded = next < CONFIG_TRACE_CAPTURE_EVENTS ? next : CONFIG_TRACE_CAPTURE_EVENTS;
+    status->dropped = next - status->recorded;
+}
+
+bool trace_capture_read(uint32_t index, tc_record_t *rec)
+{
+    if (s_slots == NULL || index >= CONFIG_TRACE_CAPTURE_EVENTS ||
+        index >= atomic_load_explicit(&s_next, memory_order_relaxed)) {
+        return false;
+    }
+
+    const tc_slot_t *slot = &s_slots[index];
+    uint8_t phase = atomic_load_explicit(&slot->phase, memory_order_acquire);
+    if (phase == 0) {
+        return false;
+    }
+
+    rec->ts_us = slot->ts_us;
+    rec->task = slot->task;
+    rec->arg = slot->arg;
+    rec->event = slot->event;
+    rec->phase = phase;
+    rec->core = slot->core;
+    return true;
+}
+
+const char *trace_capture_event_name(tc_event_t event)
+{
+    return event < TC_EV_COUNT ? s_event_names[event] : "unknown";
+}
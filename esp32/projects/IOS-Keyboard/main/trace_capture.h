@@ -0,0 +1,98 @@
+#ifndef TRACE_CAPTURE_H
+#define TRACE_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * Traced pipeline spans
+ */
+typedef enum {
+    TC_EV_GATT_RX,      // GATT write callback (arg: payload length)
+    TC_EV_PARSE,        // Command parser dispatch (arg: opcode)
+    TC_EV_LAYOUT,       // Codepoint to keycode conversion (arg: codepoint)
+    TC_EV_HID_REPORT,   // HID report in flight, sent until acked (async, arg: report id)
+    TC_EV_TASK,         // FreeRTOS task switched in (task: new task)
+    TC_EV_COUNT
+} tc_event_t;
+
+/**
+ * Record phases (Chrome trace-event "ph" values)
+ */
+#define TC_PH_BEGIN         'B'
+#define TC_PH_END           'E'
+#define TC_PH_ASYNC_BEGIN   'b'
+#define TC_PH_ASYNC_END     'e'
+#define TC_PH_SWITCH        'S'
+
+/**
+ * One captured record
+ */
+typedef struct {
+    uint32_t ts_us;     // Microseconds since capture start
+    void *task;         // Task that recorded the event (or was switched in)
+    uint32_t arg;
+    uint8_t event;      // tc_event_t
+    uint8_t phase;      // TC_PH_* (0 while the slot is being written)
+    uint8_t core;
+} tc_record_t;
+
+/**
+ * Capture state
+ */
+typedef struct {
+    bool active;
+    uint32_t duration_ms;   // Requested window
+    uint32_t recorded;      // Records stored
+    uint32_t dropped;       // Records lost because the buffer was full
+    uint32_t capacity;
+} trace_capture_status_t;
+
+/**
+ * Start a capture window (allocates the record buffer on first use)
+ * Any previous capture is discarded.
+ * @param duration_ms Window length, clamped to CONFIG_TRACE_CAPTURE_MAX_MS
+ */
+esp_err_t trace_capture_start(uint32_t duration_ms);
+
+/**
+ * Stop the current capture early
+ */
+void trace_capture_stop(void);
+
+/**
+ * Get capture state
+ */
+void trace_capture_get_status(trace_capture_status_t *status);
+
+/**
+ * Read a stored record
+ * @return false if index is out of range or the slot was never completed
+ */
+bool trace_capture_read(uint32_t index, tc_record_t *rec);
+
+/**
+ * Get span name for export (e.g. "parse")
+ */
+const char *trace_capture_event_name(tc_event_t event);
+
+/**
+ * Record span begin/end on the calling task (no-op when not capturing)
+ */
+void trace_capture_begin(tc_event_t event, uint32_t arg);
+void trace_capture_end(tc_event_t event, uint32_t arg);
+
+/**
+ * Record an async span that may end on another task, matched by id
+ */
+void trace_capture_async_begin(tc_event_t event, uint32_t id);
+void trace_capture_async_end(tc_event_t event, uint32_t id);
+
+/**
+ * FreeRTOS traceTASK_SWITCHED_IN hook (see trace_capture_hook.h)
+ * Runs inside the scheduler, so it lives in IRAM and never blocks.
+ */
+void trace_capture_task_switched_in(void);
+
+#endif // TRACE_CAPTURE_H
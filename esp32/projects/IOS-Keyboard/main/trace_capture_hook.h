@@ -0,0 +1,12 @@
+// Force-included into the freertos component (see main/CMakeLists.txt) so
+// that every task switch is reported to trace_capture.c. Must stay free of
+// other includes: it is seen before FreeRTOS.h by the kernel sources.
+#ifndef TRACE_CAPTURE_HOOK_H
+#define TRACE_CAPTURE_HOOK_H
+
+#ifndef __ASSEMBLER__
+void trace_capture_task_switched_in(void);
+#define traceTASK_SWITCHED_IN() trace_capture_task_switched_in()
+#endif
+
+#endif // TRACE_CAPTURE_HOOK_H
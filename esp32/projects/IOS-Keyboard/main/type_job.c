@@ -0,0 +1,537 @@
+#include "type_job.h"
+#include "config.h"
+#include "json_stream.h"
+#include "ingest.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/stream_buffer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "type_job";
+
+static StreamBufferHandle_t s_stream = NULL;    // Body text -> typing worker
+static TaskHandle_t s_worker = NULL;
+static TaskHandle_t s_receiver = NULL;
+static httpd_req_t *s_rx_req = NULL;            // Async copy handed to the receiver
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static type_job_status_t s_status = { .state = TYPE_JOB_IDLE };
+static int64_t s_start_us = 0;
+static int64_t s_end_us = 0;
+static volatile bool s_cancel = false;
+static volatile bool s_rx_done = true;
+static atomic_uint s_chunks_inflight = 0;       // Submitted to the ingest bus, not yet done
+static volatile esp_err_t s_chunk_error = ESP_OK;
+
+// Streaming extraction of the top-level "text" string from a JSON body
+typedef enum {
+    SCAN_SEEK,          // Outside strings
+    SCAN_KEY,           // Inside a top-level member name
+    SCAN_KEY_ESC,
+    SCAN_COLON,         // After "text"
+    SCAN_VALUE_START,   // After "text":
+    SCAN_VALUE,         // Inside the text value (emitted)
+    SCAN_VALUE_ESC,
+    SCAN_VALUE_HEX,     // \uXXXX
+    SCAN_SKIP,          // Inside any other string
+    SCAN_SKIP_ESC,
+    SCAN_DONE,
+} scan_state_t;
+
+typedef struct {
+    scan_state_t state;
+    int depth;
+    bool expect_key;
+    char key[5];
+    uint8_t key_len;
+    bool key_match;
+    uint8_t hex_count;
+    uint32_t code;
+    uint32_t high_surrogate;
+} json_scan_t;
+
+static size_t utf8_encode(uint32_t cp, char *out)
+{
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Feed body bytes; decoded text is appended to out (never longer than the input)
+static size_t json_scan(json_scan_t *s, const char *in, size_t len, char *out)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = in[i];
+        switch (s->state) {
+            case SCAN_SEEK:
+                if (c == '{' || c == '[') {
+                    s->depth++;
+                    s->expect_key = (c == '{' && s->depth == 1);
+                } else if (c == '}' || c == ']') {
+                    s->depth--;
+                } else if (c == ',') {
+                    s->expect_key = (s->depth == 1);
+                } else if (c == '"') {
+                    if (s->depth == 1 && s->expect_key) {
+                        s->state = SCAN_KEY;
+                        s->key_len = 0;
+                        s->key_match = true;
+                    } else {
+                        s->state = SCAN_SKIP;
+                    }
+                }
+                break;
+
+            case SCAN_KEY:
+                if (c == '"') {
+                    s->expect_key = false;
+                    s->state = (s->key_match && s->key_len == 4 &&
+                                memcmp(s->key, "text", 4) == 0) ? SCAN_COLON : SCAN_SEEK;
+                } else if (c == '\\') {
+                    s->key_match = false;
+                    s->state = SCAN_KEY_ESC;
+                } else if (s->key_len < 4) {
+                    s->key[s->key_len++] = c;
+                } else {
+                    s->key_match = false;
+                }
+                break;
+
+            case SCAN_KEY_ESC:
+                s->state = SCAN_KEY;
+                break;
+
+            case SCAN_COLON:
+                if (c == ':') {
+                    s->state = SCAN_VALUE_START;
+                } else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                    s->state = SCAN_SEEK;
+                }
+                break;
+
+            case SCAN_VALUE_START:
+                if (c == '"') {
+                    s->state = SCAN_VALUE;
+                } else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                    // Not a string: keep scanning for another "text" member
+                    s->state = SCAN_SEEK;
+                    i--;
+                }
+                break;
+
+            case SCAN_VALUE:
+                if (c == '"') {
+                    s->state = SCAN_DONE;
+                } else if (c == '\\') {
+                    s->state = SCAN_VALUE_ESC;
+                } else {
+                    out[n++] = c;
+                }
+                break;
+
+            case SCAN_VALUE_ESC:
+                s->state = SCAN_VALUE;
+                switch (c) {
+                    case 'n': out[n++] = '\n'; break;
+                    case 't': out[n++] = '\t'; break;
+                    case 'r': out[n++] = '\r'; break;
+                    case 'b': out[n++] = '\b'; break;
+                    case 'f': out[n++] = '\f'; break;
+                    case 'u':
+                        s->state = SCAN_VALUE_HEX;
+                        s->hex_count = 0;
+                        s->code = 0;
+                        break;
+                    default: out[n++] = c; break;   // \" \\ \/
+                }
+                break;
+
+            case SCAN_VALUE_HEX: {
+                int v = hex_value(c);
+                if (v < 0) {
+                    s->state = SCAN_VALUE;
+                    break;
+                }
+                s->code = (s->code << 4) | v;
+                if (++s->hex_count < 4) {
+                    break;
+                }
+                s->state = SCAN_VALUE;
+                if (s->code >= 0xD800 && s->code <= 0xDBFF) {
+                    s->high_surrogate = s->code;
+                } else if (s->code >= 0xDC00 && s->code <= 0xDFFF) {
+                    if (s->high_surrogate != 0) {
+                        uint32_t cp = 0x10000 + ((s->high_surrogate - 0xD800) << 10) + (s->code - 0xDC00);
+                        n += utf8_encode(cp, out + n);
+                    }
+                    s->high_surrogate = 0;
+                } else if (s->code != 0) {
+                    n += utf8_encode(s->code, out + n);
+                }
+                break;
+            }
+
+            case SCAN_SKIP:
+                if (c == '"') {
+                    s->state = SCAN_SEEK;
+                } else if (c == '\\') {
+                    s->state = SCAN_SKIP_ESC;
+                }
+                break;
+
+            case SCAN_SKIP_ESC:
+                s->state = SCAN_SKIP;
+                break;
+
+            case SCAN_DONE:
+                return n;
+        }
+    }
+    return n;
+}
+
+// Hand text to the typing worker, waiting while the queue is full
+static bool push_text(const char *data, size_t len)
+{
+    while (len > 0) {
+        if (s_cancel) {
+            return false;
+        }
+        size_t sent = xStreamBufferSend(s_stream, data, len, pdMS_TO_TICKS(100));
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+static void finish(type_job_state_t state, esp_err_t error)
+{
+    taskENTER_CRITICAL(&s_lock);
+    if (s_status.state == TYPE_JOB_RUNNING) {
+        s_status.state = state;
+        s_status.error = error;
+        s_end_us = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+// Receive the body of one job
+static void receive_body(httpd_req_t *req)
+{
+    // Reply first: the client gets the job id while the body is still streaming
+    json_stream_t js;
+    httpd_resp_set_status(req, "202 Accepted");
+    json_stream_init_http(&js, req);
+    json_stream_object_begin(&js, NULL);
+    json_stream_bool(&js, "success", true);
+    json_stream_uint(&js, "job", s_status.id);
+    json_stream_uint(&js, "bytes", s_status.bytes_total);
+    json_stream_object_end(&js);
+    json_stream_finish(&js);
+
+    bool is_json = false;
+    char type[32];
+    if (httpd_req_get_hdr_value_str(req, "Content-Type", type, sizeof(type)) == ESP_OK) {
+        is_json = strncmp(type, "application/json", 16) == 0;
+    }
+
+    json_scan_t scan = { .state = SCAN_SEEK };
+    char buf[512];
+    char text[sizeof(buf) + 4];    // A \uXXXX split across reads can add 3 bytes
+    size_t remaining = req->content_len;
+    esp_err_t err = ESP_OK;
+
+    while (remaining > 0 && !s_cancel) {
+        int n = httpd_req_recv(req, buf, remaining < sizeof(buf) ? remaining : sizeof(buf));
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (n <= 0) {
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        remaining -= n;
+        taskENTER_CRITICAL(&s_lock);
+        s_status.bytes_received += n;
+        taskEXIT_CRITICAL(&s_lock);
+
+        if (is_json) {
+            size_t len = json_scan(&scan, buf, n, text);
+            push_text(text, len);
+        } else {
+            push_text(buf, n);
+        }
+    }
+
+    if (remaining > 0) {
+        // Don't make the server drain the rest of an abandoned body
+        httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Job %" PRIu32 ": body receive failed", s_status.id);
+            finish(TYPE_JOB_FAILED, err);
+        }
+    }
+    httpd_req_async_handler_complete(req);
+}
+
+// Bodies are received on their own task so the HTTP server stays responsive
+static void receiver_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (s_rx_req == NULL) {
+            continue;
+        }
+        receive_body(s_rx_req);
+        s_rx_req = NULL;
+        taskENTER_CRITICAL(&s_lock);
+        s_status.receiving = false;
+        s_rx_done = true;
+        taskEXIT_CRITICAL(&s_lock);
+        xTaskNotifyGive(s_worker);
+    }
+}
+
+// Length of the longest prefix that ends on a UTF-8 character boundary
+static size_t utf8_complete(const char *buf, size_t len)
+{
+    size_t i = len;
+    while (i > 0 && ((uint8_t)buf[i - 1] & 0xC0) == 0x80 && len - i < 3) {
+        i--;
+    }
+    if (i == 0) {
+        return len;     // Only continuation bytes: pass through
+    }
+    uint8_t lead = buf[i - 1];
+    size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    return (len - (i - 1) >= need) ? len : i - 1;
+}
+
+static uint32_t utf8_count(const char *str)
+{
+    uint32_t count = 0;
+    for (; *str; str++) {
+        if (((uint8_t)*str & 0xC0) != 0x80) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Ingest completion for one chunk (cookie = characters in it)
+static void chunk_done(esp_err_t result, const uint8_t *data, size_t len, void *ctx, uint64_t cookie)
+{
+    if (result == ESP_OK) {
+        taskENTER_CRITICAL(&s_lock);
+        s_status.chars_typed += (uint32_t)cookie;
+        taskEXIT_CRITICAL(&s_lock);
+    } else if (result != ESP_ERR_NOT_FINISHED && s_chunk_error == ESP_OK) {
+        s_chunk_error = result;
+    }
+    atomic_fetch_sub(&s_chunks_inflight, 1);
+    xTaskNotifyGive(s_worker);
+}
+
+// Feed one job from the stream buffer to the ingest bus, a chunk at a time
+static void type_job_run(void)
+{
+    uint8_t packet[1 + CONFIG_TYPE_JOB_CHUNK + 1] = { CMD_INSERT };
+    char *chunk = (char *)packet + 1;
+    size_t len = 0;
+    s_chunk_error = ESP_OK;
+
+    while (!s_cancel && s_chunk_error == ESP_OK && s_status.state == TYPE_JOB_RUNNING) {
+        len += xStreamBufferReceive(s_stream, chunk + len, CONFIG_TYPE_JOB_CHUNK - len,
+                                    pdMS_TO_TICKS(100));
+        bool last = s_rx_done && xStreamBufferIsEmpty(s_stream);
+        if (len == 0) {
+            if (last) {
+                break;
+            }
+            continue;
+        }
+
+        // Keep a split multi-byte character for the next round
+        size_t cut = last ? len : utf8_complete(chunk, len);
+        if (cut == 0) {
+            continue;
+        }
+        char keep = chunk[cut];
+        chunk[cut] = '\0';
+        uint32_t chars = utf8_count(chunk);
+        atomic_fetch_add(&s_chunks_inflight, 1);
+        esp_err_t err = ingest_submit(INGEST_SRC_HTTP, packet, 1 + cut, portMAX_DELAY,
+                                      chunk_done, NULL, chars);
+        if (err != ESP_OK) {
+            atomic_fetch_sub(&s_chunks_inflight, 1);
+            s_chunk_error = err;
+        }
+        chunk[cut] = keep;
+        memmove(chunk, chunk + cut, len - cut);
+        len -= cut;
+    }
+
+    // Wait for queued chunks to be typed (or flushed by a cancel); other
+    // /type commands on the same source stay queued
+    if (s_cancel || s_chunk_error != ESP_OK) {
+        ingest_flush(INGEST_SRC_HTTP, chunk_done);
+    }
+    while (atomic_load(&s_chunks_inflight) > 0) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+
+    if (s_cancel) {
+        finish(TYPE_JOB_CANCELLED, ESP_OK);
+    } else if (s_chunk_error != ESP_OK) {
+        ESP_LOGW(TAG, "Job %" PRIu32 ": typing failed: %s", s_status.id, esp_err_to_name(s_chunk_error));
+        finish(TYPE_JOB_FAILED, s_chunk_error);
+    } else {
+        finish(TYPE_JOB_DONE, ESP_OK);
+    }
+
+    // Stop the receiver before dropping whatever it queued
+    s_cancel = true;
+    while (!s_rx_done) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    xStreamBufferReset(s_stream);
+
+    ESP_LOGI(TAG, "Job %" PRIu32 " %s: %" PRIu32 " chars in %" PRIu32 " ms", s_status.id,
+             type_job_state_name(s_status.state), s_status.chars_typed,
+             (uint32_t)((s_end_us - s_start_us) / 1000));
+}
+
+static void worker_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (s_status.state == TYPE_JOB_RUNNING) {
+            type_job_run();
+        }
+    }
+}
+
+esp_err_t type_job_start(httpd_req_t *req)
+{
+    if (s_stream == NULL) {
+        s_stream = xStreamBufferCreate(CONFIG_TYPE_JOB_BUF_SIZE, 1);
+        if (s_stream == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (s_worker == NULL &&
+        xTaskCreate(worker_task, "type_job", 4096, NULL, 5, &s_worker) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (s_receiver == NULL &&
+        xTaskCreate(receiver_task, "type_rx", 4096, NULL, 5, &s_receiver) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    taskENTER_CRITICAL(&s_lock);
+    bool busy = s_status.state == TYPE_JOB_RUNNING || !s_rx_done;
+    if (!busy) {
+        uint32_t id = s_status.id + 1;
+        memset(&s_status, 0, sizeof(s_status));
+        s_status.id = id;
+        s_status.state = TYPE_JOB_RUNNING;
+        s_status.receiving = true;
+        s_status.bytes_total = req->content_len;
+        s_start_us = esp_timer_get_time();
+        s_cancel = false;
+        s_rx_done = false;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+    if (busy) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    httpd_req_t *async_req;
+    esp_err_t err = httpd_req_async_handler_begin(req, &async_req);
+    if (err != ESP_OK) {
+        taskENTER_CRITICAL(&s_lock);
+        s_status.state = TYPE_JOB_FAILED;
+        s_status.error = err;
+        s_status.receiving = false;
+        s_rx_done = true;
+        taskEXIT_CRITICAL(&s_lock);
+        return err;
+    }
+
+    s_rx_req = async_req;
+    xTaskNotifyGive(s_receiver);
+    ESP_LOGI(TAG, "Job %" PRIu32 " started (%" PRIu32 " bytes)", s_status.id, s_status.bytes_total);
+    xTaskNotifyGive(s_worker);
+    return ESP_OK;
+}
+
+esp_err_t type_job_cancel(uint32_t id)
+{
+    // Checked and flagged under the lock, so a job starting meanwhile is
+    // never the one cancelled; the worker drops the job's queued chunks
+    taskENTER_CRITICAL(&s_lock);
+    bool running = s_status.state == TYPE_JOB_RUNNING && (id == 0 || id == s_status.id);
+    if (running) {
+        s_cancel = true;
+    }
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (!running) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    xTaskNotifyGive(s_worker);
+    return ESP_OK;
+}
+
+void type_job_get_status(type_job_status_t *status)
+{
+    taskENTER_CRITICAL(&s_lock);
+    *status = s_status;
+    int64_t end_us = (s_status.state == TYPE_JOB_RUNNING) ? esp_timer_get_time() : s_end_us;
+    taskEXIT_CRITICAL(&s_lock);
+
+    status->elapsed_ms = (status->state == TYPE_JOB_IDLE) ? 0 : (uint32_t)((end_us - s_start_us) / 1000);
+}
+
+const char *type_job_state_name(type_job_state_t state)
+{
+    switch (state) {
+        case TYPE_JOB_IDLE:      return "idle";
+        case TYPE_JOB_RUNNING:   return "running";
+        case TYPE_JOB_DONE:      return "done";
+        case TYPE_JOB_CANCELLED: return "cancelled";
+        case TYPE_JOB_FAILED:    return "failed";
+        default:                 return "unknown";
+    }
+}
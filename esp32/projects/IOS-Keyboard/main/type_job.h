@@ -0,0 +1,59 @@
+#ifndef TYPE_JOB_H
+#define TYPE_JOB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Typing job state
+typedef enum {
+    TYPE_JOB_IDLE,          // No job since boot
+    TYPE_JOB_RUNNING,       // Receiving and/or typing
+    TYPE_JOB_DONE,
+    TYPE_JOB_CANCELLED,
+    TYPE_JOB_FAILED,
+} type_job_state_t;
+
+// Typing job progress
+typedef struct {
+    uint32_t id;
+    type_job_state_t state;
+    bool receiving;         // Body still arriving
+    uint32_t bytes_total;   // Content-Length of the body
+    uint32_t bytes_received;
+    uint32_t chars_typed;
+    uint32_t elapsed_ms;
+    esp_err_t error;        // Set when state is TYPE_JOB_FAILED
+} type_job_status_t;
+
+/**
+ * Start a typing job from an HTTP request body
+ * Takes the request over (async handler): replies 202 with the job id
+ * right away, then streams the body into the keystroke queue as it
+ * arrives while a worker task feeds it to the ingest bus in short
+ * CMD_INSERT chunks (INGEST_SRC_HTTP). Body is raw UTF-8 text, or a
+ * JSON object with a "text" member when Content-Type is application/json.
+ * Only one job runs at a time.
+ * @return ESP_ERR_INVALID_STATE if a job is running (nothing sent)
+ */
+esp_err_t type_job_start(httpd_req_t *req);
+
+/**
+ * Cancel a running job
+ * @param id Job id, or 0 for the current job
+ * @return ESP_ERR_NOT_FOUND if that job is not running
+ */
+esp_err_t type_job_cancel(uint32_t id);
+
+/**
+ * Get progress of the current (or last) job
+ */
+void type_job_get_status(type_job_status_t *status);
+
+/**
+ * Get state name for JSON ("idle", "running", ...)
+ */
+const char *type_job_state_name(type_job_state_t state);
+
+#endif // TYPE_JOB_H
@@ -1,12 +1,18 @@
 #include "usb_hid.h"
 #include "config.h"
 #include "keyboard_layout.h"
+#include "host_os.h"
 #include "debug_server.h"
+#include "deferred_log.h"
+#include "metrics.h"
+#include "trace_capture.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "tinyusb.h"
 #include "class/hid/hid_device.h"
 
@@ -29,14 +35,9 @@ static const char *hid_string_descriptor[] = {
 // Configuration descriptor length
 #define TUSB_DESC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
 
-// HID country codes (USB HID spec)
+// HID country code (USB HID spec) when the layout gives none; layouts
+// carry their own (country line in main/layouts/<code>.layout)
 #define HID_COUNTRY_US          33  // 0x21
-#define HID_COUNTRY_SWISS_DE    28  // 0x1C
-#define HID_COUNTRY_GERMAN       9  // 0x09
-#define HID_COUNTRY_FRENCH       8  // 0x08
-#define HID_COUNTRY_UK          32  // 0x20
-#define HID_COUNTRY_SPANISH     25  // 0x19
-#define HID_COUNTRY_ITALIAN     14  // 0x0E
 
 // Offset of country code byte in configuration descriptor
 // Config(9) + Interface(9) + HID header(4) = byte 22
@@ -53,17 +54,8 @@ static uint8_t hid_configuration_descriptor[] = {
 // Get HID country code for current keyboard layout
 static uint8_t get_hid_country_code(void)
 {
-    keyboard_layout_t layout = keyboard_layout_get();
-    switch (layout) {
-        case LAYOUT_US:    return HID_COUNTRY_US;
-        case LAYOUT_CH_DE: return HID_COUNTRY_SWISS_DE;
-        case LAYOUT_DE:    return HID_COUNTRY_GERMAN;
-        case LAYOUT_FR:    return HID_COUNTRY_FRENCH;
-        case LAYOUT_UK:    return HID_COUNTRY_UK;
-        case LAYOUT_ES:    return HID_COUNTRY_SPANISH;
-        case LAYOUT_IT:    return HID_COUNTRY_ITALIAN;
-        default:           return HID_COUNTRY_US;
-    }
+    const keyboard_layout_info_t *info = keyboard_layout_get_info(keyboard_layout_get());
+    return (info != NULL && info->hid_country != 0) ? info->hid_country : HID_COUNTRY_US;
 }
 
 // USB device ready flag
@@ -72,35 +64,117 @@ static bool s_usb_ready = false;
 // Report ID for keyboard (must match HID_REPORT_ID in descriptor)
 #define KEYBOARD_REPORT_ID 1
 
-// Send a single key press and release
-static esp_err_t send_key(uint8_t keycode, uint8_t modifier)
+// Report ids for trace capture; the endpoint completes reports in order
+static uint32_t s_reports_sent = 0;
+static uint32_t s_reports_acked = 0;
+
+// Carries a UTF-8 sequence split across inserts; any other command drops it
+static utf8_decoder_t s_type_decoder;
+
+// Held for each command, and for a whole calibration run
+static SemaphoreHandle_t s_hid_mutex = NULL;
+
+// Host LED state; Num Lock changes are counted for calibration and wake
+// the calibrating task
+static volatile uint8_t s_leds = 0;
+static volatile uint32_t s_numlock_changes = 0;
+static volatile int64_t s_numlock_change_us = 0;
+static TaskHandle_t s_calib_task = NULL;
+
+// Sleep for ms like vTaskDelay(pdMS_TO_TICKS(ms)), but never less than
+// two ticks: vTaskDelay(n) sleeps n - 1 to n ticks, so one tick could
+// return at once and the next report would find the endpoint still busy
+static void delay_ms(uint32_t ms)
+{
+    if (ms > 0) {
+        TickType_t ticks = pdMS_TO_TICKS(ms);
+        vTaskDelay(ticks < 2 ? 2 : ticks);
+    }
+}
+
+// Queue one keyboard report and account for it; false if the endpoint
+// still holds the previous one (calibration counts these)
+static bool send_report(uint8_t modifier, const uint8_t keycodes[6])
+{
+    if (!tud_hid_keyboard_report(KEYBOARD_REPORT_ID, modifier, keycodes)) {
+        return false;
+    }
+    trace_capture_async_begin(TC_EV_HID_REPORT, s_reports_sent++);
+    metrics_report_sent();
+    return true;
+}
+
+// Queue a report for typing: if the host has not polled the previous one
+// yet, retry each tick for up to CONFIG_HID_REPORT_RETRY_MS rather than
+// dropping the keystroke
+static bool send_report_retry(uint8_t modifier, const uint8_t keycodes[6])
+{
+    int64_t deadline = esp_timer_get_time() + CONFIG_HID_REPORT_RETRY_MS * 1000;
+    while (!send_report(modifier, keycodes)) {
+        if (!s_usb_ready || esp_timer_get_time() >= deadline) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+// Send a key press and release at the host's speed; modifiers shared with
+// the next keystroke stay down in the release report
+static esp_err_t send_key_held(uint8_t keycode, uint8_t modifier, uint8_t next_modifier,
+                               const host_speed_t *speed)
 {
     uint8_t keycodes[6] = {0};
 
     // Key press
     keycodes[0] = keycode;
-    if (!tud_hid_keyboard_report(KEYBOARD_REPORT_ID, modifier, keycodes)) {
+    if (!send_report_retry(modifier, keycodes)) {
         return ESP_FAIL;
     }
-    vTaskDelay(pdMS_TO_TICKS(CONFIG_TYPING_DELAY_MS));
+    delay_ms(speed->press_ms);
 
     // Key release
     memset(keycodes, 0, sizeof(keycodes));
-    if (!tud_hid_keyboard_report(KEYBOARD_REPORT_ID, 0, keycodes)) {
+    if (!send_report_retry(modifier & next_modifier, keycodes)) {
         return ESP_FAIL;
     }
-    vTaskDelay(pdMS_TO_TICKS(CONFIG_TYPING_DELAY_MS / 2));
+    delay_ms(speed->release_ms);
 
     return ESP_OK;
 }
 
+// Send a single key press and release
+static esp_err_t send_key(uint8_t keycode, uint8_t modifier)
+{
+    host_speed_t speed = host_os_get_speed();
+    xSemaphoreTake(s_hid_mutex, portMAX_DELAY);
+    esp_err_t err = send_key_held(keycode, modifier, 0, &speed);
+    xSemaphoreGive(s_hid_mutex);
+    return err;
+}
+
 // TinyUSB callbacks
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
 {
     (void)instance;
+    host_os_on_report_descriptor();
     return hid_report_descriptor;
 }
 
+// SET_IDLE and SET_PROTOCOL only feed host detection; TinyUSB keeps the state
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate)
+{
+    (void)instance;
+    host_os_on_set_idle(idle_rate);
+    return true;
+}
+
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+    (void)instance;
+    host_os_on_set_protocol(protocol);
+}
+
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id,
                                 hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
 {
@@ -116,21 +190,50 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id,
                            hid_report_type_t report_type, uint8_t const *buffer, uint16_t bufsize)
 {
     (void)instance;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)bufsize;
+    if (report_type != HID_REPORT_TYPE_OUTPUT) {
+        return;
+    }
+    // On the OUT endpoint the report id is still in front of the LED byte
+    if (report_id == 0 && bufsize >= 2 && buffer[0] == KEYBOARD_REPORT_ID) {
+        buffer++;
+        bufsize--;
+    }
+    if (bufsize >= 1) {
+        uint8_t leds = buffer[0];
+        if ((leds ^ s_leds) & KEYBOARD_LED_NUMLOCK) {
+            s_numlock_change_us = esp_timer_get_time();
+            s_numlock_changes++;
+            if (s_calib_task != NULL) {
+                xTaskNotifyGive(s_calib_task);
+            }
+        }
+        s_leds = leds;
+        keyboard_layout_set_numlock((leds & KEYBOARD_LED_NUMLOCK) != 0);
+        host_os_on_led_report(leds);
+    }
+}
+
+// Invoked when a report was transferred to the host
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    (void)instance;
+    (void)report;
+    (void)len;
+    trace_capture_async_end(TC_EV_HID_REPORT, s_reports_acked++);
+    metrics_report_acked();
 }
 
 void tud_mount_cb(void)
 {
     ESP_LOGI(TAG, "USB mounted");
+    host_os_on_mount();
     s_usb_ready = true;
 }
 
 void tud_umount_cb(void)
 {
     ESP_LOGI(TAG, "USB unmounted");
+    host_os_on_unmount();
     s_usb_ready = false;
 }
 
@@ -153,6 +256,12 @@ esp_err_t usb_hid_init(void)
         .vbus_monitor_io = -1,
     };
 
+    utf8_decoder_reset(&s_type_decoder);
+    s_hid_mutex = xSemaphoreCreateMutex();
+    if (s_hid_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
     esp_err_t ret = tinyusb_driver_install(&tusb_cfg);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "TinyUSB driver install failed: %s", esp_err_to_name(ret));
@@ -163,32 +272,8 @@ esp_err_t usb_hid_init(void)
     return ESP_OK;
 }
 
-// Context for typing callback
-typedef struct {
-    esp_err_t result;
-    const char *text;  // Current text being typed
-    int index;         // Current character index
-} type_context_t;
-
-// Callback for keyboard_layout_string_to_keycodes
-static void type_key_callback(uint8_t keycode, uint8_t modifiers, void *ctx)
-{
-    type_context_t *type_ctx = (type_context_t *)ctx;
-    if (type_ctx->result != ESP_OK) {
-        return;  // Stop on first error
-    }
-
-    // Get the character being typed for trace
-    char ch = type_ctx->text[type_ctx->index++];
-    // Show printable char, or hex for non-printable
-    if (ch >= 32 && ch < 127) {
-        debug_server_trace_hid("'%c' K:0x%02X M:0x%02X", ch, keycode, modifiers);
-    } else {
-        debug_server_trace_hid("0x%02X K:0x%02X M:0x%02X", (uint8_t)ch, keycode, modifiers);
-    }
-
-    type_ctx->result = send_key(keycode, modifiers);
-}
+// Keystrokes planned per batch
+#define TYPE_PLAN_KEYS 32
 
 esp_err_t usb_hid_type_text(const char *text)
 {
@@ -201,13 +286,37 @@ esp_err_t usb_hid_type_text(const char *text)
         return ESP_ERR_INVALID_ARG;
     }
 
-    ESP_LOGI(TAG, "Typing: %s", text);
-
-    type_context_t ctx = { .result = ESP_OK, .text = text, .index = 0 };
-    int count = keyboard_layout_string_to_keycodes(text, type_key_callback, &ctx);
+    // Convert a batch up front, then pace its reports without layout work
+    // in between
+    keyboard_keystroke_t keys[TYPE_PLAN_KEYS];
+    host_speed_t speed = host_os_get_speed();
+    size_t len = strlen(text);
+    size_t pos = 0;
+    int count = 0;
+    esp_err_t result = ESP_OK;
+
+    xSemaphoreTake(s_hid_mutex, portMAX_DELAY);
+    while (pos < len && result == ESP_OK) {
+        keyboard_plan_t plan;
+        keyboard_layout_plan(&s_type_decoder, text + pos, len - pos, keys, TYPE_PLAN_KEYS, &plan);
+
+        for (size_t i = 0; i < plan.keys && result == ESP_OK; i++) {
+            uint8_t ch = (uint8_t)text[pos + keys[i].offset];
+            debug_server_trace(TRACE_STAGE_HID, CMD_INSERT, keys[i].keycode, keys[i].modifiers, ch);
+            metrics_inc(METRIC_CHARACTERS, 1);
+            uint8_t next = (i + 1 < plan.keys) ? keys[i + 1].modifiers : 0;
+            result = send_key_held(keys[i].keycode, keys[i].modifiers, next, &speed);
+        }
+        count += plan.chars;
+        if (plan.consumed == 0) {
+            break;  // Defensive: no progress
+        }
+        pos += plan.consumed;
+    }
+    xSemaphoreGive(s_hid_mutex);
 
-    ESP_LOGI(TAG, "Typed %d characters", count);
-    return ctx.result;
+    DLOG(DLOG_HID_TYPED, count, len);
+    return result;
 }
 
 esp_err_t usb_hid_type_hello_world(void)
@@ -225,7 +334,9 @@ esp_err_t usb_hid_send_backspace(void)
     if (!s_usb_ready) {
         return ESP_ERR_INVALID_STATE;
     }
-    debug_server_trace_hid("BS K:0x%02X", HID_KEY_BACKSPACE);
+    utf8_decoder_reset(&s_type_decoder);
+    debug_server_trace(TRACE_STAGE_HID, CMD_BACKSPACE, HID_KEY_BACKSPACE, 0, 0);
+    metrics_inc(METRIC_BACKSPACES, 1);
     return send_key(HID_KEY_BACKSPACE, 0);
 }
 
@@ -234,7 +345,8 @@ esp_err_t usb_hid_send_enter(void)
     if (!s_usb_ready) {
         return ESP_ERR_INVALID_STATE;
     }
-    debug_server_trace_hid("ENTER K:0x%02X", HID_KEY_ENTER);
+    utf8_decoder_reset(&s_type_decoder);
+    debug_server_trace(TRACE_STAGE_HID, CMD_ENTER, HID_KEY_ENTER, 0, 0);
     return send_key(HID_KEY_ENTER, 0);
 }
 
@@ -255,7 +367,164 @@ esp_err_t usb_hid_send_ctrl_key(char key)
         return ESP_ERR_INVALID_ARG;
     }
 
-    debug_server_trace_hid("CTRL+%c K:0x%02X M:0x02", key, keycode);
+    utf8_decoder_reset(&s_type_decoder);
+    debug_server_trace(TRACE_STAGE_HID, CMD_CTRL_KEY, keycode, KEYBOARD_MODIFIER_LEFTCTRL, (uint8_t)key);
     // Send with Left Ctrl modifier
     return send_key(keycode, KEYBOARD_MODIFIER_LEFTCTRL);
 }
+
+esp_err_t usb_hid_send_shortcut(host_shortcut_t shortcut)
+{
+    if (!s_usb_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    host_key_t key;
+    esp_err_t err = host_os_get_shortcut(shortcut, &key);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    utf8_decoder_reset(&s_type_decoder);
+    debug_server_trace(TRACE_STAGE_HID, CMD_SHORTCUT, key.keycode, key.modifiers, shortcut);
+    return send_key(key.keycode, key.modifiers);
+}
+
+// Calibration rates, slowest first
+static const host_speed_t s_calib_steps[USB_HID_CALIB_STEPS] = {
+    { 40, 20 },
+    { 30, 20 },
+    { 20, 10 },
+    { 10, 10 },
+};
+
+// One Num Lock press and release; false if the endpoint refused a report
+// (previous one not yet polled by the host)
+static bool calib_toggle(const host_speed_t *speed)
+{
+    uint8_t keycodes[6] = { HID_KEY_NUM_LOCK };
+    bool ok = send_report(0, keycodes);
+    delay_ms(speed->press_ms);
+    memset(keycodes, 0, sizeof(keycodes));
+    ok = send_report(0, keycodes) && ok;
+    delay_ms(speed->release_ms);
+    return ok;
+}
+
+// Wait for the next Num Lock LED change; its time, or -1 on timeout
+static int64_t calib_wait_echo(void)
+{
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_CALIBRATE_ECHO_TIMEOUT_MS)) == 0) {
+        return -1;
+    }
+    return s_numlock_change_us;
+}
+
+// Measure the echo round trip with single toggles (even count, so Num Lock
+// ends as it started)
+static void calib_rtt(usb_hid_calibration_t *result)
+{
+    const host_speed_t slow = s_calib_steps[0];
+    uint64_t total = 0;
+    int samples = 0;
+
+    result->rtt_min_us = UINT32_MAX;
+    for (int i = 0; i < CONFIG_CALIBRATE_RTT_SAMPLES; i++) {
+        ulTaskNotifyTake(pdTRUE, 0);
+        int64_t start = esp_timer_get_time();
+        calib_toggle(&slow);
+        int64_t echo = calib_wait_echo();
+        if (echo < 0) {
+            continue;
+        }
+        uint32_t rtt = (uint32_t)(echo - start);
+        total += rtt;
+        samples++;
+        if (rtt < result->rtt_min_us) {
+            result->rtt_min_us = rtt;
+        }
+        if (rtt > result->rtt_max_us) {
+            result->rtt_max_us = rtt;
+        }
+    }
+    result->echo = samples > 0;
+    result->rtt_avg_us = samples > 0 ? (uint32_t)(total / samples) : 0;
+    if (samples == 0) {
+        result->rtt_min_us = 0;
+    }
+}
+
+esp_err_t usb_hid_calibrate(usb_hid_calibration_t *result)
+{
+    if (!s_usb_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (result == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(result, 0, sizeof(*result));
+
+    // Typing waits until the run is over
+    xSemaphoreTake(s_hid_mutex, portMAX_DELAY);
+    s_calib_task = xTaskGetCurrentTaskHandle();
+    bool numlock_before = (s_leds & KEYBOARD_LED_NUMLOCK) != 0;
+
+    calib_rtt(result);
+
+    // Toggle bursts at increasing rates; a burst is clean if every report
+    // went out and every toggle came back as an LED change. LED reports a
+    // host merges count as lost, so the result errs on the slow side.
+    int clean = -1;
+    for (int s = 0; result->echo && s < USB_HID_CALIB_STEPS; s++) {
+        usb_hid_calib_step_t *step = &result->step[s];
+        step->press_ms = s_calib_steps[s].press_ms;
+        step->release_ms = s_calib_steps[s].release_ms;
+
+        uint32_t changes = s_numlock_changes;
+        for (int i = 0; i < CONFIG_CALIBRATE_TOGGLES; i++) {
+            if (!calib_toggle(&s_calib_steps[s])) {
+                step->failed++;
+            }
+            step->sent++;
+        }
+        // Let late echoes arrive
+        delay_ms(CONFIG_CALIBRATE_ECHO_TIMEOUT_MS);
+        step->echoed = (uint8_t)(s_numlock_changes - changes);
+        result->steps = s + 1;
+
+        if (step->failed > 0 || step->echoed != step->sent) {
+            break;  // Faster steps only lose more
+        }
+        clean = s;
+    }
+
+    // A lossy burst can leave Num Lock flipped
+    if (result->echo && ((s_leds & KEYBOARD_LED_NUMLOCK) != 0) != numlock_before) {
+        ulTaskNotifyTake(pdTRUE, 0);
+        calib_toggle(&s_calib_steps[0]);
+        calib_wait_echo();
+    }
+
+    s_calib_task = NULL;
+    ulTaskNotifyTake(pdTRUE, 0);
+    xSemaphoreGive(s_hid_mutex);
+
+    if (!result->echo) {
+        ESP_LOGW(TAG, "Calibration: host does not echo Num Lock");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (clean < 0) {
+        ESP_LOGW(TAG, "Calibration: toggles lost even at %u/%u ms",
+                 s_calib_steps[0].press_ms, s_calib_steps[0].release_ms);
+        return ESP_FAIL;
+    }
+
+    // Fastest clean rate plus a safety margin
+    const host_speed_t *best = &s_calib_steps[clean];
+    result->speed.press_ms = best->press_ms + (best->press_ms * CONFIG_CALIBRATE_MARGIN_PCT + 99) / 100;
+    result->speed.release_ms = best->release_ms + (best->release_ms * CONFIG_CALIBRATE_MARGIN_PCT + 99) / 100;
+    ESP_LOGI(TAG, "Calibration: RTT %lu us avg, clean up to %u/%u ms, using %u/%u ms",
+             (unsigned long)result->rtt_avg_us, best->press_ms, best->release_ms,
+             result->speed.press_ms, result->speed.release_ms);
+    return ESP_OK;
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include "esp_err.h"
+#include "host_os.h"
 
 /**
  * Initialize USB HID keyboard
@@ -42,4 +43,47 @@ esp_err_t usb_hid_send_enter(void);
  */
 esp_err_t usb_hid_send_ctrl_key(char key);
 
+#define USB_HID_CALIB_STEPS 4
+
+/**
+ * One calibration rate
+ */
+typedef struct {
+    uint16_t press_ms;
+    uint16_t release_ms;
+    uint8_t sent;           // Num Lock toggles sent
+    uint8_t failed;         // Toggles with a report the endpoint refused
+    uint8_t echoed;         // Num Lock LED changes the host sent back
+} usb_hid_calib_step_t;
+
+/**
+ * Calibration result
+ */
+typedef struct {
+    bool echo;              // Host echoes Num Lock in its LED report
+    uint32_t rtt_min_us;    // Press report queued to LED report received
+    uint32_t rtt_avg_us;
+    uint32_t rtt_max_us;
+    int steps;              // Rates tried (stops at the first lossy one)
+    usb_hid_calib_step_t step[USB_HID_CALIB_STEPS];
+    host_speed_t speed;     // Fastest clean rate plus CONFIG_CALIBRATE_MARGIN_PCT
+} usb_hid_calibration_t;
+
+/**
+ * Measure how fast the host takes keystrokes
+ * Toggles Num Lock, first one at a time to time the LED echo, then in
+ * bursts at increasing rates until toggles get lost. Typing waits while
+ * it runs (a few seconds, on the caller's task); Num Lock ends as it
+ * started.
+ * @return ESP_ERR_NOT_SUPPORTED if the host never echoes Num Lock,
+ *         ESP_FAIL if even the slowest rate lost toggles
+ */
+esp_err_t usb_hid_calibrate(usb_hid_calibration_t *result);
+
+/**
+ * Send an editing shortcut in the form the host OS expects
+ * (e.g. delete word: Ctrl+Backspace, or Option+Backspace on macOS)
+ */
+esp_err_t usb_hid_send_shortcut(host_shortcut_t shortcut);
+
 #endif // USB_HID_H
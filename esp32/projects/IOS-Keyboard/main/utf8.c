@@ -0,0 +1,107 @@
+#include "utf8.h"
+
+#include <string.h>
+
+uint32_t utf8_decode_next(utf8_decoder_t *dec, const char *buf, size_t len, size_t *pos)
+{
+    while (*pos < len) {
+        uint8_t b = (uint8_t)buf[*pos];
+
+        if (dec->need == 0) {
+            (*pos)++;
+            if (b < 0x80) {
+                return b;
+            }
+            // Lead byte; the first continuation range excludes overlong
+            // forms (E0, F0), surrogates (ED) and values past U+10FFFF (F4)
+            if (b >= 0xC2 && b <= 0xDF) {
+                dec->need = 1;
+                dec->cp = b & 0x1F;
+                dec->lo = 0x80;
+                dec->hi = 0xBF;
+            } else if (b >= 0xE0 && b <= 0xEF) {
+                dec->need = 2;
+                dec->cp = b & 0x0F;
+                dec->lo = (b == 0xE0) ? 0xA0 : 0x80;
+                dec->hi = (b == 0xED) ? 0x9F : 0xBF;
+            } else if (b >= 0xF0 && b <= 0xF4) {
+                dec->need = 3;
+                dec->cp = b & 0x07;
+                dec->lo = (b == 0xF0) ? 0x90 : 0x80;
+                dec->hi = (b == 0xF4) ? 0x8F : 0xBF;
+            } else {
+                return UTF8_REPLACEMENT;    // C0, C1, F5-FF or a stray continuation
+            }
+            continue;
+        }
+
+        if (b < dec->lo || b > dec->hi) {
+            // Interrupted: replace what we have, restart at this byte
+            utf8_decoder_reset(dec);
+            return UTF8_REPLACEMENT;
+        }
+        (*pos)++;
+        dec->cp = (dec->cp << 6) | (b & 0x3F);
+        dec->lo = 0x80;     // Only the first continuation byte is restricted
+        dec->hi = 0xBF;
+        if (--dec->need == 0) {
+            uint32_t cp = dec->cp;
+            dec->cp = 0;
+            return cp;
+        }
+    }
+    return UTF8_NEED_MORE;
+}
+
+size_t utf8_ascii_span(const char *buf, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t w;
+        memcpy(&w, buf + i, sizeof(w));
+        if (w & 0x8080808080808080ull) {
+            break;
+        }
+    }
+    if (i + 4 <= len) {
+        uint32_t w;
+        memcpy(&w, buf + i, sizeof(w));
+        if ((w & 0x80808080u) == 0) {
+            i += 4;
+        }
+    }
+    while (i < len && ((uint8_t)buf[i] & 0x80) == 0) {
+        i++;
+    }
+    return i;
+}
+
+size_t utf8_count(utf8_decoder_t *dec, const char *buf, size_t len, size_t *invalid)
+{
+    size_t count = 0;
+    size_t bad = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        if (!utf8_decoder_pending(dec)) {
+            size_t ascii = utf8_ascii_span(buf + pos, len - pos);
+            count += ascii;
+            pos += ascii;
+            if (pos == len) {
+                break;
+            }
+        }
+        uint32_t cp = utf8_decode_next(dec, buf, len, &pos);
+        if (cp == UTF8_NEED_MORE) {
+            break;
+        }
+        count++;
+        bad += (cp == UTF8_REPLACEMENT);
+    }
+
+    if (invalid != NULL) {
+        *invalid = bad;
+    }
+    return count;
+}
@@ -0,0 +1,69 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Streaming UTF-8 decoder
+ *
+ * Length-bounded: never reads past len and never needs a terminator. A
+ * sequence cut off at the end of a buffer is kept in the decoder and
+ * completed by the next buffer (e.g. the next BLE insert). Overlong forms,
+ * surrogates, code points above U+10FFFF, stray continuation bytes and
+ * interrupted sequences each decode to one U+FFFD, so a broken sequence
+ * never turns into a wrong character.
+ */
+
+#define UTF8_REPLACEMENT    0xFFFD
+#define UTF8_NEED_MORE      0xFFFFFFFFu     // Buffer ended inside a sequence
+
+typedef struct {
+    uint32_t cp;            // Bits collected so far
+    uint8_t need;           // Continuation bytes still expected (0: idle)
+    uint8_t lo;             // Valid range of the next continuation byte
+    uint8_t hi;
+} utf8_decoder_t;
+
+/**
+ * Reset to the idle state, dropping any partial sequence
+ */
+static inline void utf8_decoder_reset(utf8_decoder_t *dec)
+{
+    dec->cp = 0;
+    dec->need = 0;
+    dec->lo = 0x80;
+    dec->hi = 0xBF;
+}
+
+/**
+ * True while a sequence is incomplete
+ */
+static inline bool utf8_decoder_pending(const utf8_decoder_t *dec)
+{
+    return dec->need != 0;
+}
+
+/**
+ * Decode the next code point from buf[*pos..len)
+ * Advances *pos past the bytes used. Returns UTF8_NEED_MORE (with *pos ==
+ * len) when the buffer ends inside a sequence; the state carries over.
+ * A byte that interrupts a sequence is not consumed: the call returns
+ * U+FFFD and the next call starts a new sequence with that byte.
+ */
+uint32_t utf8_decode_next(utf8_decoder_t *dec, const char *buf, size_t len, size_t *pos);
+
+/**
+ * Length of the ASCII run at the start of buf (checks 8, then 4 bytes at a
+ * time)
+ */
+size_t utf8_ascii_span(const char *buf, size_t len);
+
+/**
+ * Decode a whole buffer and count code points
+ * @param invalid Optional: U+FFFD produced (malformed input, or a literal U+FFFD)
+ */
+size_t utf8_count(utf8_decoder_t *dec, const char *buf, size_t len, size_t *invalid);
+
+#endif // UTF8_H
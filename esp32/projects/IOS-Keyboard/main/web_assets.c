@@ -0,0 +1,291 @@
+#include "web_assets.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "web_assets";
+
+// Gzipped assets embedded by main/CMakeLists.txt (tools/gzip_asset.py)
+extern const uint8_t debug_html_gz_start[] asm("_binary_debug_html_gz_start");
+extern const uint8_t debug_html_gz_end[] asm("_binary_debug_html_gz_end");
+extern const uint8_t captive_html_gz_start[] asm("_binary_captive_html_gz_start");
+extern const uint8_t captive_html_gz_end[] asm("_binary_captive_html_gz_end");
+
+typedef struct {
+    const char *name;
+    const char *type;
+    const uint8_t *start;
+    const uint8_t *end;
+    uint32_t etag;          // Computed on first use
+} embedded_asset_t;
+
+static embedded_asset_t s_embedded[] = {
+    { "debug.html",   "text/html", debug_html_gz_start,   debug_html_gz_end,   0 },
+    { "captive.html", "text/html", captive_html_gz_start, captive_html_gz_end, 0 },
+};
+
+// Asset pack layout (see tools/pack_assets.py)
+#define PACK_MAGIC      0x50575757  // "WWWP"
+#define PACK_VERSION    2
+#define PACK_PARTITION  "spiffs"
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t size;          // Whole pack including this header
+    uint32_t crc;           // CRC32 of everything after the header
+    uint8_t elf_sha256[32]; // Firmware the pack was built with (app ELF hash)
+} pack_header_t;
+
+typedef struct __attribute__((packed)) {
+    char name[32];
+    char type[24];
+    uint32_t offset;        // From the start of the pack
+    uint32_t length;
+    uint32_t etag;
+} pack_entry_t;
+
+static const esp_partition_t *s_partition = NULL;
+static const uint8_t *s_pack = NULL;            // Mapped pack (flash, read-only)
+static esp_partition_mmap_handle_t s_pack_handle;
+static web_assets_store_t s_store = WEB_ASSETS_STORE_EMPTY;
+
+// Check a mapped pack; all offsets must stay inside it
+static bool pack_valid(const uint8_t *pack, uint32_t size)
+{
+    const pack_header_t *hdr = (const pack_header_t *)pack;
+    if (hdr->version != PACK_VERSION ||
+        sizeof(pack_header_t) + hdr->count * sizeof(pack_entry_t) > size) {
+        return false;
+    }
+    if (esp_rom_crc32_le(0, pack + sizeof(pack_header_t), size - sizeof(pack_header_t)) != hdr->crc) {
+        return false;
+    }
+
+    const pack_entry_t *entries = (const pack_entry_t *)(pack + sizeof(pack_header_t));
+    for (int i = 0; i < hdr->count; i++) {
+        if (entries[i].offset > size || entries[i].length > size - entries[i].offset ||
+            memchr(entries[i].name, '\0', sizeof(entries[i].name)) == NULL ||
+            memchr(entries[i].type, '\0', sizeof(entries[i].type)) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void pack_unmap(void)
+{
+    if (s_pack != NULL) {
+        esp_partition_munmap(s_pack_handle);
+        s_pack = NULL;
+    }
+    s_store = WEB_ASSETS_STORE_EMPTY;
+}
+
+static esp_err_t pack_map(void)
+{
+    pack_unmap();
+
+    pack_header_t hdr;
+    esp_err_t ret = esp_partition_read(s_partition, 0, &hdr, sizeof(hdr));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (hdr.magic != PACK_MAGIC) {
+        return ESP_OK;  // Erased or never written
+    }
+    if (hdr.size < sizeof(hdr) || hdr.size > s_partition->size) {
+        s_store = WEB_ASSETS_STORE_INVALID;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const void *ptr;
+    ret = esp_partition_mmap(s_partition, 0, hdr.size, ESP_PARTITION_MMAP_DATA, &ptr, &s_pack_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "mmap failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    if (!pack_valid(ptr, hdr.size)) {
+        ESP_LOGW(TAG, "Asset pack is damaged, using embedded assets");
+        esp_partition_munmap(s_pack_handle);
+        s_store = WEB_ASSETS_STORE_INVALID;
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // A pack left over from older firmware (e.g. after an OTA) would hide
+    // the UI that matches this build
+    if (memcmp(hdr.elf_sha256, esp_app_get_description()->app_elf_sha256, sizeof(hdr.elf_sha256)) != 0) {
+        ESP_LOGW(TAG, "Asset pack was built for other firmware, using embedded assets");
+        esp_partition_munmap(s_pack_handle);
+        s_store = WEB_ASSETS_STORE_STALE;
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    s_pack = ptr;
+    s_store = WEB_ASSETS_STORE_VALID;
+    ESP_LOGI(TAG, "Asset pack mapped: %d files, %" PRIu32 " bytes", hdr.count, hdr.size);
+    return ESP_OK;
+}
+
+esp_err_t web_assets_init(void)
+{
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PACK_PARTITION);
+    if (s_partition == NULL) {
+        ESP_LOGW(TAG, "No '%s' partition, using embedded assets", PACK_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t ret = pack_map();
+    return ret == ESP_ERR_INVALID_VERSION ? ESP_OK : ret;    // Stale pack: embedded assets
+}
+
+// Send compressed bytes with caching headers (data may live in mapped flash)
+static esp_err_t send_gzip(httpd_req_t *req, const char *type, const uint8_t *data,
+                           size_t len, uint32_t etag)
+{
+    // httpd keeps the header pointer until the response is sent
+    char etag_str[12];
+    snprintf(etag_str, sizeof(etag_str), "\"%08" PRIx32 "\"", etag);
+
+    httpd_resp_set_hdr(req, "ETag", etag_str);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    char if_none_match[sizeof(etag_str) + 8];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                    sizeof(if_none_match)) == ESP_OK &&
+        strcmp(if_none_match, etag_str) == 0) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)data, len);
+}
+
+esp_err_t web_assets_send(httpd_req_t *req, const char *name)
+{
+    // Asset pack first (only mapped if built for this firmware), so UI
+    // updates override the embedded copy
+    if (s_pack != NULL) {
+        const pack_header_t *hdr = (const pack_header_t *)s_pack;
+        const pack_entry_t *entries = (const pack_entry_t *)(s_pack + sizeof(pack_header_t));
+        for (int i = 0; i < hdr->count; i++) {
+            if (strcmp(entries[i].name, name) == 0) {
+                return send_gzip(req, entries[i].type, s_pack + entries[i].offset,
+                                 entries[i].length, entries[i].etag);
+            }
+        }
+    }
+
+    for (int i = 0; i < sizeof(s_embedded) / sizeof(s_embedded[0]); i++) {
+        embedded_asset_t *asset = &s_embedded[i];
+        if (strcmp(asset->name, name) == 0) {
+            size_t len = asset->end - asset->start;
+            if (asset->etag == 0) {
+                asset->etag = esp_rom_crc32_le(0, asset->start, len);
+            }
+            return send_gzip(req, asset->type, asset->start, len, asset->etag);
+        }
+    }
+
+    ESP_LOGW(TAG, "Unknown asset: %s", name);
+    httpd_resp_send_404(req);
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t web_assets_receive(httpd_req_t *req)
+{
+    if (s_partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    size_t total = req->content_len;
+    if (total < sizeof(pack_header_t) || total > s_partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Nothing may read the old mapping while it is being erased
+    pack_unmap();
+
+    size_t erase_len = (total + s_partition->erase_size - 1) & ~(s_partition->erase_size - 1);
+    esp_err_t ret = esp_partition_erase_range(s_partition, 0, erase_len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    // Magic is held back and written last to commit the pack
+    uint32_t magic = 0;
+    size_t received = 0;
+    char buf[1024];
+    while (received < total) {
+        int n = httpd_req_recv(req, buf, sizeof(buf));
+        if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+
+        size_t skip = 0;
+        if (received < sizeof(magic)) {
+            skip = sizeof(magic) - received;
+            if (skip > n) {
+                skip = n;
+            }
+            memcpy((uint8_t *)&magic + received, buf, skip);
+        }
+        if (n > skip) {
+            ret = esp_partition_write(s_partition, received + skip, buf + skip, n - skip);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+        received += n;
+    }
+
+    if (magic != PACK_MAGIC) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    ret = esp_partition_write(s_partition, 0, &magic, sizeof(magic));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = pack_map();
+    if (ret != ESP_OK) {
+        // Leave an empty store rather than a damaged or foreign pack
+        esp_partition_erase_range(s_partition, 0, s_partition->erase_size);
+        s_store = WEB_ASSETS_STORE_EMPTY;
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Asset pack updated (%u bytes)", (unsigned)total);
+    return ESP_OK;
+}
+
+web_assets_store_t web_assets_get_store(int *count)
+{
+    if (count != NULL) {
+        *count = s_pack != NULL ? ((const pack_header_t *)s_pack)->count : 0;
+    }
+    return s_store;
+}
+
+bool web_assets_get_info(int index, web_asset_info_t *info)
+{
+    if (s_pack == NULL || index < 0 || index >= ((const pack_header_t *)s_pack)->count) {
+        return false;
+    }
+    const pack_entry_t *entry = (const pack_entry_t *)(s_pack + sizeof(pack_header_t)) + index;
+    info->name = entry->name;
+    info->type = entry->type;
+    info->size = entry->length;
+    info->etag = entry->etag;
+    return true;
+}
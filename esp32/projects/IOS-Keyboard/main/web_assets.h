@@ -0,0 +1,65 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/**
+ * Asset pack state
+ */
+typedef enum {
+    WEB_ASSETS_STORE_EMPTY,     // No pack in the partition (embedded assets only)
+    WEB_ASSETS_STORE_VALID,     // Pack mapped and served
+    WEB_ASSETS_STORE_INVALID,   // Partition holds a damaged or unknown pack
+    WEB_ASSETS_STORE_STALE,     // Pack built for other firmware (not served)
+} web_assets_store_t;
+
+/**
+ * One file in the asset pack
+ */
+typedef struct {
+    const char *name;
+    const char *type;
+    uint32_t size;          // Compressed size
+    uint32_t etag;          // CRC32 of the compressed data
+} web_asset_info_t;
+
+/**
+ * Map the asset pack from the "spiffs" partition (if present)
+ */
+esp_err_t web_assets_init(void);
+
+/**
+ * Send a web UI asset (e.g. "debug.html")
+ * Looks in the asset pack first, then in the assets embedded in the
+ * firmware. The pack is only used if it was built with this firmware
+ * (its header carries the app ELF SHA-256), so an OTA never leaves an
+ * older UI in front of the new one. Assets are gzipped at build time and sent with
+ * Content-Encoding: gzip and a strong ETag; a matching If-None-Match
+ * gets 304 Not Modified.
+ * @return ESP_ERR_NOT_FOUND (after sending 404) for an unknown name
+ */
+esp_err_t web_assets_send(httpd_req_t *req, const char *name);
+
+/**
+ * Replace the asset pack with the request body (tools/pack_assets.py output)
+ * The pack is written with its magic last, so an interrupted upload
+ * leaves an empty store rather than a damaged one. A pack built for other
+ * firmware is erased again (ESP_ERR_INVALID_VERSION).
+ */
+esp_err_t web_assets_receive(httpd_req_t *req);
+
+/**
+ * Get store state and number of files in the pack
+ */
+web_assets_store_t web_assets_get_store(int *count);
+
+/**
+ * Get a file from the pack
+ * @return false if index is out of range
+ */
+bool web_assets_get_info(int index, web_asset_info_t *info);
+
+#endif // WEB_ASSETS_H
@@ -1,5 +1,6 @@
 #include "wifi_manager.h"
 #include "config.h"
+#include "settings.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
@@ -9,8 +10,6 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
-#include "nvs_flash.h"
-#include "nvs.h"
 #include "esp_netif.h"
 
 static const char *TAG = "wifi_mgr";
@@ -34,17 +33,6 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base,
 
 esp_err_t wifi_manager_init(void)
 {
-    esp_err_t ret;
-
-    // Initialize NVS
-    ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_LOGW(TAG, "NVS partition was truncated, erasing...");
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
-
     // Create event group
     s_wifi_event_group = xEventGroupCreate();
     if (s_wifi_event_group == NULL) {
@@ -179,34 +167,22 @@ esp_err_t wifi_manager_start_ap(void)
 esp_err_t wifi_manager_start_sta(void)
 {
     esp_err_t ret;
-    nvs_handle_t nvs;
     char ssid[33] = {0};
     char password[65] = {0};
-    size_t ssid_len = sizeof(ssid);
-    size_t pass_len = sizeof(password);
 
-    // Read credentials from NVS
-    ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    // Read credentials (cached by the settings store)
+    ret = settings_get_str(SETTING_WIFI_SSID, ssid, sizeof(ssid));
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS");
+        ESP_LOGE(TAG, "No stored SSID");
         return ret;
     }
 
-    ret = nvs_get_str(nvs, CONFIG_NVS_KEY_SSID, ssid, &ssid_len);
+    ret = settings_get_str(SETTING_WIFI_PASS, password, sizeof(password));
     if (ret != ESP_OK) {
-        nvs_close(nvs);
-        ESP_LOGE(TAG, "Failed to read SSID from NVS");
+        ESP_LOGE(TAG, "No stored password");
         return ret;
     }
 
-    ret = nvs_get_str(nvs, CONFIG_NVS_KEY_PASS, password, &pass_len);
-    if (ret != ESP_OK) {
-        nvs_close(nvs);
-        ESP_LOGE(TAG, "Failed to read password from NVS");
-        return ret;
-    }
-    nvs_close(nvs);
-
     esp_wifi_stop();  // Stop WiFi if running (ignore errors)
 
     wifi_config_t wifi_config = {
@@ -247,53 +223,31 @@ esp_err_t wifi_manager_start_sta(void)
 
 bool wifi_manager_has_credentials(void)
 {
-    nvs_handle_t nvs;
-    esp_err_t ret;
-
-    ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs);
-    if (ret != ESP_OK) {
-        return false;
-    }
-
-    size_t ssid_len = 0;
-    ret = nvs_get_str(nvs, CONFIG_NVS_KEY_SSID, NULL, &ssid_len);
-    nvs_close(nvs);
-
-    return (ret == ESP_OK && ssid_len > 1);
+    char ssid[33];
+    return settings_get_str(SETTING_WIFI_SSID, ssid, sizeof(ssid)) == ESP_OK && ssid[0] != '\0';
 }
 
 esp_err_t wifi_manager_save_credentials(const char *ssid, const char *password)
 {
-    nvs_handle_t nvs;
     esp_err_t ret;
 
     if (ssid == NULL || strlen(ssid) == 0) {
         return ESP_ERR_INVALID_ARG;
     }
 
-    ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open NVS for writing");
-        return ret;
-    }
-
-    ret = nvs_set_str(nvs, CONFIG_NVS_KEY_SSID, ssid);
+    // Both keys go out in one commit (at the latest on esp_restart)
+    ret = settings_set_str(SETTING_WIFI_SSID, ssid);
     if (ret != ESP_OK) {
-        nvs_close(nvs);
         ESP_LOGE(TAG, "Failed to save SSID");
         return ret;
     }
 
-    ret = nvs_set_str(nvs, CONFIG_NVS_KEY_PASS, password ? password : "");
+    ret = settings_set_str(SETTING_WIFI_PASS, password ? password : "");
     if (ret != ESP_OK) {
-        nvs_close(nvs);
         ESP_LOGE(TAG, "Failed to save password");
         return ret;
     }
 
-    ret = nvs_commit(nvs);
-    nvs_close(nvs);
-
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "Credentials saved for SSID: %s", ssid);
     }
@@ -303,18 +257,8 @@ esp_err_t wifi_manager_save_credentials(const char *ssid, const char *password)
 
 esp_err_t wifi_manager_clear_credentials(void)
 {
-    nvs_handle_t nvs;
-    esp_err_t ret;
-
-    ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
-    if (ret != ESP_OK) {
-        return ret;
-    }
-
-    nvs_erase_key(nvs, CONFIG_NVS_KEY_SSID);
-    nvs_erase_key(nvs, CONFIG_NVS_KEY_PASS);
-    ret = nvs_commit(nvs);
-    nvs_close(nvs);
+    settings_erase(SETTING_WIFI_SSID);
+    esp_err_t ret = settings_erase(SETTING_WIFI_PASS);
 
     ESP_LOGI(TAG, "Credentials cleared");
     return ret;
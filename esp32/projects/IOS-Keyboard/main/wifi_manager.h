@@ -22,7 +22,7 @@ typedef struct {
 
 /**
  * Initialize the WiFi manager
- * Initializes NVS, WiFi, and event handlers
+ * Initializes WiFi and event handlers (settings_init must run first)
  */
 esp_err_t wifi_manager_init(void);
 
@@ -43,17 +43,17 @@ esp_err_t wifi_manager_start_ap(void);
 esp_err_t wifi_manager_start_sta(void);
 
 /**
- * Check if WiFi credentials are stored in NVS
+ * Check if WiFi credentials are stored
  */
 bool wifi_manager_has_credentials(void);
 
 /**
- * Save WiFi credentials to NVS
+ * Save WiFi credentials (committed to flash in the background and before a restart)
  */
 esp_err_t wifi_manager_save_credentials(const char *ssid, const char *password);
 
 /**
- * Clear stored WiFi credentials from NVS
+ * Clear stored WiFi credentials
  */
 esp_err_t wifi_manager_clear_credentials(void);
 
@@ -0,0 +1,110 @@
+#include "ws_ingest.h"
+#include "config.h"
+#include "ingest.h"
+#include "debug_server.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "esp_log.h"
+
+static const char *TAG = "ws_ingest";
+
+static void ack_sent(esp_err_t err, int fd, void *arg)
+{
+    free(arg);
+}
+
+// Queue an ack on the server task (safe from any task)
+static void send_ack(httpd_handle_t server, int fd, uint8_t opcode, uint8_t status, uint32_t seq)
+{
+    uint8_t *ack = malloc(8);
+    if (ack == NULL) {
+        return;
+    }
+    ack[0] = WS_ACK;
+    ack[1] = opcode;
+    ack[2] = status;
+    ack[3] = (uint8_t)MIN(ingest_pending(INGEST_SRC_WS), 255);
+    memcpy(&ack[4], &seq, sizeof(seq));
+
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = ack,
+        .len = 8,
+    };
+    if (httpd_ws_send_data_async(server, fd, &frame, ack_sent, ack) != ESP_OK) {
+        free(ack);
+    }
+}
+
+// Ingest completion: cookie carries the socket (high word) and frame sequence
+static void command_done(esp_err_t result, const uint8_t *data, size_t len, void *ctx, uint64_t cookie)
+{
+    uint8_t status = result == ESP_OK ? WS_ACK_OK :
+                     result == ESP_ERR_NOT_FINISHED ? WS_ACK_BUSY : WS_ACK_ERROR;
+    send_ack(ctx, (int)(cookie >> 32), data[0], status, (uint32_t)cookie);
+}
+
+esp_err_t ws_ingest_handler(httpd_req_t *req)
+{
+    int fd = httpd_req_to_sockfd(req);
+
+    if (req->method == HTTP_GET) {
+        // Handshake: acks are tiny, don't let Nagle hold them back
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        // Per-connection frame counter, freed by the server on close
+        req->sess_ctx = calloc(1, sizeof(uint32_t));
+        req->free_ctx = free;
+        debug_server_log("WebSocket ingest client connected");
+        return ESP_OK;
+    }
+
+    httpd_ws_frame_t frame = { 0 };
+    esp_err_t err = httpd_ws_recv_frame(req, &frame, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame.type != HTTPD_WS_TYPE_BINARY) {
+        // Text and control frames carry no commands
+        return ESP_OK;
+    }
+
+    static uint8_t data[CONFIG_INGEST_MAX_CMD];    // Server task only
+    uint32_t *counter = req->sess_ctx;
+    uint32_t seq = (counter != NULL) ? ++*counter : 0;
+
+    if (frame.len == 0 || frame.len > sizeof(data)) {
+        ESP_LOGW(TAG, "Bad frame length %u", (unsigned)frame.len);
+        if (frame.len > 0) {
+            // Drain the payload so the connection stays in sync
+            uint8_t *discard = malloc(frame.len);
+            frame.payload = discard;
+            err = (discard != NULL) ? httpd_ws_recv_frame(req, &frame, frame.len) : ESP_ERR_NO_MEM;
+            free(discard);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        send_ack(req->handle, fd, 0, WS_ACK_ERROR, seq);
+        return ESP_OK;
+    }
+
+    frame.payload = data;
+    err = httpd_ws_recv_frame(req, &frame, sizeof(data));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint64_t cookie = ((uint64_t)fd << 32) | seq;
+    if (ingest_submit(INGEST_SRC_WS, data, frame.len, 0, command_done, req->handle, cookie) != ESP_OK) {
+        send_ack(req->handle, fd, data[0], WS_ACK_BUSY, seq);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,33 @@
+#ifndef WS_INGEST_H
+#define WS_INGEST_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/**
+ * WebSocket command ingest (/ws)
+ *
+ * Each binary frame carries one command packet in the BLE format
+ * (CMD_BACKSPACE/CMD_INSERT/CMD_ENTER/CMD_CTRL_KEY/CMD_LAYOUT/CMD_SHORTCUT,
+ * see command_parser.h).
+ * Commands go through the ingest bus (INGEST_SRC_WS) and run in order;
+ * every frame is answered with an 8-byte binary ack:
+ *
+ *   [0]    WS_ACK (0x80)
+ *   [1]    Opcode of the command
+ *   [2]    Status (WS_ACK_OK / WS_ACK_ERROR / WS_ACK_BUSY)
+ *   [3]    Commands still queued after this one
+ *   [4..7] Frame sequence number on this connection (uint32 LE, from 1)
+ */
+#define WS_ACK          0x80
+
+#define WS_ACK_OK       0   // Keystrokes queued to USB
+#define WS_ACK_ERROR    1   // Parser or HID error
+#define WS_ACK_BUSY     2   // Ingest queue full (or flushed), command dropped
+
+/**
+ * URI handler for the /ws endpoint (register with is_websocket = true)
+ */
+esp_err_t ws_ingest_handler(httpd_req_t *req);
+
+#endif // WS_INGEST_H
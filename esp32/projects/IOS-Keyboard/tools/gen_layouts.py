@@ -0,0 +1,416 @@
+#!/usr/bin/env python3
+"""Compile keyboard layout definitions into lookup tables.
+
+Usage: gen_layouts.py <output.c> <file.layout> [<file.layout> ...]
+       gen_layouts.py --pack <output.bin> <file.layout> [<file.layout> ...]
+
+The C output defines layout_table_info[] and layout_tables[] (see
+main/layout_tables.h) in the order the files are given, which must match
+keyboard_layout_t. The --pack output is a layout pack for the "layouts"
+data partition; layout_pack.c maps it and adds its layouts at runtime.
+Upload it with
+    curl --data-binary @layouts.bin http://<device>/keyboard/pack
+or let `idf.py flash` write it.
+
+Layout file format (UTF-8, '#' starts a comment line):
+    code    ch-de                   short code (max 7 chars), also names LAYOUT_CH_DE
+    name    Swiss German            display name (max 23 chars)
+    country 28                      HID country code (default 33, US)
+    <KEY>   base [shift [altgr [shift+altgr]]]
+    seq     <char> <stroke> [<stroke> ...]
+    dead    <stroke> <char> <combining mark>
+<KEY> is a HID key name without the HID_KEY_ prefix (A, 1, MINUS,
+EUROPE_2, ...). Each character is a literal UTF-8 character, U+XXXX,
+space, tab or newline; 'none' leaves that level empty. A key may appear
+on several rows to type more than one character per level. A seq line
+types a character as up to 4 keystrokes, each [shift+][altgr+]<KEY> (e.g.
+a dead key, then the base letter). A dead line declares a dead key: its
+<char> (e.g. ^) is typed as the dead key, then space, and every
+Latin-1 letter that composes from the mark (U+0302 for ^) and a plain key
+of the layout gets a dead key sequence, unless the layout already types
+it. The dead stroke itself must not be on a key row. Sequences with the
+same keystrokes are stored once. The first row or seq line that types a
+character is its primary path; up to 3 later ones become alternatives,
+which the planner picks when they need fewer keystrokes or modifier
+changes next to the surrounding text. Every layout also gets the keypad
+as an alternative for 0-9 / * - + (KEYPAD_* key names) where typing them
+needs a modifier.
+
+Tables per layout:
+    ascii   u16[128], indexed by codepoint
+    ext     minimal perfect hash of the non-ASCII codepoints (hash and
+            displace): bucket = reduce(mix(cp, 0)), slot =
+            reduce(mix(cp, seed[bucket])); the slot holds the codepoint to
+            confirm the hit. mix() and reduce() must match keyboard_layout.c.
+    alt     codepoints with alternative paths, ascending, and u16[3] entries
+            each (0-padded); ASCII ones are also in a 128-bit bitmap
+Entries are keycode | modifiers << 8, 0 for unmapped; keycode 0 with
+a non-zero high byte n selects key sequence n - 1 (u16[4], 0-padded).
+
+Pack layout (little endian):
+    header  magic "KLPK", u16 version, u16 count, u32 size, u32 crc32
+    entry   char code[8], char name[24], u8 country, u8 reserved,
+            u16 ext_count, u16 seq_count, u16 alt_count, u32 offset, u32 length
+    data    per layout, 4-byte aligned: u16 ascii[128], u16 ext_seed[n],
+            pad, u32 ext_cp[n], u16 ext_key[n], pad, u16 seq[seq_count][4],
+            pad, u32 alt_cp[alt_count], u16 alt[alt_count][3]
+crc32 covers everything after the header. alt_count was reserved (0) in
+packs from older generators, which simply have no alternatives.
+"""
+import os
+import struct
+import sys
+import unicodedata
+import zlib
+
+MOD_SHIFT = 0x02    # KEYBOARD_MODIFIER_LEFTSHIFT
+MOD_ALTGR = 0x40    # KEYBOARD_MODIFIER_RIGHTALT
+LEVELS = (0, MOD_SHIFT, MOD_ALTGR, MOD_SHIFT | MOD_ALTGR)
+
+# HID keyboard usages (HID Usage Tables, page 0x07)
+KEYS = {chr(ord('A') + i): 0x04 + i for i in range(26)}
+KEYS.update({str((i + 1) % 10): 0x1E + i for i in range(10)})
+KEYS.update({
+    'ENTER': 0x28, 'TAB': 0x2B, 'SPACE': 0x2C, 'MINUS': 0x2D, 'EQUAL': 0x2E,
+    'BRACKET_LEFT': 0x2F, 'BRACKET_RIGHT': 0x30, 'BACKSLASH': 0x31,
+    'EUROPE_1': 0x32, 'SEMICOLON': 0x33, 'APOSTROPHE': 0x34, 'GRAVE': 0x35,
+    'COMMA': 0x36, 'PERIOD': 0x37, 'SLASH': 0x38, 'EUROPE_2': 0x64,
+    'KEYPAD_DIVIDE': 0x54, 'KEYPAD_MULTIPLY': 0x55, 'KEYPAD_SUBTRACT': 0x56,
+    'KEYPAD_ADD': 0x57,
+})
+KEYS.update({f'KEYPAD_{(i + 1) % 10}': 0x59 + i for i in range(10)})
+
+# Same on every layout (the digits only with Num Lock on; the planner checks)
+KEYPAD = {str(i): KEYS[f'KEYPAD_{i}'] for i in range(10)}
+KEYPAD.update({'/': KEYS['KEYPAD_DIVIDE'], '*': KEYS['KEYPAD_MULTIPLY'],
+               '-': KEYS['KEYPAD_SUBTRACT'], '+': KEYS['KEYPAD_ADD']})
+
+NAMED = {'space': 0x20, 'tab': 0x09, 'newline': 0x0A}
+
+SEQ_MAX = 4
+SEQ_LIMIT = 255
+ALT_MAX = 3
+
+PACK_MAGIC = b'KLPK'
+PACK_VERSION = 1
+PACK_HEADER = struct.Struct('<4sHHII')
+PACK_ENTRY = struct.Struct('<8s24sBBHHHII')
+
+MASK = 0xFFFFFFFF
+
+
+def mix(cp, seed):
+    h = ((cp ^ seed) * 0x9E3779B1) & MASK
+    h ^= h >> 16
+    h = (h * 0x85EBCA6B) & MASK
+    h ^= h >> 13
+    return h
+
+
+def reduce(h, n):
+    return (h * n) >> 32
+
+
+class LayoutError(Exception):
+    pass
+
+
+def parse_char(token):
+    if token in NAMED:
+        return NAMED[token]
+    if token.startswith('U+') and len(token) > 2:
+        return int(token[2:], 16)
+    if len(token) == 1:
+        return ord(token)
+    raise LayoutError(f"bad character '{token}'")
+
+
+def parse_stroke(token):
+    mods = 0
+    while True:
+        if token.startswith('shift+'):
+            mods |= MOD_SHIFT
+            token = token[6:]
+        elif token.startswith('altgr+'):
+            mods |= MOD_ALTGR
+            token = token[6:]
+        else:
+            break
+    if token not in KEYS:
+        raise LayoutError(f"unknown key '{token}'")
+    return KEYS[token] | (mods << 8)
+
+
+class Layout:
+    def __init__(self):
+        self.code = None
+        self.name = None
+        self.country = 33
+        self.keymap = {}    # codepoint -> table entry (primary path)
+        self.alts = {}      # codepoint -> [table entry, ...]
+        self.seqs = []      # [[stroke, ...], ...]
+        self.deads = []     # [(stroke, char, mark, lineno), ...]
+
+    def add_seq(self, cp, strokes):
+        # Identical keystrokes share one sequence
+        if strokes in self.seqs:
+            self.add(cp, (self.seqs.index(strokes) + 1) << 8)
+            return
+        if len(self.seqs) == SEQ_LIMIT:
+            raise LayoutError(f'more than {SEQ_LIMIT} sequences')
+        self.seqs.append(strokes)
+        self.add(cp, len(self.seqs) << 8)
+
+    def add(self, cp, entry):
+        if cp not in self.keymap:
+            self.keymap[cp] = entry
+            return
+        alts = self.alts.setdefault(cp, [])
+        if entry == self.keymap[cp] or entry in alts:
+            raise LayoutError(f'U+{cp:04X} is mapped twice to the same keys')
+        if len(alts) == ALT_MAX:
+            raise LayoutError(f'U+{cp:04X} has more than {ALT_MAX} alternatives')
+        alts.append(entry)
+
+
+def parse_layout(path):
+    layout = Layout()
+    with open(path, encoding='utf-8') as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.rstrip('\n')
+            if not line.strip() or line.lstrip().startswith('#'):
+                continue
+            try:
+                key, _, rest = line.strip().partition(' ')
+                if key == 'code':
+                    layout.code = rest.strip()
+                    continue
+                if key == 'name':
+                    layout.name = rest.strip()
+                    continue
+                if key == 'country':
+                    layout.country = int(rest, 0)
+                    continue
+                if key == 'seq':
+                    tokens = rest.split()
+                    if not 2 <= len(tokens) <= SEQ_MAX + 1:
+                        raise LayoutError(f'expected a character and 1-{SEQ_MAX} keystrokes')
+                    layout.add_seq(parse_char(tokens[0]), [parse_stroke(t) for t in tokens[1:]])
+                    continue
+                if key == 'dead':
+                    tokens = rest.split()
+                    if len(tokens) != 3:
+                        raise LayoutError('expected a keystroke, a character and a combining mark')
+                    layout.deads.append((parse_stroke(tokens[0]), parse_char(tokens[1]),
+                                         parse_char(tokens[2]), lineno))
+                    continue
+                if key not in KEYS:
+                    raise LayoutError(f"unknown key '{key}'")
+                tokens = rest.split()
+                if not 1 <= len(tokens) <= len(LEVELS):
+                    raise LayoutError('expected 1-4 characters')
+                for token, mods in zip(tokens, LEVELS):
+                    if token == 'none':
+                        continue
+                    layout.add(parse_char(token), KEYS[key] | (mods << 8))
+            except (LayoutError, ValueError) as e:
+                raise LayoutError(f'{path}:{lineno}: {e}') from None
+    for stroke, cp, mark, lineno in layout.deads:
+        try:
+            add_dead_key(layout, stroke, cp, mark)
+        except LayoutError as e:
+            raise LayoutError(f'{path}:{lineno}: {e}') from None
+    try:
+        for ch, key in KEYPAD.items():
+            primary = layout.keymap.get(ord(ch), 0)
+            if primary & 0xFF and primary >> 8 == 0:
+                continue    # Already one key without modifiers: nothing to gain
+            if key not in layout.alts.get(ord(ch), []) and primary != key:
+                layout.add(ord(ch), key)
+    except LayoutError as e:
+        raise LayoutError(f'{path}: keypad: {e}') from None
+    if not layout.code or not layout.name:
+        raise LayoutError(f'{path}: missing code or name')
+    if len(layout.code) > 7 or len(layout.name.encode()) > 23:
+        raise LayoutError(f'{path}: code or name too long')
+    return layout
+
+
+def add_dead_key(layout, stroke, cp, mark):
+    """Sequences for a dead key: the accent itself, then composed letters"""
+    if stroke in layout.keymap.values() or any(stroke in a for a in layout.alts.values()):
+        raise LayoutError('dead key is also on a key row')
+    layout.add_seq(cp, [stroke, KEYS['SPACE']])
+    # Plain keys only, in codepoint order so the output is stable
+    for base, entry in sorted(layout.keymap.items()):
+        if not entry & 0xFF or base <= 0x20:
+            continue
+        composed = unicodedata.normalize('NFC', chr(base) + chr(mark))
+        # Latin-1 only: composed reliably by the dead keys of every host OS
+        if len(composed) == 1 and 0xC0 <= ord(composed) <= 0xFF and ord(composed) not in layout.keymap:
+            layout.add_seq(ord(composed), [stroke, entry])
+
+
+def build_hash(cps):
+    """Return (seeds, slots): slots[i] is the codepoint stored in slot i"""
+    n = len(cps)
+    buckets = [[] for _ in range(n)]
+    for cp in cps:
+        buckets[reduce(mix(cp, 0), n)].append(cp)
+
+    seeds = [0] * n
+    slots = [None] * n
+    for b in sorted(range(n), key=lambda i: -len(buckets[i])):
+        if not buckets[b]:
+            break
+        for seed in range(1, 0x10000):
+            taken = [reduce(mix(cp, seed), n) for cp in buckets[b]]
+            if len(set(taken)) == len(taken) and all(slots[s] is None for s in taken):
+                break
+        else:
+            raise LayoutError('no perfect hash seed found')
+        seeds[b] = seed
+        for cp, s in zip(buckets[b], taken):
+            slots[s] = cp
+    return seeds, slots
+
+
+class Tables:
+    """Lookup tables for one layout"""
+    def __init__(self, layout):
+        self.ascii = [layout.keymap.get(cp, 0) for cp in range(128)]
+        ext = sorted(cp for cp in layout.keymap if cp >= 128)
+        self.seeds, self.ext_cp = build_hash(ext) if ext else ([], [])
+        self.ext_key = [layout.keymap[cp] for cp in self.ext_cp]
+        self.seq = [s + [0] * (SEQ_MAX - len(s)) for s in layout.seqs]
+        self.alt_cp = sorted(layout.alts)
+        self.alt = [layout.alts[cp] + [0] * (ALT_MAX - len(layout.alts[cp])) for cp in self.alt_cp]
+        self.alt_ascii = [0] * 4
+        for cp in self.alt_cp:
+            if cp < 128:
+                self.alt_ascii[cp // 32] |= 1 << (cp % 32)
+
+
+def c_array(ctype, name, values, fmt, per_line=8):
+    lines = [f'static const {ctype} {name}[{len(values)}] = {{']
+    for i in range(0, len(values), per_line):
+        lines.append('    ' + ', '.join(fmt.format(v) for v in values[i:i + per_line]) + ',')
+    lines.append('};')
+    return lines
+
+
+def write_c(out, paths, layouts):
+    src = [
+        '// Generated by tools/gen_layouts.py - do not edit',
+        '// Sources: ' + ' '.join(os.path.basename(p) for p in paths),
+        '#include "layout_tables.h"',
+        '',
+        f'_Static_assert(LAYOUT_COUNT == {len(layouts)}, "keyboard_layout_t does not match main/layouts");',
+    ]
+    entries = []
+    for layout in layouts:
+        ident = layout.code.replace('-', '_')
+        t = Tables(layout)
+        arrays = {'ext_seed': 'NULL', 'ext_cp': 'NULL', 'ext_key': 'NULL', 'seq': 'NULL',
+                  'alt_cp': 'NULL', 'alt': 'NULL'}
+
+        src += ['', f'// {layout.name} ({len(layout.keymap)} characters)']
+        src += c_array('uint16_t', f's_{ident}_ascii', t.ascii, '0x{:04X}')
+        if t.ext_cp:
+            src += c_array('uint16_t', f's_{ident}_ext_seed', t.seeds, '0x{:04X}')
+            src += c_array('uint32_t', f's_{ident}_ext_cp', t.ext_cp, '0x{:05X}', per_line=6)
+            src += c_array('uint16_t', f's_{ident}_ext_key', t.ext_key, '0x{:04X}')
+            arrays.update(ext_seed=f's_{ident}_ext_seed', ext_cp=f's_{ident}_ext_cp',
+                          ext_key=f's_{ident}_ext_key')
+        if t.seq:
+            src.append(f'static const uint16_t s_{ident}_seq[{len(t.seq)}][LAYOUT_SEQ_MAX] = {{')
+            for s in t.seq:
+                src.append('    { ' + ', '.join(f'0x{k:04X}' for k in s) + ' },')
+            src.append('};')
+            arrays['seq'] = f's_{ident}_seq'
+        if t.alt:
+            src += c_array('uint32_t', f's_{ident}_alt_cp', t.alt_cp, '0x{:05X}', per_line=6)
+            src.append(f'static const uint16_t s_{ident}_alt[{len(t.alt)}][LAYOUT_ALT_MAX] = {{')
+            for a in t.alt:
+                src.append('    { ' + ', '.join(f'0x{k:04X}' for k in a) + ' },')
+            src.append('};')
+            arrays.update(alt_cp=f's_{ident}_alt_cp', alt=f's_{ident}_alt')
+        entries.append((layout, ident, t, arrays))
+
+    src += ['', 'const keyboard_layout_info_t layout_table_info[LAYOUT_COUNT] = {']
+    for layout, ident, t, arrays in entries:
+        src.append(f'    {{ LAYOUT_{ident.upper()}, "{layout.code}", "{layout.name}", {layout.country}, false }},')
+    src += ['};', '', 'const layout_table_t layout_tables[LAYOUT_COUNT] = {']
+    for layout, ident, t, a in entries:
+        src.append(f'    [LAYOUT_{ident.upper()}] = {{ s_{ident}_ascii, {len(t.ext_cp)}, {len(t.seq)}, '
+                   f'{a["ext_seed"]}, {a["ext_cp"]}, {a["ext_key"]}, {a["seq"]}, {len(t.alt)}, '
+                   '{ ' + ', '.join(f'0x{w:08X}' for w in t.alt_ascii) + ' }, '
+                   f'{a["alt_cp"]}, {a["alt"]} }},')
+    src.append('};')
+
+    text = '\n'.join(src) + '\n'
+    # Leave an unchanged file alone so dependent objects are not rebuilt
+    if os.path.exists(out):
+        with open(out, encoding='utf-8') as f:
+            if f.read() == text:
+                return
+    with open(out, 'w', encoding='utf-8') as f:
+        f.write(text)
+
+
+def pad4(data):
+    return data + b'\0' * (-len(data) % 4)
+
+
+def write_pack(out, layouts):
+    blobs = []
+    for layout in layouts:
+        t = Tables(layout)
+        n = len(t.ext_cp)
+        blob = struct.pack(f'<128H{n}H', *t.ascii, *t.seeds)
+        blob = pad4(blob) + struct.pack(f'<{n}I{n}H', *t.ext_cp, *t.ext_key)
+        blob = pad4(blob) + struct.pack(f'<{len(t.seq) * SEQ_MAX}H', *[k for s in t.seq for k in s])
+        a = len(t.alt_cp)
+        blob = pad4(blob) + struct.pack(f'<{a}I{a * ALT_MAX}H', *t.alt_cp, *[k for e in t.alt for k in e])
+        blobs.append((layout, t, blob))
+
+    offset = PACK_HEADER.size + PACK_ENTRY.size * len(blobs)
+    table = b''
+    data = b''
+    for layout, t, blob in blobs:
+        table += PACK_ENTRY.pack(layout.code.encode(), layout.name.encode(), layout.country, 0,
+                                 len(t.ext_cp), len(t.seq), len(t.alt_cp), offset + len(data), len(blob))
+        data += blob
+    body = table + data
+    header = PACK_HEADER.pack(PACK_MAGIC, PACK_VERSION, len(blobs),
+                              PACK_HEADER.size + len(body), zlib.crc32(body))
+    with open(out, 'wb') as f:
+        f.write(header + body)
+
+
+def main():
+    args = sys.argv[1:]
+    pack = args[:1] == ['--pack']
+    if pack:
+        args = args[1:]
+    if len(args) < 1 or (not pack and len(args) < 2):
+        sys.exit(__doc__)
+    out, paths = args[0], args[1:]
+
+    try:
+        layouts = [parse_layout(p) for p in paths]
+    except LayoutError as e:
+        sys.exit(f'gen_layouts: {e}')
+
+    codes = [layout.code for layout in layouts]
+    if len(set(codes)) != len(codes):
+        sys.exit('gen_layouts: duplicate layout code')
+
+    if pack:
+        write_pack(out, layouts)
+    else:
+        write_c(out, paths, layouts)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,24 @@
+#!/usr/bin/env python3
+"""Gzip a web asset for embedding in the firmware.
+
+Usage: gzip_asset.py <input> <output.gz>
+
+The header mtime is zeroed so identical input always gives identical
+output (and therefore the same ETag on the device).
+"""
+import gzip
+import sys
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    src, dst = sys.argv[1], sys.argv[2]
+    with open(src, 'rb') as f:
+        data = f.read()
+    with open(dst, 'wb') as f:
+        f.write(gzip.compress(data, compresslevel=9, mtime=0))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Build a web UI asset pack for the "spiffs" data partition.
+
+Usage: pack_assets.py <app.elf> <output.bin> <file> [<file> ...]
+
+Every file is stored gzipped (files already ending in .gz are stored
+as-is under their name without the suffix). The pack is memory-mapped
+by web_assets.c and served without copying; upload it with
+    curl --data-binary @www.bin http://<device>/assets
+or let `idf.py flash` write it. The pack carries the SHA-256 of the app
+ELF it was built with; other firmware ignores it and serves its embedded
+copies, so pass the .elf of the build that will run it.
+
+Layout (little endian):
+    header  magic "WWWP", u16 version, u16 count, u32 size, u32 crc32,
+            u8 elf_sha256[32]
+    entry   char name[32], char type[24], u32 offset, u32 length, u32 etag
+    data    gzipped files, each 4-byte aligned
+crc32 covers everything after the header; etag is the crc32 of the file data.
+"""
+import gzip
+import hashlib
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b'WWWP'
+VERSION = 2
+HEADER = struct.Struct('<4sHHII32s')
+ENTRY = struct.Struct('<32s24sIII')
+
+TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+    '.json': 'application/json',
+    '.svg': 'image/svg+xml',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+}
+
+
+def main():
+    if len(sys.argv) < 4:
+        sys.exit(__doc__)
+    elf_path, out_path, files = sys.argv[1], sys.argv[2], sys.argv[3:]
+
+    # Same hash esptool stores in esp_app_desc_t.app_elf_sha256
+    with open(elf_path, 'rb') as f:
+        elf_sha256 = hashlib.sha256(f.read()).digest()
+
+    entries = []
+    for path in files:
+        name = os.path.basename(path)
+        with open(path, 'rb') as f:
+            data = f.read()
+        if name.endswith('.gz'):
+            name = name[:-3]
+        else:
+            data = gzip.compress(data, compresslevel=9, mtime=0)
+        ext = os.path.splitext(name)[1]
+        if len(name.encode()) >= 32:
+            sys.exit('%s: name too long' % name)
+        entries.append((name, TYPES.get(ext, 'application/octet-stream'), data))
+
+    offset = HEADER.size + ENTRY.size * len(entries)
+    table = b''
+    blob = b''
+    for name, ctype, data in entries:
+        pad = (-offset) % 4
+        blob += b'\0' * pad
+        offset += pad
+        table += ENTRY.pack(name.encode(), ctype.encode(), offset, len(data), zlib.crc32(data))
+        blob += data
+        offset += len(data)
+
+    body = table + blob
+    header = HEADER.pack(MAGIC, VERSION, len(entries), HEADER.size + len(body), zlib.crc32(body),
+                         elf_sha256)
+    with open(out_path, 'wb') as f:
+        f.write(header + body)
+
+
+if __name__ == '__main__':
+    main()